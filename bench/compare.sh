@@ -0,0 +1,58 @@
+#!/bin/sh
+# usage: compare.sh baseline.json report.json [tolerance]
+#
+# Matches the runs of two loadgen reports by name and fails when one got
+# worse by more than tolerance (0.10 is 10%): lower mb_per_s, or higher
+# cpu_s_per_gb or syscalls_per_mb. Runs missing from either side and
+# metrics that are zero in the baseline are skipped.
+[ $# -ge 2 ] || { echo "usage: compare.sh baseline.json report.json [tolerance]" >&2; exit 2; }
+
+awk -v tol="${3:-0.10}" '
+function num(line, key, m)
+{
+	if (!match(line, "\"" key "\": [0-9.]+"))
+		return -1
+	m = substr(line, RSTART, RLENGTH)
+	sub(/.*: /, "", m)
+	return m + 0
+}
+function run(line)
+{
+	match(line, /"name": "[^"]*"/)
+	return substr(line, RSTART + 9, RLENGTH - 10)
+}
+# +1 where more is better, -1 where less is
+function check(name, key, sign, cur, base, change)
+{
+	base = baseline[name, key]
+	if (base <= 0 || cur < 0)
+		return
+	change = (cur - base) / base
+	bad = change * sign < -tol
+	printf "%-26s %-16s %12.3f %12.3f %+7.1f%%%s\n", name, key, base, cur,
+	       change * 100, bad ? "  REGRESSION" : ""
+	failed += bad
+}
+BEGIN {
+	nkeys = split("mb_per_s cpu_s_per_gb syscalls_per_mb", keys)
+	sign["mb_per_s"] = 1
+	sign["cpu_s_per_gb"] = -1
+	sign["syscalls_per_mb"] = -1
+	printf "%-26s %-16s %12s %12s %8s\n", "run", "metric", "baseline",
+	       "current", "change"
+}
+FNR == NR && /"name"/ {
+	for (i = 1; i <= nkeys; i++)
+		baseline[run($0), keys[i]] = num($0, keys[i])
+	next
+}
+FNR != NR && /"name"/ {
+	for (i = 1; i <= nkeys; i++)
+		check(run($0), keys[i], sign[keys[i]], num($0, keys[i]))
+}
+END {
+	if (failed)
+		printf "%d metrics regressed by more than %.0f%%\n", failed, tol * 100
+	exit failed > 0
+}
+' "$1" "$2"
@@ -0,0 +1,255 @@
+/*
+ * Compares the old flat connection slot against the hot/cold split one for
+ * the two access patterns the worker loop has: the drop-candidate sweep over
+ * every slot and dispatching events to random slots.
+ *
+ * usage: conn_layout [nslots...]   (default 10000 50000)
+ *
+ * Cache misses come from perf_event_open when the kernel lets us, otherwise
+ * only the time per slot is reported.
+ */
+#include <linux/perf_event.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../connection.h"
+#include "../mysock.h"
+
+#define ROUNDS 20
+
+/* the slot as it was before the split, everything inline */
+struct conn_flat
+{
+  enum conn_state_t m_state;
+  int m_file_descriptor;
+  struct sockaddr_storage m_sock_storage;
+  struct req_t m_req;
+  struct resp_t m_resp;
+  struct my_buffer rbuf;
+  struct my_buffer buf;
+  struct my_buffer body;
+  enum body_engine m_engine;
+  int m_body_fd;
+  size_t m_progr;
+};
+
+static volatile size_t sink;
+
+static int open_counter(void)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void flush_caches(void)
+{
+  static char *junk;
+  size_t i, len = 64 << 20;
+
+  if (!junk && !(junk = malloc(len)))
+  {
+    return;
+  }
+  for (i = 0; i < len; i += 64)
+  {
+    junk[i]++;
+  }
+}
+
+struct sample
+{
+  double ns;
+  long long misses;
+};
+
+#define MEASURE(res, nops, body)                                              \
+  do                                                                          \
+  {                                                                           \
+    long long cnt_ = -1;                                                      \
+    double t_;                                                                \
+    flush_caches();                                                           \
+    if (pfd >= 0)                                                             \
+    {                                                                         \
+      ioctl(pfd, PERF_EVENT_IOC_RESET, 0);                                    \
+      ioctl(pfd, PERF_EVENT_IOC_ENABLE, 0);                                   \
+    }                                                                         \
+    t_ = now();                                                               \
+    body;                                                                     \
+    t_ = now() - t_;                                                          \
+    if (pfd >= 0)                                                             \
+    {                                                                         \
+      ioctl(pfd, PERF_EVENT_IOC_DISABLE, 0);                                  \
+      if (read(pfd, &cnt_, sizeof(cnt_)) != sizeof(cnt_))                     \
+        cnt_ = -1;                                                            \
+    }                                                                         \
+    (res).ns = t_ * 1e9 / (nops);                                             \
+    (res).misses = cnt_;                                                      \
+  } while (0)
+
+static void report(const char *what, size_t n, const struct sample *flat,
+                   const struct sample *split, size_t nops)
+{
+  printf("%-8s nslots=%-7zu flat %8.2f ns/slot", what, n, flat->ns);
+  if (flat->misses >= 0)
+  {
+    printf(" %6.2f miss/slot", (double)flat->misses / nops);
+  }
+  printf("   split %8.2f ns/slot", split->ns);
+  if (split->misses >= 0)
+  {
+    printf(" %6.2f miss/slot", (double)split->misses / nops);
+  }
+  printf("\n");
+}
+
+static void run(size_t n, int pfd)
+{
+  struct conn_flat *flat;
+  struct conn_t *hot;
+  struct sockaddr_storage *peer;
+  struct sample sf, ss;
+  size_t i, r, acc, *order;
+
+  if (!(flat = calloc(n, sizeof(*flat))) ||
+      posix_memalign((void **)&hot, CACHE_LINE_SIZE, n * sizeof(*hot)) ||
+      !(peer = calloc(n, sizeof(*peer))) ||
+      !(order = malloc(n * sizeof(*order))))
+  {
+    perror("alloc");
+    exit(1);
+  }
+  memset(hot, 0, n * sizeof(*hot));
+
+  srand(1);
+  for (i = 0; i < n; i++)
+  {
+    uint32_t addr = 0x0a000000u | (rand() % 256);
+
+    flat[i].m_state = CONN_SEND_BODY;
+    flat[i].m_file_descriptor = (int)i + 3;
+    flat[i].m_sock_storage.ss_family = AF_INET;
+    ((struct sockaddr_in *)&flat[i].m_sock_storage)->sin_addr.s_addr = addr;
+    flat[i].m_resp.m_type = rand() % 3;
+    flat[i].m_progr = rand();
+
+    hot[i].m_state = flat[i].m_state;
+    hot[i].m_file_descriptor = flat[i].m_file_descriptor;
+    hot[i].m_peer = &peer[i];
+    peer[i] = flat[i].m_sock_storage;
+    hot[i].m_peer_key = get_socket_key(&peer[i]);
+    hot[i].m_type = flat[i].m_resp.m_type;
+    hot[i].m_progr = flat[i].m_progr;
+    order[i] = i;
+  }
+  for (i = n - 1; i > 0; i--)
+  {
+    size_t j = rand() % (i + 1), t = order[i];
+    order[i] = order[j];
+    order[j] = t;
+  }
+
+  /* one pass of the drop-candidate inner loop against a fixed peer */
+  MEASURE(sf, (double)n * ROUNDS, {
+    for (r = 0, acc = 0; r < ROUNDS; r++)
+      for (i = 0; i < n; i++)
+        if (flat[i].m_state == CONN_SEND_BODY &&
+            sockets_same_addr(&flat[i].m_sock_storage,
+                              &flat[r].m_sock_storage) &&
+            flat[i].m_resp.m_type <= flat[r].m_resp.m_type)
+          acc += flat[i].m_progr;
+    sink = acc;
+  });
+  MEASURE(ss, (double)n * ROUNDS, {
+    for (r = 0, acc = 0; r < ROUNDS; r++)
+      for (i = 0; i < n; i++)
+        if (hot[i].m_state == CONN_SEND_BODY &&
+            hot[i].m_peer_key == hot[r].m_peer_key &&
+            hot[i].m_type <= hot[r].m_type)
+          acc += hot[i].m_progr;
+    sink = acc;
+  });
+  report("sweep", n, &sf, &ss, n * ROUNDS);
+
+  /* events arrive for slots in no particular order */
+  MEASURE(sf, (double)n * ROUNDS, {
+    for (r = 0, acc = 0; r < ROUNDS; r++)
+      for (i = 0; i < n; i++)
+      {
+        struct conn_flat *c = &flat[order[i]];
+        if (c->m_file_descriptor && c->m_state == CONN_SEND_BODY)
+          acc += c->m_progr;
+      }
+    sink = acc;
+  });
+  MEASURE(ss, (double)n * ROUNDS, {
+    for (r = 0, acc = 0; r < ROUNDS; r++)
+      for (i = 0; i < n; i++)
+      {
+        struct conn_t *c = &hot[order[i]];
+        if (c->m_file_descriptor && c->m_state == CONN_SEND_BODY)
+          acc += c->m_progr;
+      }
+    sink = acc;
+  });
+  report("dispatch", n, &sf, &ss, n * ROUNDS);
+
+  free(flat);
+  free(hot);
+  free(peer);
+  free(order);
+}
+
+int main(int argc, char *argv[])
+{
+  static const size_t def[] = {10000, 50000};
+  int i, pfd;
+
+  printf("slot size: flat %zu bytes, hot %zu bytes + cold %zu bytes\n",
+         sizeof(struct conn_flat), sizeof(struct conn_t),
+         sizeof(struct conn_cold));
+  if ((pfd = open_counter()) < 0)
+  {
+    printf("perf_event_open unavailable, timing only\n");
+  }
+
+  if (argc > 1)
+  {
+    for (i = 1; i < argc; i++)
+    {
+      run(strtoul(argv[i], NULL, 10), pfd);
+    }
+  }
+  else
+  {
+    for (i = 0; i < (int)LEN(def); i++)
+    {
+      run(def[i], pfd);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,312 @@
+/*
+ * Streams one file over a loopback TCP connection with each body engine the
+ * server has and reports throughput and sender CPU time: the buffered
+ * pread/write path (prepare_file_buffer + send_buffer_http), splice through
+ * a pipe (send_splice_http) and sendfile (send_file_http). The same amount
+ * is then sent from one memory-resident buffer, copied (send_buffer_http)
+ * and pinned (send_buffer_zc_http), which is the MSG_ZEROCOPY comparison.
+ * Note that loopback delivery copies zerocopy pages anyway, so only a real
+ * NIC shows its full benefit.
+ *
+ * usage: file_engines [file [rounds]]
+ *
+ * Without a file a 256 MB temporary one is created. The page cache is warmed
+ * first, so this measures the engines rather than the disk.
+ */
+#define _GNU_SOURCE /* F_SETPIPE_SZ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../buffer.h"
+#include "../http.h"
+
+#define TMP_SIZE (256 * 1048576)
+
+enum engine
+{
+  RUN_READ_WRITE,
+  RUN_SPLICE,
+  RUN_SENDFILE,
+  RUN_MEM_COPY,
+  RUN_MEM_ZEROCOPY,
+  NUM_RUNS,
+};
+
+static const char *engine_str[] = {
+    [RUN_READ_WRITE] = "read/write",
+    [RUN_SPLICE] = "splice",
+    [RUN_SENDFILE] = "sendfile",
+    [RUN_MEM_COPY] = "mem copy",
+    [RUN_MEM_ZEROCOPY] = "mem zc",
+};
+
+static void *drain(void *arg)
+{
+  static char sink[1 << 20];
+  int fd = *(int *)arg;
+
+  while (read(fd, sink, sizeof(sink)) > 0)
+    ;
+  close(fd);
+
+  return NULL;
+}
+
+static int connect_pair(pthread_t *reader, int *rfd)
+{
+  struct sockaddr_in sa;
+  socklen_t len = sizeof(sa);
+  int lfd, fd;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+      bind(lfd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(lfd, 1) < 0 ||
+      getsockname(lfd, (struct sockaddr *)&sa, &len) < 0 ||
+      (fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+      connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+      (*rfd = accept(lfd, NULL, NULL)) < 0)
+  {
+    perror("loopback");
+    exit(1);
+  }
+  close(lfd);
+  pthread_create(reader, NULL, drain, rfd);
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+  return fd;
+}
+
+static double cpu_seconds(void)
+{
+  struct rusage ru;
+
+  getrusage(RUSAGE_THREAD, &ru);
+  return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+         (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void wait_writable(int fd)
+{
+  struct pollfd p = {fd, POLLOUT, 0};
+
+  poll(&p, 1, -1);
+}
+
+/* like CONN_WAIT_ZC: the buffer is reused only once the kernel let go */
+static int wait_zerocopy(int fd, uint32_t issued, uint32_t *done)
+{
+  struct pollfd p = {fd, 0, 0};
+
+  while (*done != issued)
+  {
+    poll(&p, 1, -1);
+    if (reap_zerocopy_http(fd, done))
+    {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/* same loop shape as serve_con: push until EAGAIN, then wait for POLLOUT */
+static void run(enum engine e, int file_fd, size_t size, double *wall,
+                double *cpu)
+{
+  struct resp_t res;
+  struct my_buffer buf;
+  pthread_t reader;
+  int fd, rfd, pipe_fd[2];
+  size_t progress = 0, fill = 0, in_pipe = 0;
+  uint32_t zc_issued = 0, zc_done = 0;
+  double t, c;
+
+  memset(&res, 0, sizeof(res));
+  res.m_file.lower = 0;
+  res.m_file.upper = size - 1;
+  res.m_file.fd = file_fd;
+  memset(&buf, 0, sizeof(buf));
+  buf.size = BULK_BUFFER_MAX;
+  if (!(buf.data = malloc(buf.size)) ||
+      pipe2(pipe_fd, O_NONBLOCK | O_CLOEXEC) < 0)
+  {
+    perror("setup");
+    exit(1);
+  }
+  fcntl(pipe_fd[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+  fd = connect_pair(&reader, &rfd);
+  if (e == RUN_MEM_ZEROCOPY &&
+      setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &(int){1}, sizeof(int)) < 0)
+  {
+    perror("SO_ZEROCOPY");
+    exit(1);
+  }
+  if (e == RUN_MEM_COPY || e == RUN_MEM_ZEROCOPY)
+  {
+    memset(buf.data, 'x', buf.size);
+  }
+
+  t = now();
+  c = cpu_seconds();
+  while (progress < size)
+  {
+    switch (e)
+    {
+    case RUN_READ_WRITE:
+      if (buf.length == 0 && prepare_file_buffer(&res, &buf, &fill))
+      {
+        goto fail;
+      }
+      if (send_buffer_http(fd, NULL, &buf))
+      {
+        goto fail;
+      }
+      progress = fill - (buf.length - buf.offset);
+      break;
+    case RUN_SPLICE:
+      if (send_splice_http(fd, file_fd, pipe_fd, &res, &progress, &in_pipe,
+                           SIZE_MAX))
+      {
+        goto fail;
+      }
+      break;
+    case RUN_SENDFILE:
+      if (send_file_http(fd, file_fd, &res, &progress, SIZE_MAX))
+      {
+        goto fail;
+      }
+      break;
+    case RUN_MEM_COPY:
+    case RUN_MEM_ZEROCOPY:
+      if (buf.length == 0)
+      {
+        if (wait_zerocopy(fd, zc_issued, &zc_done))
+        {
+          goto fail;
+        }
+        buf.length = MIN(buf.size, size - fill);
+        fill += buf.length;
+      }
+      if (e == RUN_MEM_COPY ? send_buffer_http(fd, NULL, &buf)
+                            : send_buffer_zc_http(fd, &buf, &zc_issued))
+      {
+        goto fail;
+      }
+      progress = fill - (buf.length - buf.offset);
+      break;
+    default:
+      break;
+    }
+    if (progress < size)
+    {
+      wait_writable(fd);
+    }
+  }
+  if (wait_zerocopy(fd, zc_issued, &zc_done))
+  {
+    goto fail;
+  }
+  close(fd);
+  pthread_join(reader, NULL);
+  *wall = now() - t;
+  *cpu = cpu_seconds() - c;
+
+  close(pipe_fd[0]);
+  close(pipe_fd[1]);
+  free(buf.data);
+  return;
+fail:
+  fprintf(stderr, "%s failed: %s\n", engine_str[e], strerror(errno));
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  static char chunk[1 << 20];
+  char tmpl[] = "/tmp/file_engines.XXXXXX";
+  const char *path = NULL;
+  struct stat st;
+  double wall, cpu, best_wall, best_cpu, gb;
+  int fd, rounds = 3, i, e;
+  size_t done;
+
+  if (argc > 1)
+  {
+    path = argv[1];
+  }
+  if (argc > 2)
+  {
+    rounds = atoi(argv[2]);
+  }
+
+  if (path)
+  {
+    fd = open(path, O_RDONLY);
+  }
+  else if ((fd = mkstemp(tmpl)) >= 0)
+  {
+    unlink(tmpl);
+    memset(chunk, 'x', sizeof(chunk));
+    for (done = 0; done < TMP_SIZE; done += sizeof(chunk))
+    {
+      if (write(fd, chunk, sizeof(chunk)) != sizeof(chunk))
+      {
+        perror("write");
+        return 1;
+      }
+    }
+  }
+  if (fd < 0 || fstat(fd, &st) < 0 || st.st_size == 0)
+  {
+    perror("open");
+    return 1;
+  }
+
+  // warm the page cache
+  for (done = 0; pread(fd, chunk, sizeof(chunk), done) > 0;
+       done += sizeof(chunk))
+    ;
+
+  gb = st.st_size / 1e9;
+  printf("%-10s %10s %10s %12s\n", "engine", "MB/s", "wall s", "cpu s/GB");
+  for (e = 0; e < NUM_RUNS; e++)
+  {
+    best_wall = best_cpu = 0;
+    for (i = 0; i < rounds; i++)
+    {
+      run(e, fd, st.st_size, &wall, &cpu);
+      if (i == 0 || wall < best_wall)
+      {
+        best_wall = wall;
+        best_cpu = cpu;
+      }
+    }
+    printf("%-10s %10.1f %10.3f %12.3f\n", engine_str[e],
+           st.st_size / best_wall / 1e6, best_wall, best_cpu / gb);
+  }
+
+  return 0;
+}
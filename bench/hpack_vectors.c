@@ -0,0 +1,310 @@
+/*
+ * The header block examples of RFC 7541 Appendix C run through the HPACK
+ * decoder: C.2 one field of each representation, C.3 and C.4 three requests
+ * over one dynamic table, plain and Huffman coded, C.5 and C.6 three
+ * responses over a 256 byte table, which makes them evict. After each block
+ * the decoded fields, the dynamic table newest first and its size are
+ * checked against the RFC. The requests are then decoded again, on a fresh
+ * table, by h2_request into the HTTP/1.1 header the server goes on with.
+ *
+ * usage: hpack_vectors
+ *
+ * Prints one line per block and exits nonzero if any of them failed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../h2.h"
+#include "../util.h"
+
+struct vector
+{
+  const char *m_name;
+  const char *m_hex;    /* the header block, spaces are ignored */
+  const char *m_fields; /* decoded, one "name: value\n" each */
+  const char *m_table;  /* the dynamic table after it, newest first */
+  size_t m_size;
+  const char *m_request; /* h2_request's output, NULL for responses */
+};
+
+struct group
+{
+  size_t m_max; /* the decoder's table size */
+  const struct vector *m_vec;
+  int m_count;
+};
+
+#define GET_EXAMPLE "GET / HTTP/1.1\r\nHost: www.example.com\r\n\r\n"
+#define GET_INDEX "GET /index.html HTTP/1.1\r\nHost: www.example.com\r\n\r\n"
+
+static const struct vector literals[] = {
+    {"C.2.1", "400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164"
+              "6572",
+     "custom-key: custom-header\n", "custom-key: custom-header\n", 55, NULL},
+    {"C.2.2", "040c 2f73 616d 706c 652f 7061 7468", ":path: /sample/path\n",
+     "", 0, NULL},
+    {"C.2.3", "1008 7061 7373 776f 7264 0673 6563 7265 74",
+     "password: secret\n", "", 0, NULL},
+    {"C.2.4", "82", ":method: GET\n", "", 0, NULL},
+};
+
+static const struct vector requests[] = {
+    {"C.3.1", "8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+     ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n",
+     ":authority: www.example.com\n", 57, GET_EXAMPLE},
+    {"C.3.2", "8286 84be 5808 6e6f 2d63 6163 6865",
+     ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n"
+     "cache-control: no-cache\n",
+     "cache-control: no-cache\n:authority: www.example.com\n", 110,
+     GET_EXAMPLE},
+    {"C.3.3", "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d"
+              "7661 6c75 65",
+     ":method: GET\n:scheme: https\n:path: /index.html\n"
+     ":authority: www.example.com\ncustom-key: custom-value\n",
+     "custom-key: custom-value\ncache-control: no-cache\n"
+     ":authority: www.example.com\n",
+     164, GET_INDEX},
+};
+
+static const struct vector requests_huffman[] = {
+    {"C.4.1", "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff",
+     ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n",
+     ":authority: www.example.com\n", 57, GET_EXAMPLE},
+    {"C.4.2", "8286 84be 5886 a8eb 1064 9cbf",
+     ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n"
+     "cache-control: no-cache\n",
+     "cache-control: no-cache\n:authority: www.example.com\n", 110,
+     GET_EXAMPLE},
+    {"C.4.3", "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf",
+     ":method: GET\n:scheme: https\n:path: /index.html\n"
+     ":authority: www.example.com\ncustom-key: custom-value\n",
+     "custom-key: custom-value\ncache-control: no-cache\n"
+     ":authority: www.example.com\n",
+     164, GET_INDEX},
+};
+
+#define DATE_21 "date: Mon, 21 Oct 2013 20:13:21 GMT\n"
+#define DATE_22 "date: Mon, 21 Oct 2013 20:13:22 GMT\n"
+#define LOCATION "location: https://www.example.com\n"
+#define COOKIE                                                               \
+  "set-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1\n"
+
+static const struct vector responses[] = {
+    {"C.5.1", "4803 3330 3258 0770 7269 7661 7465 611d 4d6f 6e2c 2032 3120"
+              "4f63 7420 3230 3133 2032 303a 3133 3a32 3120 474d 546e 1768"
+              "7474 7073 3a2f 2f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+     ":status: 302\ncache-control: private\n" DATE_21 LOCATION,
+     LOCATION DATE_21 "cache-control: private\n:status: 302\n", 222, NULL},
+    {"C.5.2", "4803 3330 37c1 c0bf",
+     ":status: 307\ncache-control: private\n" DATE_21 LOCATION,
+     ":status: 307\n" LOCATION DATE_21 "cache-control: private\n", 222, NULL},
+    {"C.5.3", "88c1 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a"
+              "3133 3a32 3220 474d 54c0 5a04 677a 6970 7738 666f 6f3d 4153"
+              "444a 4b48 514b 425a 584f 5157 454f 5049 5541 5851 5745 4f49"
+              "553b 206d 6178 2d61 6765 3d33 3630 303b 2076 6572 7369 6f6e"
+              "3d31",
+     ":status: 200\ncache-control: private\n" DATE_22 LOCATION
+     "content-encoding: gzip\n" COOKIE,
+     COOKIE "content-encoding: gzip\n" DATE_22, 215, NULL},
+};
+
+static const struct vector responses_huffman[] = {
+    {"C.6.1", "4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005"
+              "9504 0b81 66e0 82a6 2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8"
+              "e9ae 82ae 43d3",
+     ":status: 302\ncache-control: private\n" DATE_21 LOCATION,
+     LOCATION DATE_21 "cache-control: private\n:status: 302\n", 222, NULL},
+    {"C.6.2", "4883 640e ffc1 c0bf",
+     ":status: 307\ncache-control: private\n" DATE_21 LOCATION,
+     ":status: 307\n" LOCATION DATE_21 "cache-control: private\n", 222, NULL},
+    {"C.6.3", "88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d"
+              "1bff c05a 839b d9ab 77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b"
+              "3960 d5af 2708 7f36 72c1 ab27 0fb5 291f 9587 3160 65c0 03ed"
+              "4ee5 b106 3d50 07",
+     ":status: 200\ncache-control: private\n" DATE_22 LOCATION
+     "content-encoding: gzip\n" COOKIE,
+     COOKIE "content-encoding: gzip\n" DATE_22, 215, NULL},
+};
+
+#define GROUP(max, a) {max, a, (int)LEN(a)}
+
+/* each C.2 block starts on an empty table, C.5 and C.6 agree on 256 bytes */
+static const struct group groups[] = {
+    GROUP(4096, literals),  GROUP(4096, requests),
+    GROUP(4096, requests_huffman), GROUP(256, responses),
+    GROUP(256, responses_huffman),
+};
+
+static size_t unhex(const char *hex, unsigned char *out)
+{
+  size_t n = 0;
+  unsigned int b;
+
+  for (; *hex; hex++)
+  {
+    if (*hex != ' ' && sscanf(hex, "%2x", &b) == 1)
+    {
+      out[n++] = b;
+      hex++;
+    }
+  }
+
+  return n;
+}
+
+struct text
+{
+  char m_data[1024];
+  size_t m_len;
+};
+
+static void append(struct text *t, const char *name, size_t nlen,
+                   const char *value, size_t vlen)
+{
+  int n;
+
+  n = snprintf(t->m_data + t->m_len, sizeof(t->m_data) - t->m_len,
+               "%.*s: %.*s\n", (int)nlen, name, (int)vlen, value);
+  if (n > 0)
+  {
+    t->m_len += n;
+  }
+}
+
+static int collect(void *arg, const char *name, size_t nlen,
+                   const char *value, size_t vlen)
+{
+  if (name == NULL || value == NULL)
+  {
+    return -1;
+  }
+  append(arg, name, nlen, value, vlen);
+
+  return 0;
+}
+
+static void table_text(const struct hpack_table *t, struct text *out)
+{
+  const struct hpack_entry *e;
+  size_t i;
+
+  for (i = 0; i < t->m_count; i++)
+  {
+    e = &t->m_entry[(t->m_first + i) % H2_TABLE_ENTRIES];
+    append(out, e->m_name, e->m_nlen, e->m_value, e->m_vlen);
+  }
+}
+
+static int check(const char *name, const char *what, const char *got,
+                 const char *want)
+{
+  if (strcmp(got, want) == 0)
+  {
+    return 0;
+  }
+  printf("%-6s FAIL %s\n--- got\n%s--- want\n%s", name, what, got, want);
+
+  return 1;
+}
+
+/* the blocks of a group in order, over one table */
+static int decode_group(const struct group *g)
+{
+  struct hpack_table t;
+  struct text fields, table;
+  unsigned char block[256];
+  size_t len;
+  int i, failed = 0, bad;
+
+  hpack_init(&t);
+  t.m_max = g->m_max;
+  for (i = 0; i < g->m_count; i++)
+  {
+    const struct vector *v = &g->m_vec[i];
+
+    if (g->m_vec == literals)
+    {
+      hpack_free(&t);
+      t.m_max = g->m_max;
+    }
+    len = unhex(v->m_hex, block);
+    fields.m_len = table.m_len = 0;
+    fields.m_data[0] = table.m_data[0] = '\0';
+    if (hpack_decode(&t, block, len, collect, &fields))
+    {
+      printf("%-6s FAIL decode error\n", v->m_name);
+      failed++;
+      continue;
+    }
+    table_text(&t, &table);
+    bad = check(v->m_name, "fields", fields.m_data, v->m_fields);
+    bad |= check(v->m_name, "table", table.m_data, v->m_table);
+    if (t.m_size != v->m_size)
+    {
+      printf("%-6s FAIL table size %zu, want %zu\n", v->m_name, t.m_size,
+             v->m_size);
+      bad = 1;
+    }
+    printf("%-6s %s\n", v->m_name, bad ? "FAIL" : "ok");
+    failed += bad;
+  }
+  hpack_free(&t);
+
+  return failed;
+}
+
+/* the same requests again, as the server takes them */
+static int request_group(const struct group *g)
+{
+  struct hpack_table t;
+  unsigned char block[256];
+  char out[512];
+  size_t len;
+  int i, failed = 0, err, bad;
+
+  hpack_init(&t);
+  t.m_max = g->m_max;
+  for (i = 0; i < g->m_count; i++)
+  {
+    const struct vector *v = &g->m_vec[i];
+
+    if (v->m_request == NULL)
+    {
+      continue;
+    }
+    len = unhex(v->m_hex, block);
+    if ((err = h2_request(&t, block, len, out, sizeof(out))))
+    {
+      printf("%-6s FAIL h2_request error %d\n", v->m_name, err);
+      failed++;
+      continue;
+    }
+    bad = check(v->m_name, "request", out, v->m_request);
+    printf("%-6s %s h2_request\n", v->m_name, bad ? "FAIL" : "ok");
+    failed += bad;
+  }
+  hpack_free(&t);
+
+  return failed;
+}
+
+int main(void)
+{
+  int i, failed = 0;
+
+  for (i = 0; i < (int)LEN(groups); i++)
+  {
+    failed += decode_group(&groups[i]);
+  }
+  for (i = 0; i < (int)LEN(groups); i++)
+  {
+    failed += request_group(&groups[i]);
+  }
+  if (failed)
+  {
+    printf("%d failed\n", failed);
+  }
+
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,275 @@
+/*
+ * Microbenchmarks for the per-request HTTP functions: parse_header_http,
+ * decode, norm_path, handle_range, prep_header_buf_http, html_escape and the
+ * MIME lookup, each over a small corpus of realistic input including the
+ * percent-encoded Cyrillic paths from the README.
+ *
+ * usage: http_hot [-n iterations | -t seconds] [name...]
+ *
+ * Without -n every benchmark doubles its iteration count until one run takes
+ * at least -t seconds (0.5 by default). B/op is the input consumed, or the
+ * output produced for the formatters, per call. Most of these are static, so
+ * http.c and buffer.c are compiled right into this file.
+ */
+#define _GNU_SOURCE
+#include "../http.c"
+#include "../buffer.c"
+
+#include <stdlib.h>
+
+static const char *headers[] = {
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: curl/7.88.1\r\n"
+    "Accept: */*\r\n"
+    "\r\n",
+
+    "GET /files/ HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "Connection: keep-alive\r\n"
+    "Cache-Control: max-age=0\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, "
+    "like Gecko) Chrome/119.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/"
+    "avif,image/webp,image/apng,*/*;q=0.8\r\n"
+    "Sec-Fetch-Site: none\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: ru-RU,ru;q=0.9,en-US;q=0.8,en;q=0.7\r\n"
+    "If-Modified-Since: Thu, 30 Nov 2023 12:00:00 GMT\r\n"
+    "\r\n",
+
+    "GET /files/%D0%BA%D0%BE%D1%82%D0%B5%D0%BD%D0%BE%D0%BA.jpg?asd=sdfdds"
+    "#dsfdsf HTTP/1.1\r\n"
+    "Host: localhost\r\n"
+    "Range: bytes=0-1023\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+
+    "HEAD /video.mp4 HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8080\r\n"
+    "Range: bytes=1048576-\r\n"
+    "\r\n",
+};
+
+static const char *encoded[] = {
+    "/index.html",
+    "/files/%D0%BA%D0%BE%D1%82%D0%B5%D0%BD%D0%BE%D0%BA.jpg",
+    "/%D0%94%D0%BE%D0%BA%D1%83%D0%BC%D0%B5%D0%BD%D1%82%D1%8B/"
+    "%D0%BE%D1%82%D1%87%D1%91%D1%82%202023.pdf",
+    "/files/dir2/file.txt",
+};
+
+static const char *decoded[] = {
+    "/index.html",
+    "/files/котенок.jpg",
+    "/files/dir2/../dir2/./file.txt",
+    "//files///todo.md",
+    "/Документы/отчёт 2023.pdf",
+};
+
+static const char *ranges[] = {
+    "bytes=0-1023",
+    "bytes=1048576-",
+    "bytes=-500",
+    "bytes=1000-1999999",
+};
+
+static const char *names[] = {
+    "kitty.jpeg",
+    "котенок.jpg",
+    "<script>alert(\"x\")</script>.html",
+    "Tom & Jerry's.mp4",
+};
+
+static const char *mime_paths[] = {
+    "/index.html", "/kitty.jpeg",     "/files/todo.md",
+    "/video.mp4",  "/style.css",      "/interaction.js",
+};
+
+static struct req_t req;
+static struct resp_t resp[3];
+static struct my_buffer hdr;
+static char path[PATH_MAX], out[PATH_MAX];
+static volatile size_t sink;
+
+static size_t run_parse(size_t i)
+{
+  const char *h = headers[i % LEN(headers)];
+
+  sink += parse_header_http(h, &req);
+  return strlen(h);
+}
+
+static size_t run_decode(size_t i)
+{
+  const char *p = encoded[i % LEN(encoded)];
+  size_t n = strlen(p) + 1;
+
+  memcpy(path, p, n);
+  decode(path, out);
+  sink += out[0];
+  return n - 1;
+}
+
+/* the copy is part of the op, norm_path works in place */
+static size_t run_norm_path(size_t i)
+{
+  const char *p = decoded[i % LEN(decoded)];
+  size_t n = strlen(p) + 1;
+  int redirect = 0;
+
+  memcpy(path, p, n);
+  sink += norm_path(path, &redirect) + redirect;
+  return n - 1;
+}
+
+static size_t run_range(size_t i)
+{
+  const char *r = ranges[i % LEN(ranges)];
+  size_t lower, upper;
+
+  sink += handle_range(r, 30000000, &lower, &upper) + lower + upper;
+  return strlen(r);
+}
+
+static size_t run_prep_header(size_t i)
+{
+  sink += prep_header_buf_http(&resp[i % LEN(resp)], &hdr);
+  return hdr.length;
+}
+
+static size_t run_html_escape(size_t i)
+{
+  html_escape(names[i % LEN(names)], out, sizeof(out));
+  sink += out[0];
+  return strlen(out);
+}
+
+static size_t run_mime(size_t i)
+{
+  const char *p = mime_paths[i % LEN(mime_paths)];
+
+  sink += (size_t)get_mime_type(p);
+  return strlen(p);
+}
+
+static const struct
+{
+  const char *m_name;
+  size_t (*m_fn)(size_t);
+} benches[] = {
+    {"parse_header_http", run_parse},
+    {"decode", run_decode},
+    {"norm_path", run_norm_path},
+    {"handle_range", run_range},
+    {"prep_header_buf_http", run_prep_header},
+    {"html_escape", run_html_escape},
+    {"mime_lookup", run_mime},
+};
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void setup(void)
+{
+  init_canned_http();
+  hdr.size = HEADER_BUFFER_SIZE;
+  if (!(hdr.data = malloc(hdr.size)))
+  {
+    die("malloc:");
+  }
+
+  // a plain file, a ranged one and a canned 304
+  resp[0].m_type = RESTYPE_FILE;
+  resp[0].m_status = STATUS_OK;
+  resp[0].m_keep_alive = 1;
+  strcpy(resp[0].m_field[RES_ACCEPT_RANGES], "bytes");
+  strcpy(resp[0].m_field[RES_CONTENT_LENGTH], "647278");
+  strcpy(resp[0].m_field[RES_CONTENT_TYPE], "image/jpeg");
+  strcpy(resp[0].m_field[RES_LAST_MODIFIED], "Thu, 30 Nov 2023 12:00:00 GMT");
+  resp[1] = resp[0];
+  strcpy(resp[1].m_field[RES_CONTENT_LENGTH], "1024");
+  strcpy(resp[1].m_field[RES_CONTENT_RANGE], "bytes 0-1023/81362");
+  resp[2].m_type = RESTYPE_FILE;
+  resp[2].m_status = STATUS_NOT_MODIFIED;
+  resp[2].m_keep_alive = 1;
+}
+
+static int selected(int argc, char *argv[], const char *name)
+{
+  int i;
+
+  if (optind == argc)
+  {
+    return 1;
+  }
+  for (i = optind; i < argc; i++)
+  {
+    if (!strcmp(argv[i], name))
+    {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  size_t b, i, iters, fixed = 0, bytes;
+  double min_time = 0.5, t;
+  int ch;
+
+  while ((ch = getopt(argc, argv, "n:t:")) != -1)
+  {
+    switch (ch)
+    {
+    case 'n':
+      fixed = strtoul(optarg, NULL, 10);
+      break;
+    case 't':
+      min_time = atof(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: http_hot [-n iterations | -t seconds] "
+                      "[name...]\n");
+      return 1;
+    }
+  }
+  setup();
+
+  printf("%-22s %12s %10s %8s %10s\n", "benchmark", "iterations", "ns/op",
+         "B/op", "MB/s");
+  for (b = 0; b < LEN(benches); b++)
+  {
+    if (!selected(argc, argv, benches[b].m_name))
+    {
+      continue;
+    }
+    for (iters = fixed ? fixed : 1;; iters *= 2)
+    {
+      bytes = 0;
+      t = now();
+      for (i = 0; i < iters; i++)
+      {
+        bytes += benches[b].m_fn(i);
+      }
+      t = now() - t;
+      if (fixed || t >= min_time)
+      {
+        break;
+      }
+    }
+    printf("%-22s %12zu %10.1f %8.1f %10.1f\n", benches[b].m_name, iters,
+           t * 1e9 / iters, (double)bytes / iters, bytes / t / 1e6);
+  }
+
+  return 0;
+}
@@ -0,0 +1,75 @@
+#!/bin/sh
+# Large file streaming per body engine. A sparse $HUGE byte file (10 GB by
+# default) and a random $DENSE byte one are served from a temp dir and
+# downloaded by $CONNS concurrent clients for $DURATION seconds, whole and as
+# a range, by each of $ENGINES (read/write through buffers, sendfile, splice,
+# io_uring). Every engine's server runs under bench/syscount.so, so besides
+# the throughput each run reports the server's CPU seconds per GB and
+# syscalls per MB. Run through `make bench-large`, as root.
+#
+# The report goes to bench/results/large_files.json and is checked against
+# $BASELINE by bench/compare.sh, failing past $TOLERANCE. UPDATE_BASELINE=1
+# stores the report as the new baseline instead.
+set -e
+cd "$(dirname "$0")/.."
+
+PORT=${PORT:-8090}
+BENCH_USER=${BENCH_USER:-www}
+DURATION=${DURATION:-5}
+CONNS=${CONNS:-4}
+HUGE=${HUGE:-10737418240}
+DENSE=${DENSE:-268435456}
+ENGINES=${ENGINES:-buffer sendfile splice uring}
+BASELINE=${BASELINE:-bench/baseline/large_files.json}
+TOLERANCE=${TOLERANCE:-0.10}
+report=bench/results/large_files.json
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+mkdir "$tmp/www"
+truncate -s "$HUGE" "$tmp/www/sparse.bin"
+head -c "$DENSE" /dev/urandom > "$tmp/www/dense.bin"
+chmod -R a+rX "$tmp/www"
+mkdir -p bench/results
+
+scenario()
+{
+	name=$1
+	shift
+	[ -n "$sep" ] && echo ","
+	sep=1
+	./bench/loadgen -P "$PORT" -c "$CONNS" -d "$DURATION" -m "$pid" \
+		-C "$tmp/syscount" -n "$engine/$name" "$@"
+}
+
+sep=
+{
+	echo "["
+	for engine in $ENGINES; do
+		SYSCOUNT_FILE="$tmp/syscount" LD_PRELOAD="$PWD/bench/syscount.so" \
+			./bench/server_engine_$engine -s 64 "$PORT" "$BENCH_USER" \
+			"$tmp/www" >/dev/null 2>&1 &
+		pid=$!
+		sleep 1
+		scenario sparse_full /sparse.bin
+		scenario sparse_range -R "bytes=$((HUGE / 4))-$((HUGE / 2 - 1))" \
+			/sparse.bin
+		scenario dense_full /dense.bin
+		scenario dense_range -R "bytes=$((DENSE / 4))-$((DENSE / 2 - 1))" \
+			/dense.bin
+		kill $pid
+		wait $pid || true
+	done
+	echo "]"
+} >$report
+echo "large files: $report"
+
+if [ "$UPDATE_BASELINE" = 1 ]; then
+	mkdir -p "$(dirname "$BASELINE")"
+	cp $report "$BASELINE"
+	echo "baseline stored in $BASELINE"
+elif [ -f "$BASELINE" ]; then
+	sh bench/compare.sh "$BASELINE" $report "$TOLERANCE"
+else
+	echo "no baseline at $BASELINE, UPDATE_BASELINE=1 stores one"
+fi
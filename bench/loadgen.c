@@ -0,0 +1,771 @@
+/*
+ * HTTP load generator: one epoll loop driving keep-alive connections to the
+ * server, each with up to depth pipelined requests in flight.
+ *
+ * Closed loop (the default) sends the next request as soon as a response is
+ * in. With -r the requests are due at a constant rate instead, and latency
+ * counts from when a request was due rather than when a connection got
+ * around to sending it, so a stalled server can't hide its queueing.
+ *
+ * With -i the run first parks that many idle connections on the server,
+ * each after one keep-alive request, or halfway through its header with -s,
+ * and reports how many the server still holds at the end. With -m the
+ * server's RSS is sampled before and after they were opened and its
+ * /__stats counters around the run, giving memory per idle connection and
+ * the event rate out of queue_wait, along with the CPU time it spent per GB
+ * received. -C names the counter file of a server started under
+ * bench/syscount.so and adds its syscalls per MB.
+ *
+ * usage: loadgen [-a addr] [-P port] [-c conns] [-p depth] [-d seconds]
+ *                [-r rate] [-R range] [-i idle [-s]] [-m server_pid]
+ *                [-C syscount_file] [-n name] path
+ *
+ * One JSON object describing the run is printed on stdout.
+ */
+#define _GNU_SOURCE /* strcasestr */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../util.h"
+
+#define DEPTH_MAX 64
+#define HDR_MAX 8192
+#define READ_SIZE (256 * 1024)
+#define IDLE_PER_ADDR 20000 // below the default ephemeral port range
+
+struct conn
+{
+  int fd;
+  size_t out_off, out_len; // into the repeated request template
+  uint64_t due[DEPTH_MAX]; // when each in-flight request was due
+  size_t head, inflight;
+  char hdr[HDR_MAX];
+  size_t hlen;
+  int in_body, until_eof, closing, status, out_armed;
+  size_t body_left;
+};
+
+/* an idle connection only has to notice the server closing it */
+struct idle
+{
+  int fd;
+};
+
+struct server_stats
+{
+  long rss_kb;
+  double cpu_s;
+  uint64_t syscalls;
+  uint64_t accepted, evicted, waits, events;
+};
+
+static struct
+{
+  const char *addr, *name, *path, *range, *syscount;
+  int port, slow, pid;
+  size_t conns, depth, idle;
+  double duration, rate;
+} opt = {"127.0.0.1", "run", NULL, NULL, NULL, 8080, 0, 0, 8, 1, 0, 5, 0};
+
+static char *reqbuf;
+static size_t reqlen;
+static struct sockaddr_in sa;
+static int efd;
+
+static uint64_t *lat;
+static size_t nlat, lat_cap;
+static size_t errors, reconnects;
+static uint64_t bytes;
+
+static struct idle *idle;
+static size_t idle_open;
+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void usage(void)
+{
+  fprintf(stderr, "usage: loadgen [-a addr] [-P port] [-c conns] [-p depth] "
+                  "[-d seconds] [-r rate] [-R range] [-i idle [-s]] "
+                  "[-m server_pid] [-C syscount_file] [-n name] path\n");
+  exit(1);
+}
+
+static void record(uint64_t ns)
+{
+  if (nlat == lat_cap)
+  {
+    lat_cap = lat_cap ? lat_cap * 2 : 65536;
+    if (!(lat = realloc(lat, lat_cap * sizeof(*lat))))
+    {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  lat[nlat++] = ns;
+}
+
+static int open_conn(struct conn *c)
+{
+  struct epoll_event ev = {EPOLLIN, {.ptr = c}};
+
+  if ((c->fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+      connect(c->fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+  {
+    perror("connect");
+    exit(1);
+  }
+  setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+  fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+  if (epoll_ctl(efd, EPOLL_CTL_ADD, c->fd, &ev) < 0)
+  {
+    perror("epoll_ctl");
+    exit(1);
+  }
+  c->out_off = c->out_len = 0;
+  c->head = c->inflight = 0;
+  c->hlen = 0;
+  c->in_body = c->until_eof = c->closing = c->out_armed = 0;
+
+  return 0;
+}
+
+/* whatever was still in flight on a closed connection is lost */
+static void reopen_conn(struct conn *c)
+{
+  close(c->fd);
+  errors += c->inflight;
+  reconnects++;
+  open_conn(c);
+}
+
+static void want_out(struct conn *c, int on)
+{
+  struct epoll_event ev = {EPOLLIN | (on ? EPOLLOUT : 0), {.ptr = c}};
+
+  if (c->out_armed != on)
+  {
+    epoll_ctl(efd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->out_armed = on;
+  }
+}
+
+static int flush_conn(struct conn *c)
+{
+  ssize_t w;
+  size_t off;
+
+  while (c->out_len > 0)
+  {
+    // the template holds depth + 1 copies, any offset has a whole run ahead
+    off = c->out_off % reqlen;
+    if ((w = send(c->fd, reqbuf + off, c->out_len, MSG_NOSIGNAL)) < 0)
+    {
+      if (errno == EAGAIN)
+      {
+        want_out(c, 1);
+        return 0;
+      }
+      return -1;
+    }
+    c->out_off += w;
+    c->out_len -= w;
+  }
+  want_out(c, 0);
+
+  return 0;
+}
+
+static void send_req(struct conn *c, uint64_t due)
+{
+  c->due[(c->head + c->inflight) % DEPTH_MAX] = due;
+  c->inflight++;
+  c->out_len += reqlen;
+}
+
+static void complete(struct conn *c, uint64_t now)
+{
+  record(now - c->due[c->head]);
+  if (c->status < 200 || c->status >= 400)
+  {
+    errors++;
+  }
+  c->head = (c->head + 1) % DEPTH_MAX;
+  c->inflight--;
+  c->in_body = 0;
+}
+
+static int parse_header(struct conn *c, size_t end)
+{
+  const char *p;
+
+  c->hdr[end] = '\0';
+  if (sscanf(c->hdr, "HTTP/1.%*d %d", &c->status) != 1)
+  {
+    return -1;
+  }
+  c->closing = strcasestr(c->hdr, "\nconnection: close") != NULL;
+  if ((p = strcasestr(c->hdr, "\ncontent-length:")))
+  {
+    c->body_left = strtoull(p + sizeof("\ncontent-length:") - 1, NULL, 10);
+    c->until_eof = 0;
+  }
+  else
+  {
+    c->body_left = 0;
+    c->until_eof = 1;
+  }
+  c->in_body = 1;
+
+  return 0;
+}
+
+/* -1 on a protocol error, 1 once the server wants the connection closed */
+static int consume(struct conn *c, const char *p, size_t n, uint64_t now)
+{
+  size_t k, old;
+  char *end;
+
+  while (n > 0)
+  {
+    if (!c->in_body)
+    {
+      if (c->inflight == 0)
+      {
+        return -1;
+      }
+      old = c->hlen;
+      k = MIN(n, HDR_MAX - 1 - c->hlen);
+      memcpy(c->hdr + c->hlen, p, k);
+      c->hlen += k;
+      c->hdr[c->hlen] = '\0';
+      if (!(end = strstr(c->hdr + (old > 3 ? old - 3 : 0), "\r\n\r\n")))
+      {
+        if (c->hlen == HDR_MAX - 1)
+        {
+          return -1;
+        }
+        bytes += k;
+        return 0;
+      }
+      k = end + 4 - c->hdr - old;
+      bytes += k;
+      p += k;
+      n -= k;
+      c->hlen = 0;
+      if (parse_header(c, end - c->hdr))
+      {
+        return -1;
+      }
+    }
+    else
+    {
+      k = c->until_eof ? n : MIN(n, c->body_left);
+      c->body_left -= c->until_eof ? 0 : k;
+      bytes += k;
+      p += k;
+      n -= k;
+    }
+    if (c->in_body && !c->until_eof && c->body_left == 0)
+    {
+      complete(c, now);
+      if (c->closing)
+      {
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Blocking connect: the server accepts from every worker, a full backlog
+ * only delays us. Loopback targets get a source address per IDLE_PER_ADDR
+ * connections so C100K doesn't run out of ephemeral ports.
+ */
+static void open_idle(struct idle *ic, size_t k)
+{
+  struct epoll_event ev = {EPOLLIN, {.ptr = ic}};
+  struct sockaddr_in src;
+  char req[HDR_MAX];
+  int len;
+
+  if ((ic->fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+  {
+    perror("socket");
+    exit(1);
+  }
+  if (ntohl(sa.sin_addr.s_addr) >> 24 == 127)
+  {
+    memset(&src, 0, sizeof(src));
+    src.sin_family = AF_INET;
+    src.sin_addr.s_addr = htonl(0x7f000002 + k / IDLE_PER_ADDR);
+    setsockopt(ic->fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &(int){1},
+               sizeof(int));
+    if (bind(ic->fd, (struct sockaddr *)&src, sizeof(src)) < 0)
+    {
+      perror("bind");
+      exit(1);
+    }
+  }
+  if (connect(ic->fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+  {
+    perror("connect");
+    exit(1);
+  }
+  fcntl(ic->fd, F_SETFL, fcntl(ic->fd, F_GETFL) | O_NONBLOCK);
+
+  len = snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: %s\r\n%s",
+                 opt.path, opt.addr, opt.slow ? "" : "\r\n");
+  // a lost request shows up as the server closing the connection
+  send(ic->fd, req, len, MSG_NOSIGNAL);
+  if (epoll_ctl(efd, EPOLL_CTL_ADD, ic->fd, &ev) < 0)
+  {
+    perror("epoll_ctl");
+    exit(1);
+  }
+  idle_open++;
+}
+
+static int is_idle(const void *p)
+{
+  return (uintptr_t)p - (uintptr_t)idle < opt.idle * sizeof(*idle);
+}
+
+/* responses are thrown away, only the close matters */
+static void read_idle(struct idle *ic)
+{
+  char buf[4096];
+  ssize_t r;
+
+  while ((r = read(ic->fd, buf, sizeof(buf))) > 0)
+  {
+  }
+  if (r < 0 && errno == EAGAIN)
+  {
+    return;
+  }
+  close(ic->fd);
+  ic->fd = -1;
+  idle_open--;
+}
+
+static long server_rss(void)
+{
+  char path[64], line[256];
+  long kb = -1;
+  FILE *f;
+
+  snprintf(path, sizeof(path), "/proc/%d/status", opt.pid);
+  if (!(f = fopen(path, "r")))
+  {
+    return -1;
+  }
+  while (fgets(line, sizeof(line), f))
+  {
+    if (sscanf(line, "VmRSS: %ld", &kb) == 1)
+    {
+      break;
+    }
+  }
+  fclose(f);
+
+  return kb;
+}
+
+/* user and system time from /proc/pid/stat, fields 14 and 15 */
+static double server_cpu(void)
+{
+  char path[64], buf[1024], *p;
+  unsigned long utime, stime;
+  ssize_t n;
+  int fd;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", opt.pid);
+  if ((fd = open(path, O_RDONLY)) < 0)
+  {
+    return -1;
+  }
+  n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  buf[n > 0 ? n : 0] = '\0';
+  // the command name in parentheses may contain spaces
+  if (!(p = strrchr(buf, ')')) ||
+      sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+             &utime, &stime) != 2)
+  {
+    return -1;
+  }
+
+  return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+/* the shim's file is nothing but counters, their sum is all that matters */
+static uint64_t server_syscalls(void)
+{
+  uint64_t buf[4096], sum = 0;
+  ssize_t n, i;
+  int fd;
+
+  if (!opt.syscount || (fd = open(opt.syscount, O_RDONLY)) < 0)
+  {
+    return 0;
+  }
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+  {
+    for (i = 0; i < n / (ssize_t)sizeof(*buf); i++)
+    {
+      sum += buf[i];
+    }
+  }
+  close(fd);
+
+  return sum;
+}
+
+static uint64_t stat_value(const char *body, const char *name)
+{
+  char key[128];
+  const char *p;
+
+  snprintf(key, sizeof(key), "\n%s ", name);
+  return (p = strstr(body, key)) ? strtoull(p + strlen(key), NULL, 10) : 0;
+}
+
+/* the server may evict the scrape to make room, so it gets a few tries */
+static int scrape(struct server_stats *s, char *buf, size_t size)
+{
+  struct timeval tv = {2, 0};
+  size_t len;
+  ssize_t r = -1;
+  int fd, tries;
+
+  s->rss_kb = server_rss();
+  s->cpu_s = server_cpu();
+  s->syscalls = server_syscalls();
+  for (tries = 0; tries < 3; tries++)
+  {
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    {
+      return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    len = 0;
+    if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == 0)
+    {
+      dprintf(fd, "GET %s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n",
+              STATS_PATH, opt.addr);
+      while (len < size - 1 && (r = read(fd, buf + len, size - 1 - len)) > 0)
+      {
+        len += r;
+      }
+    }
+    close(fd);
+    buf[len] = '\0';
+    if (r == 0 && strstr(buf, "\nmisha_queue_events_total "))
+    {
+      s->accepted = stat_value(buf, "misha_accepted_total");
+      s->evicted = stat_value(buf, "misha_evicted_total");
+      s->waits = stat_value(buf, "misha_queue_waits_total");
+      s->events = stat_value(buf, "misha_queue_events_total");
+      return 0;
+    }
+  }
+  fprintf(stderr, "loadgen: can't scrape %s\n", STATS_PATH);
+
+  return -1;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+static double pct(double q)
+{
+  return nlat ? lat[(size_t)(q * (nlat - 1))] / 1e3 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+  static char rbuf[READ_SIZE];
+  struct epoll_event ev[256];
+  struct server_stats base, before, after;
+  struct rlimit rl;
+  struct conn *conns, *c;
+  uint64_t start, end, now, due, issued = 0, sum = 0;
+  size_t i, rr = 0;
+  double elapsed;
+  ssize_t r;
+  int n, j, ch, st, timeout;
+
+  while ((ch = getopt(argc, argv, "a:P:c:p:d:r:R:i:sm:C:n:")) != -1)
+  {
+    switch (ch)
+    {
+    case 'a':
+      opt.addr = optarg;
+      break;
+    case 'P':
+      opt.port = atoi(optarg);
+      break;
+    case 'c':
+      opt.conns = strtoul(optarg, NULL, 10);
+      break;
+    case 'p':
+      opt.depth = strtoul(optarg, NULL, 10);
+      break;
+    case 'd':
+      opt.duration = atof(optarg);
+      break;
+    case 'r':
+      opt.rate = atof(optarg);
+      break;
+    case 'R':
+      opt.range = optarg;
+      break;
+    case 'i':
+      opt.idle = strtoul(optarg, NULL, 10);
+      break;
+    case 's':
+      opt.slow = 1;
+      break;
+    case 'm':
+      opt.pid = atoi(optarg);
+      break;
+    case 'C':
+      opt.syscount = optarg;
+      break;
+    case 'n':
+      opt.name = optarg;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind != argc - 1 || opt.conns == 0 || opt.depth == 0 ||
+      opt.depth > DEPTH_MAX)
+  {
+    usage();
+  }
+  opt.path = argv[optind];
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(opt.port);
+  if (inet_pton(AF_INET, opt.addr, &sa.sin_addr) != 1)
+  {
+    usage();
+  }
+
+  reqlen = snprintf(NULL, 0, "GET %s HTTP/1.1\r\nHost: %s\r\n%s%s%s\r\n",
+                    opt.path, opt.addr, opt.range ? "Range: " : "",
+                    opt.range ? opt.range : "", opt.range ? "\r\n" : "");
+  if (!(reqbuf = malloc(reqlen * (opt.depth + 1) + 1)))
+  {
+    perror("malloc");
+    return 1;
+  }
+  for (i = 0; i <= opt.depth; i++)
+  {
+    sprintf(reqbuf + i * reqlen, "GET %s HTTP/1.1\r\nHost: %s\r\n%s%s%s\r\n",
+            opt.path, opt.addr, opt.range ? "Range: " : "",
+            opt.range ? opt.range : "", opt.range ? "\r\n" : "");
+  }
+
+  if ((efd = epoll_create1(0)) < 0 || !(conns = calloc(opt.conns, sizeof(*conns))))
+  {
+    perror("setup");
+    return 1;
+  }
+
+  // every idle connection is a descriptor of its own
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+  {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+  if (opt.pid && scrape(&base, rbuf, sizeof(rbuf)))
+  {
+    return 1;
+  }
+  if (opt.idle && !(idle = calloc(opt.idle, sizeof(*idle))))
+  {
+    perror("calloc");
+    return 1;
+  }
+  for (i = 0; i < opt.idle; i++)
+  {
+    open_idle(&idle[i], i);
+  }
+  if (opt.pid && scrape(&before, rbuf, sizeof(rbuf)))
+  {
+    return 1;
+  }
+
+  for (i = 0; i < opt.conns; i++)
+  {
+    open_conn(&conns[i]);
+  }
+
+  start = now_ns();
+  end = start + (uint64_t)(opt.duration * 1e9);
+  for (now = start; now < end; now = now_ns())
+  {
+    timeout = 100;
+    if (opt.rate > 0)
+    {
+      // hand every request that is due to a connection with room for it
+      due = (now - start) * opt.rate / 1e9;
+      for (i = 0; issued < due && i < opt.conns; i++, rr++)
+      {
+        c = &conns[rr % opt.conns];
+        while (issued < due && c->inflight < opt.depth)
+        {
+          send_req(c, start + issued++ * 1e9 / opt.rate);
+        }
+      }
+      timeout = issued < due ? 0 : 1;
+    }
+    else
+    {
+      for (i = 0; i < opt.conns; i++)
+      {
+        while (conns[i].inflight < opt.depth)
+        {
+          send_req(&conns[i], now);
+        }
+      }
+    }
+    for (i = 0; i < opt.conns; i++)
+    {
+      if (conns[i].out_len > 0 && flush_conn(&conns[i]))
+      {
+        reopen_conn(&conns[i]);
+      }
+    }
+
+    if ((n = epoll_wait(efd, ev, 256, timeout)) < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      perror("epoll_wait");
+      return 1;
+    }
+    now = now_ns();
+    for (j = 0; j < n; j++)
+    {
+      if (is_idle(ev[j].data.ptr))
+      {
+        read_idle(ev[j].data.ptr);
+        continue;
+      }
+      c = ev[j].data.ptr;
+      if (ev[j].events & EPOLLOUT && flush_conn(c))
+      {
+        reopen_conn(c);
+        continue;
+      }
+      if (!(ev[j].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+      {
+        continue;
+      }
+      st = 0;
+      while (st == 0 && (r = read(c->fd, rbuf, sizeof(rbuf))) > 0)
+      {
+        st = consume(c, rbuf, r, now);
+      }
+      if (st == 0 && r < 0 && errno == EAGAIN)
+      {
+        continue;
+      }
+      // end of a close-delimited body
+      if (st == 0 && r == 0 && c->in_body && c->until_eof)
+      {
+        complete(c, now);
+      }
+      reopen_conn(c);
+    }
+  }
+  elapsed = (now_ns() - start) / 1e9;
+  if (opt.pid && scrape(&after, rbuf, sizeof(rbuf)))
+  {
+    return 1;
+  }
+
+  qsort(lat, nlat, sizeof(*lat), cmp_u64);
+  for (i = 0; i < nlat; i++)
+  {
+    sum += lat[i];
+  }
+
+  printf("{\"name\": \"%s\", \"path\": \"%s\", \"range\": \"%s\", "
+         "\"connections\": %zu, \"depth\": %zu, \"rate\": %.0f, "
+         "\"seconds\": %.3f, \"requests\": %zu, \"errors\": %zu, "
+         "\"reconnects\": %zu, \"rps\": %.1f, \"mb_per_s\": %.2f, "
+         "\"latency_us\": {\"mean\": %.1f, \"p50\": %.1f, \"p90\": %.1f, "
+         "\"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}",
+         opt.name, opt.path, opt.range ? opt.range : "", opt.conns, opt.depth,
+         opt.rate, elapsed, nlat, errors, reconnects, nlat / elapsed,
+         bytes / elapsed / 1e6, nlat ? sum / 1e3 / nlat : 0, pct(0.5),
+         pct(0.9), pct(0.99), pct(0.999), nlat ? lat[nlat - 1] / 1e3 : 0);
+  if (opt.idle)
+  {
+    printf(", \"idle\": %zu, \"idle_slow\": %d, \"idle_open\": %zu",
+           opt.idle, opt.slow, idle_open);
+  }
+  if (opt.pid)
+  {
+    // accepts and evictions cover the idle setup too, the rates only the run
+    printf(", \"server\": {\"rss_base_kb\": %ld, \"rss_idle_kb\": %ld, "
+           "\"rss_kb\": %ld, \"rss_per_idle_conn\": %.0f, "
+           "\"accepted\": %" PRIu64 ", \"evicted\": %" PRIu64 ", "
+           "\"queue_waits_per_s\": %.1f, \"queue_events_per_s\": %.1f, "
+           "\"events_per_wait\": %.2f, \"cpu_s\": %.2f, "
+           "\"cpu_s_per_gb\": %.3f",
+           base.rss_kb, before.rss_kb, after.rss_kb,
+           opt.idle ? (before.rss_kb - base.rss_kb) * 1024.0 / opt.idle : 0,
+           after.accepted - base.accepted, after.evicted - base.evicted,
+           (after.waits - before.waits) / elapsed,
+           (after.events - before.events) / elapsed,
+           after.waits > before.waits
+               ? (double)(after.events - before.events) /
+                     (after.waits - before.waits)
+               : 0,
+           after.cpu_s - before.cpu_s,
+           bytes ? (after.cpu_s - before.cpu_s) / (bytes / 1e9) : 0);
+    if (opt.syscount)
+    {
+      printf(", \"syscalls\": %" PRIu64 ", \"syscalls_per_mb\": %.1f",
+             after.syscalls - before.syscalls,
+             bytes ? (after.syscalls - before.syscalls) / (bytes / 1e6) : 0);
+    }
+    printf("}");
+  }
+  printf("}\n");
+
+  return 0;
+}
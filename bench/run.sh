@@ -0,0 +1,49 @@
+#!/bin/sh
+# Standard load scenarios against the select and the epoll build, one JSON
+# array per backend in bench/results/. Run through `make bench`, as root:
+# the server chroots into a copy of server_dir and drops to $BENCH_USER.
+#
+# PORT, BENCH_USER, DURATION (seconds per scenario), CONNS and SERVER_FLAGS
+# (workers and slots, as in misha_server's usage) override the defaults.
+set -e
+cd "$(dirname "$0")/.."
+
+PORT=${PORT:-8090}
+BENCH_USER=${BENCH_USER:-www}
+DURATION=${DURATION:-5}
+CONNS=${CONNS:-8}
+SERVER_FLAGS=${SERVER_FLAGS:--s 64}
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cp -r server_dir/. "$dir"
+head -c 67108864 /dev/urandom > "$dir/large.bin"
+chmod -R a+rX "$dir"
+mkdir -p bench/results
+
+scenario()
+{
+	[ -n "$sep" ] && echo ","
+	sep=1
+	./bench/loadgen -P "$PORT" -c "$CONNS" -d "$DURATION" "$@"
+}
+
+for backend in select epoll; do
+	./bench/server_$backend $SERVER_FLAGS "$PORT" "$BENCH_USER" "$dir" >/dev/null 2>&1 &
+	pid=$!
+	sleep 1
+	sep=
+	{
+		echo "["
+		scenario -n index /index.html
+		scenario -n index_pipelined -p 8 /index.html
+		scenario -n index_rate -r 2000 /index.html
+		scenario -n dirlisting /files/
+		scenario -n kitty /kitty.jpeg
+		scenario -n large_range -R bytes=1048576-9437183 /large.bin
+		echo "]"
+	} >bench/results/$backend.json
+	kill $pid
+	wait $pid || true
+	echo "$backend: bench/results/$backend.json"
+done
@@ -0,0 +1,61 @@
+#!/bin/sh
+# Connection scaling: for every count in $IDLE park that many idle keep-alive
+# connections on the server (SLOW=1 leaves them halfway through a header
+# instead) while $CONNS clients measure /index.html latency. Each run records
+# the server's RSS per idle connection and the event rate out of queue_wait.
+# One JSON array per backend in bench/results/scaling_<backend>.json. Run
+# through `make bench-scaling`, as root.
+#
+# Every worker gets $SLOTS slots, enough to hold the largest count
+# without evictions when the workers share the load evenly. select can't
+# watch descriptors past FD_SETSIZE, its counts stop at $SELECT_MAX and its
+# workers get $SELECT_SLOTS. More than ~28k idle connections per loopback address would
+# exhaust the ephemeral ports, loadgen spreads them over 127.0.0.2 and up.
+set -e
+cd "$(dirname "$0")/.."
+
+PORT=${PORT:-8090}
+BENCH_USER=${BENCH_USER:-www}
+DURATION=${DURATION:-5}
+CONNS=${CONNS:-8}
+IDLE=${IDLE:-0 100 1000 10000}
+SELECT_MAX=${SELECT_MAX:-900}
+SLOW=${SLOW:-0}
+BACKENDS=${BACKENDS:-select epoll}
+SLOTS=${SLOTS:-16384}
+SELECT_SLOTS=${SELECT_SLOTS:-1024}
+
+# the server and loadgen both need a descriptor per connection
+ulimit -n 1048576 2>/dev/null || ulimit -n "$(ulimit -Hn)"
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cp -r server_dir/. "$dir"
+chmod -R a+rX "$dir"
+mkdir -p bench/results
+
+slow=
+[ "$SLOW" = 1 ] && slow=-s
+
+for backend in $BACKENDS; do
+	slots=$SLOTS
+	[ "$backend" = select ] && slots=$SELECT_SLOTS
+	./bench/server_$backend -s "$slots" "$PORT" "$BENCH_USER" "$dir" >/dev/null 2>&1 &
+	pid=$!
+	sleep 1
+	sep=
+	{
+		echo "["
+		for n in $IDLE; do
+			[ "$backend" = select ] && [ "$n" -gt "$SELECT_MAX" ] && continue
+			[ -n "$sep" ] && echo ","
+			sep=1
+			./bench/loadgen -P "$PORT" -c "$CONNS" -d "$DURATION" \
+				-i "$n" $slow -m "$pid" -n "idle_$n" /index.html
+		done
+		echo "]"
+	} >bench/results/scaling_$backend.json
+	kill $pid
+	wait $pid || true
+	echo "$backend: bench/results/scaling_$backend.json"
+done
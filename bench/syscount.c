@@ -0,0 +1,225 @@
+/*
+ * LD_PRELOAD shim counting the syscall wrappers a server calls, for the
+ * syscalls per MB of bench/large_files.sh.
+ *
+ * The counters live in $SYSCOUNT_FILE, mapped shared, so loadgen -C can sum
+ * them while the server runs: the file is nothing but native uint64_t
+ * counters, one cache-line aligned row per thread. It is created before
+ * main() and thereby before the chroot. Calls glibc makes internally, the
+ * futexes of pthread_cond_wait among them, aren't seen.
+ */
+#define _GNU_SOURCE /* RTLD_NEXT */
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define THREADS 256
+#define ROW 64 /* counters per thread, at least one per wrapper */
+
+static uint64_t *counters;
+static size_t next_row;
+static __thread uint64_t *row;
+
+__attribute__((constructor)) static void syscount_init(void)
+{
+  const char *path;
+  size_t size = THREADS * ROW * sizeof(uint64_t);
+  void *p;
+  int fd;
+
+  if (!(path = getenv("SYSCOUNT_FILE")) ||
+      (fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+  {
+    return;
+  }
+  if (ftruncate(fd, size) == 0 &&
+      (p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) !=
+          MAP_FAILED)
+  {
+    counters = p;
+  }
+  close(fd);
+}
+
+/* each thread bumps its own row, a reader sums them all */
+static void count(int call)
+{
+  size_t r;
+
+  if (!counters)
+  {
+    return;
+  }
+  if (!row)
+  {
+    r = __atomic_fetch_add(&next_row, 1, __ATOMIC_RELAXED);
+    row = counters + (r < THREADS ? r : THREADS - 1) * ROW;
+  }
+  __atomic_store_n(&row[call], row[call] + 1, __ATOMIC_RELAXED);
+}
+
+static void *real(const char *name)
+{
+  return dlsym(RTLD_NEXT, name);
+}
+
+/* a cached pointer to the next definition, counted under __COUNTER__ */
+#define WRAP(ret, name, params, args)                                         \
+  ret name params                                                             \
+  {                                                                           \
+    static ret(*fn) params;                                                   \
+    if (!fn)                                                                  \
+    {                                                                         \
+      *(void **)&fn = real(#name);                                            \
+    }                                                                         \
+    count(__COUNTER__);                                                       \
+    return fn args;                                                           \
+  }
+
+WRAP(ssize_t, read, (int fd, void *buf, size_t n), (fd, buf, n))
+WRAP(ssize_t, write, (int fd, const void *buf, size_t n), (fd, buf, n))
+WRAP(ssize_t, readv, (int fd, const struct iovec *iov, int n), (fd, iov, n))
+WRAP(ssize_t, writev, (int fd, const struct iovec *iov, int n), (fd, iov, n))
+WRAP(ssize_t, pread, (int fd, void *buf, size_t n, off_t off),
+     (fd, buf, n, off))
+WRAP(ssize_t, pwrite, (int fd, const void *buf, size_t n, off_t off),
+     (fd, buf, n, off))
+WRAP(ssize_t, send, (int fd, const void *buf, size_t n, int flags),
+     (fd, buf, n, flags))
+WRAP(ssize_t, sendmsg, (int fd, const struct msghdr *msg, int flags),
+     (fd, msg, flags))
+WRAP(ssize_t, recv, (int fd, void *buf, size_t n, int flags),
+     (fd, buf, n, flags))
+WRAP(ssize_t, recvmsg, (int fd, struct msghdr *msg, int flags),
+     (fd, msg, flags))
+WRAP(ssize_t, sendfile, (int out, int in, off_t *off, size_t n),
+     (out, in, off, n))
+WRAP(ssize_t, splice,
+     (int in, loff_t *in_off, int out, loff_t *out_off, size_t n,
+      unsigned int flags),
+     (in, in_off, out, out_off, n, flags))
+/* glibc's transparent sockaddr union, or the prototypes clash */
+WRAP(int, accept, (int fd, __SOCKADDR_ARG sa, socklen_t *len), (fd, sa, len))
+WRAP(int, accept4, (int fd, __SOCKADDR_ARG sa, socklen_t *len, int flags),
+     (fd, sa, len, flags))
+WRAP(int, close, (int fd), (fd))
+WRAP(int, shutdown, (int fd, int how), (fd, how))
+WRAP(int, setsockopt,
+     (int fd, int level, int name, const void *val, socklen_t len),
+     (fd, level, name, val, len))
+WRAP(int, pipe2, (int fds[2], int flags), (fds, flags))
+WRAP(int, fstat, (int fd, struct stat *st), (fd, st))
+WRAP(int, stat, (const char *path, struct stat *st), (path, st))
+WRAP(int, posix_fadvise, (int fd, off_t off, off_t len, int advice),
+     (fd, off, len, advice))
+WRAP(ssize_t, readahead, (int fd, off64_t off, size_t n), (fd, off, n))
+WRAP(int, madvise, (void *addr, size_t len, int advice), (addr, len, advice))
+WRAP(int, eventfd, (unsigned int val, int flags), (val, flags))
+WRAP(int, epoll_wait, (int fd, struct epoll_event *ev, int n, int timeout),
+     (fd, ev, n, timeout))
+WRAP(int, epoll_ctl, (int fd, int op, int cfd, struct epoll_event *ev),
+     (fd, op, cfd, ev))
+WRAP(int, pselect,
+     (int n, fd_set *r, fd_set *w, fd_set *e, const struct timespec *ts,
+      const sigset_t *mask),
+     (n, r, w, e, ts, mask))
+WRAP(int, nanosleep, (const struct timespec *ts, struct timespec *rem),
+     (ts, rem))
+
+enum
+{
+  COUNTED_FCNTL = __COUNTER__,
+  COUNTED_OPEN,
+  COUNTED_OPENAT,
+  COUNTED_SYSCALL,
+};
+
+/* the variadic ones forward the most arguments any caller passes */
+int fcntl(int fd, int cmd, ...)
+{
+  static int (*fn)(int, int, ...);
+  va_list ap;
+  long arg;
+
+  if (!fn)
+  {
+    *(void **)&fn = real("fcntl");
+  }
+  va_start(ap, cmd);
+  arg = va_arg(ap, long);
+  va_end(ap);
+  count(COUNTED_FCNTL);
+
+  return fn(fd, cmd, arg);
+}
+
+int open(const char *path, int flags, ...)
+{
+  static int (*fn)(const char *, int, ...);
+  va_list ap;
+  int mode;
+
+  if (!fn)
+  {
+    *(void **)&fn = real("open");
+  }
+  va_start(ap, flags);
+  mode = flags & (O_CREAT | O_TMPFILE) ? va_arg(ap, int) : 0;
+  va_end(ap);
+  count(COUNTED_OPEN);
+
+  return fn(path, flags, mode);
+}
+
+int openat(int dir, const char *path, int flags, ...)
+{
+  static int (*fn)(int, const char *, int, ...);
+  va_list ap;
+  int mode;
+
+  if (!fn)
+  {
+    *(void **)&fn = real("openat");
+  }
+  va_start(ap, flags);
+  mode = flags & (O_CREAT | O_TMPFILE) ? va_arg(ap, int) : 0;
+  va_end(ap);
+  count(COUNTED_OPENAT);
+
+  return fn(dir, path, flags, mode);
+}
+
+/* io_uring has no libc wrapper */
+long syscall(long nr, ...)
+{
+  static long (*fn)(long, ...);
+  va_list ap;
+  long a[6];
+  int i;
+
+  if (!fn)
+  {
+    *(void **)&fn = real("syscall");
+  }
+  va_start(ap, nr);
+  for (i = 0; i < 6; i++)
+  {
+    a[i] = va_arg(ap, long);
+  }
+  va_end(ap);
+  count(COUNTED_SYSCALL);
+
+  return fn(nr, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
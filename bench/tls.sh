@@ -0,0 +1,90 @@
+#!/bin/sh
+# HTTPS on loopback: kTLS against userspace TLS, plain HTTP for reference.
+# $CONNS curl clients each download a random $SIZE byte file $ROUNDS times
+# over one connection, from a server with ktls=yes, then ktls=no, then over
+# the plain listener. Each run reports the throughput, the server's CPU
+# seconds per GB and how many connections the kernel encrypted for
+# (misha_ktls_total): without the tls module, or with a cipher it can't
+# take, the ktls run quietly falls back to userspace TLS. A throwaway
+# self-signed certificate is made with openssl. Run through `make
+# bench-tls`, as root; the report goes to bench/results/tls.json.
+set -e
+cd "$(dirname "$0")/.."
+
+PORT=${PORT:-8090}
+TLS_PORT=${TLS_PORT:-8453}
+BENCH_USER=${BENCH_USER:-www}
+CONNS=${CONNS:-4}
+ROUNDS=${ROUNDS:-8}
+SIZE=${SIZE:-268435456}
+report=bench/results/tls.json
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+mkdir "$tmp/www"
+head -c "$SIZE" /dev/urandom > "$tmp/www/dense.bin"
+chmod -R a+rX "$tmp/www"
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost \
+	-keyout "$tmp/key.pem" -out "$tmp/cert.pem" 2>/dev/null
+mkdir -p bench/results
+modprobe tls 2>/dev/null || true
+
+# utime + stime of the server, in clock ticks
+ticks()
+{
+	awk '{ print $14 + $15 }' "/proc/$1/stat"
+}
+
+run()
+{
+	name=$1
+	url=$2
+	start=$(date +%s.%N)
+	cpu=$(ticks "$pid")
+	i=0
+	clients=
+	while [ $i -lt "$CONNS" ]; do
+		curl -sk -o /dev/null "$url/dense.bin?[1-$ROUNDS]" &
+		clients="$clients $!"
+		i=$((i + 1))
+	done
+	# not the server
+	wait $clients
+	end=$(date +%s.%N)
+	cpu=$(($(ticks "$pid") - cpu))
+	ktls=$(curl -s "http://127.0.0.1:$PORT/__stats" |
+		awk '/^misha_ktls_total/ { print $2 }')
+	[ -n "$sep" ] && echo ","
+	sep=1
+	awk -v name="$name" -v conns="$CONNS" -v bytes=$((SIZE * ROUNDS * CONNS)) \
+		-v secs="$(echo "$start $end" | awk '{ print $2 - $1 }')" \
+		-v cpu="$cpu" -v hz="$(getconf CLK_TCK)" -v ktls="$ktls" 'BEGIN {
+		printf "{\"name\": \"%s\", \"connections\": %d, \"bytes\": %.0f, " \
+		    "\"seconds\": %.3f, \"mb_per_s\": %.2f, \"server\": " \
+		    "{\"cpu_s\": %.2f, \"cpu_s_per_gb\": %.3f, " \
+		    "\"ktls_connections\": %d}}\n", name, conns, bytes, secs,
+		    bytes / secs / 1048576, cpu / hz, cpu / hz / (bytes / 2^30), ktls
+	}'
+}
+
+sep=
+{
+	echo "["
+	for ktls in yes no; do
+		./bench/server_tls -o tls_port="$TLS_PORT" \
+			-o tls_cert="$tmp/cert.pem" -o tls_key="$tmp/key.pem" \
+			-o ktls=$ktls "$PORT" "$BENCH_USER" "$tmp/www" >/dev/null 2>&1 &
+		pid=$!
+		sleep 1
+		if [ $ktls = yes ]; then
+			run ktls "https://127.0.0.1:$TLS_PORT"
+		else
+			run userspace "https://127.0.0.1:$TLS_PORT"
+			run plain "http://127.0.0.1:$PORT"
+		fi
+		kill $pid
+		wait $pid || true
+	done
+	echo "]"
+} >$report
+cat $report
@@ -1,4 +1,5 @@
 #include <dirent.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,11 +11,11 @@
 #include "http.h"
 #include "util.h"
 
-enum status (*const data_fct[])(const struct resp_t *, struct my_buffer *,
-                                size_t *) = {
-    [RESTYPE_DIRLISTING] = prepare_dir_listing_buffer,
-    [RESTYPE_ERROR] = prepare_error_buffer,
-    [RESTYPE_FILE] = prepare_file_buffer,
+const struct body_source data_fct[] = {
+    [RESTYPE_DIRLISTING] = {ENGINE_BUFFER, prepare_dir_listing_buffer},
+    [RESTYPE_ERROR] = {ENGINE_BUFFER, prepare_error_buffer},
+    [RESTYPE_FILE] = {FILE_ENGINE, prepare_file_buffer},
+    [RESTYPE_STATS] = {ENGINE_BUFFER, prepare_stats_buffer},
 };
 
 static int compareent(const struct dirent **d1, const struct dirent **d2)
@@ -113,7 +114,7 @@ enum status prepare_dir_listing_buffer(const struct resp_t *res,
   char esc_abspath[PATH_MAX * 10];
   char abspath[PATH_MAX * 10];
 
-  memset(buf, 0, sizeof(*buf));
+  buffer_reset(buf);
 
   if ((dirlen = scandir(res->m_internal_path, &e, NULL, compareent)) < 0)
   {
@@ -178,17 +179,15 @@ cleanup:
 enum status prepare_error_buffer(const struct resp_t *res,
                                  struct my_buffer *buf, size_t *progress)
 {
-  memset(buf, 0, sizeof(*buf));
+  const char *body;
+  size_t body_len;
+
+  buffer_reset(buf);
 
   if (*progress == 0)
   {
-    if (buffer_append(buf,
-                      "<!DOCTYPE html>\n<html>\n\t<head>\n"
-                      "\t\t<title>%d %s</title>\n\t</head>\n"
-                      "\t<body>\n\t\t<h1>%d %s</h1>\n"
-                      "\t</body>\n</html>\n",
-                      res->m_status, status_str[res->m_status], res->m_status,
-                      status_str[res->m_status]))
+    if (get_canned_body_http(res->m_status, &body, &body_len) ||
+        buffer_append_mem(buf, body, body_len))
     {
       return STATUS_INTERNAL_SERVER_ERROR;
     }
@@ -201,44 +200,33 @@ enum status prepare_error_buffer(const struct resp_t *res,
 enum status prepare_file_buffer(const struct resp_t *res, struct my_buffer *buf,
                                 size_t *progress)
 {
-  FILE *fp;
-  enum status s = 0;
   ssize_t r;
   size_t remaining;
 
-  memset(buf, 0, sizeof(*buf));
-
-  if (!(fp = fopen(res->m_internal_path, "r")))
-  {
-    s = STATUS_FORBIDDEN;
-    goto cleanup;
-  }
-
-  if (fseek(fp, res->m_file.lower + *progress, SEEK_SET))
-  {
-    s = STATUS_INTERNAL_SERVER_ERROR;
-    goto cleanup;
-  }
+  buffer_reset(buf);
 
+  /* the connection keeps the file open so its readahead state survives */
   remaining = res->m_file.upper - res->m_file.lower + 1 - *progress;
-  while ((r = fread(buf->data + buf->length, 1,
-                    MIN(sizeof(buf->data) - buf->length, remaining), fp)))
+  while (remaining > 0 && buf->length < buf->size)
   {
-    if (r < 0)
+    if ((r = pread(res->m_file.fd, buf->data + buf->length,
+                   MIN(buf->size - buf->length, remaining),
+                   res->m_file.lower + *progress)) < 0)
     {
-      s = STATUS_INTERNAL_SERVER_ERROR;
-      goto cleanup;
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return STATUS_INTERNAL_SERVER_ERROR;
+    }
+    if (r == 0)
+    {
+      break;
     }
     buf->length += r;
     *progress += r;
     remaining -= r;
   }
 
-cleanup:
-  if (fp)
-  {
-    fclose(fp);
-  }
-
-  return s;
+  return 0;
 }
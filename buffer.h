@@ -3,8 +3,26 @@
 #include "http.h"
 #include "util.h"
 
-extern enum status (*const data_fct[])(const struct resp_t *,
-                                       struct my_buffer *, size_t *);
+enum body_engine
+{
+  ENGINE_BUFFER,
+  ENGINE_SENDFILE,
+  ENGINE_URING,
+  ENGINE_SPLICE,
+};
+
+/*
+ * How each response type gets its body out: the preferred engine, and the
+ * producer that fills a buffer for ENGINE_BUFFER and as the fallback when a
+ * zero-copy engine isn't supported by the file.
+ */
+struct body_source
+{
+  enum body_engine m_engine;
+  enum status (*m_fill)(const struct resp_t *, struct my_buffer *, size_t *);
+};
+
+extern const struct body_source data_fct[];
 
 enum status prepare_dir_listing_buffer(const struct resp_t *,
                                        struct my_buffer *, size_t *);
@@ -12,3 +30,5 @@ enum status prepare_file_buffer(const struct resp_t *, struct my_buffer *,
                                 size_t *);
 enum status prepare_error_buffer(const struct resp_t *, struct my_buffer *,
                                  size_t *);
+enum status prepare_stats_buffer(const struct resp_t *, struct my_buffer *,
+                                 size_t *);
@@ -0,0 +1,425 @@
+#define _GNU_SOURCE /* sched_getaffinity */
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "config.h"
+#include "configuration.h"
+#include "util.h"
+
+#define CONFIG_LINE_MAX 1024
+
+void config_defaults(struct config *c)
+{
+  memset(c, 0, sizeof(*c));
+  c->m_host = "0.0.0.0";
+  c->m_list_directories = 1;
+  c->m_ktls = 1;
+  c->m_topo.m_threads = 0;
+  c->m_topo.m_slots = 64;
+  c->m_topo.m_overload = OVERLOAD_EVICT;
+  c->m_topo.m_backlog = 64;
+  c->m_header_buffer = HEADER_BUFFER_SIZE;
+  c->m_bulk_buffer_min = BULK_BUFFER_MIN;
+  c->m_bulk_buffer_max = BULK_BUFFER_MAX;
+}
+
+/*
+ * A positive count with an optional k or m suffix. strtoull would take a
+ * sign and wrap it, and the suffix could overflow, both are refused.
+ */
+static int parse_size(const char *s, size_t *out)
+{
+  unsigned long long v, unit = 1;
+  char *end;
+
+  errno = 0;
+  v = strtoull(s, &end, 10);
+  if (errno || end == s || v == 0 || strchr(s, '-'))
+  {
+    return -1;
+  }
+  switch (*end)
+  {
+  case 'k':
+  case 'K':
+    unit = 1024;
+    end++;
+    break;
+  case 'm':
+  case 'M':
+    unit = 1048576;
+    end++;
+    break;
+  }
+  if (*end != '\0' || v > SIZE_MAX / unit)
+  {
+    return -1;
+  }
+  *out = v * unit;
+
+  return 0;
+}
+
+/* a limit is a size, or 0 or off for none */
+static int parse_limit(const char *s, size_t *out)
+{
+  if (!strcmp(s, "0") || !strcmp(s, "off"))
+  {
+    *out = 0;
+    return 0;
+  }
+
+  return parse_size(s, out);
+}
+
+static int parse_bool(const char *s, int *out)
+{
+  if (!strcmp(s, "1") || !strcmp(s, "yes") || !strcmp(s, "on"))
+  {
+    *out = 1;
+  }
+  else if (!strcmp(s, "0") || !strcmp(s, "no") || !strcmp(s, "off"))
+  {
+    *out = 0;
+  }
+  else
+  {
+    return -1;
+  }
+
+  return 0;
+}
+
+/* "match rate" adds a pacing rule after the ones given so far */
+static int parse_pace(struct config *c, const char *s)
+{
+  struct pace_rule *r;
+  size_t len;
+
+  len = strcspn(s, " \t");
+  if (c->m_npace == PACE_RULES || len == 0 || s[len] == '\0')
+  {
+    return -1;
+  }
+  r = &c->m_pace[c->m_npace];
+  if (parse_size(s + len + strspn(s + len, " \t"), &r->m_rate) ||
+      !(r->m_match = strndup(s, len)))
+  {
+    return -1;
+  }
+  c->m_npace++;
+
+  return 0;
+}
+
+/* strings are kept, the caller's value must outlive the configuration */
+int config_set(struct config *c, const char *key, const char *val)
+{
+  if (!strcmp(key, "port"))
+  {
+    c->m_port = val;
+  }
+  else if (!strcmp(key, "user"))
+  {
+    c->m_user = val;
+  }
+  else if (!strcmp(key, "root"))
+  {
+    c->m_root = val;
+  }
+  else if (!strcmp(key, "host"))
+  {
+    c->m_host = val;
+  }
+  else if (!strcmp(key, "tls_port"))
+  {
+    c->m_tls_port = val;
+  }
+  else if (!strcmp(key, "tls_cert"))
+  {
+    c->m_tls_cert = val;
+  }
+  else if (!strcmp(key, "tls_key"))
+  {
+    c->m_tls_key = val;
+  }
+  else if (!strcmp(key, "ktls"))
+  {
+    return parse_bool(val, &c->m_ktls);
+  }
+  else if (!strcmp(key, "listing"))
+  {
+    return parse_bool(val, &c->m_list_directories);
+  }
+  else if (!strcmp(key, "threads"))
+  {
+    if (!strcmp(val, "auto"))
+    {
+      c->m_topo.m_threads = 0;
+      return 0;
+    }
+    return parse_size(val, &c->m_topo.m_threads);
+  }
+  else if (!strcmp(key, "slots"))
+  {
+    return parse_size(val, &c->m_topo.m_slots);
+  }
+  else if (!strcmp(key, "events"))
+  {
+    return parse_size(val, &c->m_topo.m_events);
+  }
+  else if (!strcmp(key, "pin"))
+  {
+    return parse_bool(val, &c->m_topo.m_pin);
+  }
+  else if (!strcmp(key, "overload"))
+  {
+    if (!strcmp(val, "evict"))
+    {
+      c->m_topo.m_overload = OVERLOAD_EVICT;
+    }
+    else if (!strcmp(val, "shed"))
+    {
+      c->m_topo.m_overload = OVERLOAD_SHED;
+    }
+    else if (!strcmp(val, "backlog"))
+    {
+      c->m_topo.m_overload = OVERLOAD_BACKLOG;
+    }
+    else
+    {
+      return -1;
+    }
+  }
+  else if (!strcmp(key, "backlog"))
+  {
+    return parse_size(val, &c->m_topo.m_backlog);
+  }
+  else if (!strcmp(key, "ip_conns"))
+  {
+    return parse_limit(val, &c->m_topo.m_limits.m_ip.m_conns);
+  }
+  else if (!strcmp(key, "ip_rps"))
+  {
+    return parse_limit(val, &c->m_topo.m_limits.m_ip.m_rps);
+  }
+  else if (!strcmp(key, "ip_bps"))
+  {
+    return parse_limit(val, &c->m_topo.m_limits.m_ip.m_bps);
+  }
+  else if (!strcmp(key, "prefix_conns"))
+  {
+    return parse_limit(val, &c->m_topo.m_limits.m_prefix.m_conns);
+  }
+  else if (!strcmp(key, "prefix_rps"))
+  {
+    return parse_limit(val, &c->m_topo.m_limits.m_prefix.m_rps);
+  }
+  else if (!strcmp(key, "prefix_bps"))
+  {
+    return parse_limit(val, &c->m_topo.m_limits.m_prefix.m_bps);
+  }
+  else if (!strcmp(key, "pace"))
+  {
+    return parse_pace(c, val);
+  }
+  else if (!strcmp(key, "header_buffer"))
+  {
+    return parse_size(val, &c->m_header_buffer);
+  }
+  else if (!strcmp(key, "bulk_buffer_min"))
+  {
+    return parse_size(val, &c->m_bulk_buffer_min);
+  }
+  else if (!strcmp(key, "bulk_buffer_max"))
+  {
+    return parse_size(val, &c->m_bulk_buffer_max);
+  }
+  else
+  {
+    return -1;
+  }
+
+  return 0;
+}
+
+static char *trim(char *s)
+{
+  char *end;
+
+  s += strspn(s, " \t");
+  end = s + strlen(s);
+  while (end > s && strchr(" \t\r\n", end[-1]))
+  {
+    end--;
+  }
+  *end = '\0';
+
+  return s;
+}
+
+int config_load(struct config *c, const char *path)
+{
+  char line[CONFIG_LINE_MAX], *key, *val, *p;
+  size_t n = 0;
+  FILE *f;
+  int ret = 0;
+
+  if (!(f = fopen(path, "r")))
+  {
+    log_warn("config: can't open %s:", path);
+    return -1;
+  }
+  while (fgets(line, sizeof(line), f))
+  {
+    n++;
+    if ((p = strchr(line, '#')))
+    {
+      *p = '\0';
+    }
+    if (*(key = trim(line)) == '\0')
+    {
+      continue;
+    }
+    if (!(p = strchr(key, '=')))
+    {
+      log_warn("config: %s:%zu: expected key = value", path, n);
+      ret = -1;
+      continue;
+    }
+    *p = '\0';
+    key = trim(key);
+    val = trim(p + 1);
+    if (!(val = strdup(val)) || config_set(c, key, val))
+    {
+      log_warn("config: %s:%zu: bad value for '%s'", path, n, key);
+      ret = -1;
+    }
+  }
+  fclose(f);
+
+  return ret;
+}
+
+/* NULL when the settings can run, otherwise what is wrong with them */
+const char *config_check(const struct config *c)
+{
+  if (!c->m_port || !c->m_user || !c->m_root)
+  {
+    return "port, user and root are required";
+  }
+  if (c->m_tls_port && (!c->m_tls_cert || !c->m_tls_key))
+  {
+    return "tls_port needs tls_cert and tls_key";
+  }
+  if (c->m_header_buffer < 1024)
+  {
+    return "header_buffer must be at least 1k";
+  }
+  // pool classes: header, bulk_min, bulk_max / 4, bulk_max
+  if (c->m_bulk_buffer_min < c->m_header_buffer ||
+      c->m_bulk_buffer_max / 4 < c->m_bulk_buffer_min)
+  {
+    return "buffers must grow: header_buffer <= bulk_buffer_min <= "
+           "bulk_buffer_max / 4";
+  }
+  // token buckets count in millionths, these still fit in 63 bits
+  if (MAX(c->m_topo.m_limits.m_ip.m_rps, c->m_topo.m_limits.m_ip.m_bps) >=
+          (size_t)1 << 40 ||
+      MAX(c->m_topo.m_limits.m_prefix.m_rps,
+          c->m_topo.m_limits.m_prefix.m_bps) >= (size_t)1 << 40)
+  {
+    return "request and byte rates must stay below 2^40 per second";
+  }
+
+  return NULL;
+}
+
+/*
+ * The quota of our cgroup or the tightest of its parents, as whole CPUs,
+ * 0 without one. Tries cgroup v2's cpu.max, then v1's cfs files.
+ */
+static size_t cgroup_cpus(void)
+{
+  char rel[PATH_MAX], path[PATH_MAX + 64], line[PATH_MAX + 64], *p;
+  long long quota, period;
+  size_t best = 0, n;
+  FILE *f;
+
+  rel[0] = '\0';
+  if ((f = fopen("/proc/self/cgroup", "r")))
+  {
+    while (fgets(line, sizeof(line), f))
+    {
+      if (!strncmp(line, "0::", 3))
+      {
+        esnprintf(rel, sizeof(rel), "%s", trim(line + 3));
+        break;
+      }
+    }
+    fclose(f);
+  }
+
+  for (;;)
+  {
+    esnprintf(path, sizeof(path), "/sys/fs/cgroup%s/cpu.max", rel);
+    if ((f = fopen(path, "r")))
+    {
+      // "max 100000" when there is no quota
+      if (fscanf(f, "%lld %lld", &quota, &period) == 2 && quota > 0 &&
+          period > 0)
+      {
+        n = (quota + period - 1) / period;
+        best = best ? MIN(best, n) : n;
+      }
+      fclose(f);
+    }
+    if (!(p = strrchr(rel, '/')))
+    {
+      break;
+    }
+    *p = '\0';
+  }
+
+  if (best == 0 && (f = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r")))
+  {
+    if (fscanf(f, "%lld", &quota) != 1)
+    {
+      quota = -1;
+    }
+    fclose(f);
+    if (quota > 0 && (f = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r")))
+    {
+      if (fscanf(f, "%lld", &period) == 1 && period > 0)
+      {
+        best = (quota + period - 1) / period;
+      }
+      fclose(f);
+    }
+  }
+
+  return best;
+}
+
+/* CPUs we may run on, capped by the cgroup quota; needs /sys, so pre-chroot */
+size_t config_cpus(void)
+{
+  cpu_set_t set;
+  size_t n = 1, quota;
+
+  if (sched_getaffinity(0, sizeof(set), &set) == 0)
+  {
+    n = MAX(CPU_COUNT(&set), 1);
+  }
+  if ((quota = cgroup_cpus()) > 0)
+  {
+    n = MIN(n, quota);
+  }
+
+  return n;
+}
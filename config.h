@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "configuration.h"
+#include "srv.h"
+
+/*
+ * Runtime settings: compiled-in defaults, then the file given with -c, then
+ * the command line. The file holds one `key = value` per line, # starts a
+ * comment; every key can also be given as -o key=value.
+ */
+struct config
+{
+  const char *m_port;
+  const char *m_user;
+  const char *m_root;
+  const char *m_host;
+  const char *m_tls_port; /* a second listener for HTTPS, NULL for none */
+  const char *m_tls_cert;
+  const char *m_tls_key;
+  int m_ktls;
+  int m_list_directories;
+  struct topology m_topo; /* m_threads 0 sizes to the usable CPUs */
+  size_t m_header_buffer;
+  size_t m_bulk_buffer_min;
+  size_t m_bulk_buffer_max;
+  struct pace_rule m_pace[PACE_RULES];
+  size_t m_npace;
+};
+
+void config_defaults(struct config *);
+int config_set(struct config *, const char *, const char *);
+int config_load(struct config *, const char *);
+const char *config_check(const struct config *);
+size_t config_cpus(void);
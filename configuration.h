@@ -1,6 +1,46 @@
 #pragma once
 #define FIELD_MAX 200
-#define BUFFER_SIZE 8192
+#define HEADER_BUFFER_SIZE 4096
+#define HEADER_MAX 65536
+#define BULK_BUFFER_MIN 65536
+#define BULK_BUFFER_MAX 1048576
+#define CACHE_LINE_SIZE 64
+#define COLD_MAX_FREE 256
+#define OFFLOAD_THREADS 4
+#define URING_MAX_ENTRIES 4096
+#define POOL_MAX_FREE_BYTES (4 * 1048576)
+#define READAHEAD_MIN (4 * 1048576)
+#define READAHEAD_WINDOW (2 * 1048576)
+#define DONTNEED_MIN (64 * 1048576)
+#define SPLICE_PIPE_SIZE 1048576
+#define SPLICE_MAX_FREE 4
+#define WRITE_QUOTA 1048576 /* body bytes one connection sends per wakeup */
+#define HANDOFF_MARGIN 2 /* hand work to a sibling this much less loaded, 0 never */
+#define HANDOFF_INTERVAL 1000000 /* ns between two handoffs of one worker */
+#ifndef FILE_ENGINE
+#define FILE_ENGINE ENGINE_SENDFILE
+#endif
+#define ZEROCOPY 0 /* 1 pins large memory bodies with MSG_ZEROCOPY */
+#define ZEROCOPY_MIN 262144
+#define ZEROCOPY_LINGER 10 /* s a dropped connection's pinned sends may take */
+#define RETRY_AFTER "1" /* seconds a shed client is asked to wait */
+#define IDLE_RECLAIM 1000 /* ms idle before a full worker may take the slot */
+#define LIMIT_TABLE 4096 /* client entries per worker, a power of two */
+#define LIMIT_PROBE 8 /* entries a client key may land in */
+#define LIMIT_TICK 10000000 /* ns between wakeups of throttled transfers */
+#define PACE_RULES 16
+#define PACE_MIN 1048576 /* smaller file bodies aren't paced */
+#define PACE_BURST 65536 /* send credit a paced transfer may bank, or 100 ms */
+#define PACE_KERNEL 1 /* 0 paces with send credit even where the kernel can */
+#define STATS_PATH "/__stats" /* reserved URL for the Prometheus metrics */
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LEVEL_INFO /* make CPPFLAGS+=-DLOG_LEVEL=0 for debug logs */
+#endif
+#define ACCESS_LOG NULL /* path reopened on SIGHUP, stdout if NULL */
+#define LOG_RING_SIZE 1048576 /* per thread, a power of two */
+#define LOG_LINE_MAX 1024
+#define LOG_FLUSH_MS 50
+#define LOG_SAMPLE 1 /* log one in n successful requests, errors always */
 
 static struct {
   char *extension;
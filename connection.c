@@ -1,106 +1,2101 @@
+#define _GNU_SOURCE /* readahead */
 #include "connection.h"
 #include "buffer.h"
+#include "h2.h"
 #include "http.h"
+#include "limit.h"
+#include "logger.h"
 #include "mysock.h"
+#include "pool.h"
+#include "queue.h"
 #include "srv.h"
+#include "tls.h"
 #include "util.h"
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <netinet/in.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
-struct data_for_worker
-{
-  int m_in_socket;
-  size_t m_num_slots;
-  const struct server *m_serv;
-};
+/* the most a response's HEADERS block takes */
+#define H2_BLOCK_MAX ((NUM_RES_FIELDS + 2) * (FIELD_MAX + 8))
+/* the HTTP/1.1 header a stream's request is rewritten to */
+#define H2_REQUEST_MAX (PATH_MAX + (NUM_REQ_FIELDS + 3) * (FIELD_MAX + 32))
 
-void log_con(const struct conn_t *c)
+/* one access log line, status 0 for a request that was dropped */
+static void log_req(const struct sockaddr_storage *peer,
+                    const struct req_t *req, enum status status)
 {
+  static __thread char tstmp[21];
+  static __thread time_t last;
   char inaddr_str[INET6_ADDRSTRLEN];
-  char tstmp[21];
+  struct tm tm;
+  time_t now;
+
+  // errors and drops are always logged, successes may be sampled
+  if (status != 0 && status < 400 && !log_sample())
+  {
+    return;
+  }
 
-  if (!strftime(tstmp, sizeof(tstmp), "%Y-%m-%dT%H:%M:%SZ",
-                gmtime(&(time_t){time(NULL)})))
+  // the stamp only has second resolution, format it once per second
+  if ((now = time(NULL)) != last)
   {
-    log_warn("strftime: Exceeded buffer capacity");
-    tstmp[0] = '\0';
+    if (!strftime(tstmp, sizeof(tstmp), "%Y-%m-%dT%H:%M:%SZ",
+                  gmtime_r(&now, &tm)))
+    {
+      log_warn("strftime: Exceeded buffer capacity");
+      tstmp[0] = '\0';
+    }
+    last = now;
   }
 
-  if (get_socket_inaddr(&c->m_sock_storage, inaddr_str, LEN(inaddr_str)))
+  if (get_socket_inaddr(peer, inaddr_str, LEN(inaddr_str)))
   {
     log_warn("get_socket_inaddr: Couldn't generate adress-string");
     inaddr_str[0] = '\0';
   }
 
-  log_info("%s\t%s\t status %s%.*d\t%s\t%s%s%s%s%s\n", tstmp, inaddr_str,
-           (c->m_resp.m_status == 0) ? "dropped" : "",
-           (c->m_resp.m_status == 0) ? 0 : 3, c->m_resp.m_status,
-           c->m_req.m_field[REQ_HOST][0] ? c->m_req.m_field[REQ_HOST] : "-",
-           c->m_req.m_path[0] ? c->m_req.m_path : "-",
-           c->m_req.m_query[0] ? "?" : "", c->m_req.m_query,
-           c->m_req.m_fragment[0] ? "#" : "", c->m_req.m_fragment);
-  log_info("Aboba");
+  log_access("%s\t%s\t status %s%.*d\t%s\t%s%s%s%s%s\n", tstmp, inaddr_str,
+             (status == 0) ? "dropped" : "", (status == 0) ? 0 : 3, status,
+             req->m_field[REQ_HOST][0] ? req->m_field[REQ_HOST] : "-",
+             req->m_path[0] ? req->m_path : "-", req->m_query[0] ? "?" : "",
+             req->m_query, req->m_fragment[0] ? "#" : "", req->m_fragment);
+}
+
+void log_con(const struct conn_t *c)
+{
+  static const struct req_t no_req;
+
+  // an idle connection has no request to report
+  log_req(c->m_peer, c->m_cold ? &c->m_cold->m_req : &no_req,
+          c->m_cold ? c->m_cold->m_resp.m_status : 0);
+}
+
+static size_t pending(const struct my_buffer *buf)
+{
+  return buf->length - buf->offset;
+}
+
+static int has_body(const struct req_t *req, const struct resp_t *res)
+{
+  return req->m_method == METH_GET && res->m_status != STATUS_NOT_MODIFIED;
+}
+
+static size_t body_lease_size(const struct resp_t *res)
+{
+  switch (res->m_type)
+  {
+  case RESTYPE_FILE:
+    return res->m_file.upper - res->m_file.lower + 1;
+  case RESTYPE_DIRLISTING:
+  case RESTYPE_STATS:
+    return pool_size(POOL_BULK_S);
+  default:
+    return pool_size(POOL_HEADER);
+  }
+}
+
+static struct conn_cold *acquire_cold(struct data_for_worker *d)
+{
+  struct conn_cold *cold;
+
+  if ((cold = d->m_cold_free))
+  {
+    d->m_cold_free = cold->m_next;
+    d->m_cold_nfree--;
+    COUNTER_ADD(d->m_metrics.m_cold_hits, 1);
+  }
+  else if (!(cold = calloc(1, sizeof(*cold))))
+  {
+    log_warn("calloc:");
+    return NULL;
+  }
+  else
+  {
+    COUNTER_ADD(d->m_metrics.m_cold_misses, 1);
+  }
+
+  memset(&cold->m_req, 0, sizeof(cold->m_req));
+  cold->m_resp.m_status = 0;
+  cold->m_resp.m_keep_alive = 0;
+  cold->m_engine = ENGINE_BUFFER;
+  cold->m_body_fd = 0;
+  cold->m_rd_progr = 0;
+  cold->m_inflight = 0;
+  cold->m_orphan = 0;
+  cold->m_asleep = 0;
+  cold->m_pace = 0;
+  cold->m_pace_kernel = 0;
+  cold->m_zc_issued = cold->m_zc_done = 0;
+  cold->m_zc_fd = 0;
+  memset(cold->m_stamp, 0, sizeof(cold->m_stamp));
+  cold->m_h2 = NULL;
+
+  return cold;
+}
+
+/* a phase ends where the next one begins, the body where the response does */
+static void record_phases(struct conn_t *c, struct data_for_worker *d)
+{
+  struct conn_cold *cold = c->m_cold;
+  uint64_t now = metrics_now(), end;
+  size_t p;
+
+  for (p = 0; p < PHASE_TOTAL; p++)
+  {
+    end = (p + 1 < PHASE_TOTAL) ? cold->m_stamp[p + 1] : now;
+    if (cold->m_stamp[p] && end)
+    {
+      metrics_latency(&d->m_metrics, p, c->m_type, end - cold->m_stamp[p]);
+    }
+  }
+  if (cold->m_stamp[PHASE_RECV])
+  {
+    metrics_latency(&d->m_metrics, PHASE_TOTAL, c->m_type,
+                    now - cold->m_stamp[PHASE_RECV]);
+  }
+  memset(cold->m_stamp, 0, sizeof(cold->m_stamp));
+}
+
+static int take_pipe(struct conn_cold *cold, struct data_for_worker *d)
+{
+  if (d->m_npipes > 0)
+  {
+    d->m_npipes--;
+    cold->m_pipe[0] = d->m_pipes[d->m_npipes][0];
+    cold->m_pipe[1] = d->m_pipes[d->m_npipes][1];
+    return 0;
+  }
+
+  if (pipe2(cold->m_pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+  {
+    log_warn("pipe2:");
+    cold->m_pipe[0] = cold->m_pipe[1] = 0;
+    return -1;
+  }
+  // best effort, a smaller pipe only means more splice calls
+  fcntl(cold->m_pipe[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+
+  return 0;
+}
+
+/* a pipe still holding bytes of a dead response can't be reused */
+static void give_pipe(struct conn_cold *cold, struct data_for_worker *d)
+{
+  if (cold->m_pipe_len == 0 && d->m_npipes < SPLICE_MAX_FREE)
+  {
+    d->m_pipes[d->m_npipes][0] = cold->m_pipe[0];
+    d->m_pipes[d->m_npipes][1] = cold->m_pipe[1];
+    d->m_npipes++;
+  }
+  else
+  {
+    close(cold->m_pipe[0]);
+    close(cold->m_pipe[1]);
+  }
+  cold->m_pipe[0] = cold->m_pipe[1] = 0;
+  cold->m_pipe_len = 0;
+}
+
+static void free_cold(struct conn_cold *cold, struct data_for_worker *d)
+{
+  if (cold->m_pipe[0] > 0)
+  {
+    give_pipe(cold, d);
+  }
+  pool_release(&d->m_pool, &cold->rbuf);
+  pool_release(&d->m_pool, &cold->buf);
+  pool_release(&d->m_pool, &cold->body);
+  pool_release(&d->m_pool, &cold->m_ahead);
+  if (cold->m_body_fd > 0)
+  {
+    close(cold->m_body_fd);
+  }
+
+  if (d->m_cold_nfree < COLD_MAX_FREE)
+  {
+    cold->m_next = d->m_cold_free;
+    d->m_cold_free = cold;
+    d->m_cold_nfree++;
+  }
+  else
+  {
+    free(cold);
+  }
+}
+
+/* a stream's buffer, file and slot in its session */
+static void free_stream(struct h2_stream *s, struct data_for_worker *d)
+{
+  struct h2_session *h = s->m_session;
+  size_t i;
+
+  for (i = 0; i < H2_STREAMS; i++)
+  {
+    if (h->m_stream[i] == s)
+    {
+      h->m_stream[i] = NULL;
+      h->m_nstreams--;
+      break;
+    }
+  }
+  pool_release(&d->m_pool, &s->body);
+  if (s->m_body_fd > 0)
+  {
+    close(s->m_body_fd);
+  }
+  free(s);
+}
+
+static void free_session(struct h2_session *h, struct data_for_worker *d)
+{
+  hpack_free(&h->m_dec);
+  hpack_free(&h->m_enc);
+  pool_release(&d->m_pool, &h->m_block);
+  free(h);
+}
+
+/*
+ * Ends the session of a connection going away, its open streams were
+ * dropped. Those with a job out stay with the orphaned session until
+ * job_done_con sees the last job back.
+ */
+static void close_h2(struct conn_t *c, struct h2_session *h,
+                     struct data_for_worker *d)
+{
+  struct h2_stream *s;
+  size_t i;
+
+  for (i = 0; i < H2_STREAMS; i++)
+  {
+    if ((s = h->m_stream[i]))
+    {
+      log_req(c->m_peer, &s->m_req, 0);
+      if (!s->m_busy)
+      {
+        free_stream(s, d);
+      }
+    }
+  }
+  h->m_conn = NULL;
+  if (h->m_jobs == 0)
+  {
+    free_session(h, d);
+  }
+}
+
+static void release_cold(struct conn_t *c, struct data_for_worker *d)
+{
+  struct conn_cold *cold;
+
+  if (!(cold = c->m_cold))
+  {
+    return;
+  }
+  c->m_cold = NULL;
+  COUNTER_ADD(d->m_load.m_active, -1);
+  if (cold->m_h2)
+  {
+    close_h2(c, cold->m_h2, d);
+    cold->m_h2 = NULL;
+  }
+
+  /*
+   * the kernel still writes into m_ahead, read_done_con frees it later, or
+   * still sends from body, then the tick does once it is done
+   */
+  if (cold->m_inflight || cold->m_zc_fd > 0)
+  {
+    cold->m_orphan = 1;
+    return;
+  }
+  free_cold(cold, d);
+}
+
+static void arm_tick(struct tick *t)
+{
+  static const struct itimerspec every = {{0, LIMIT_TICK}, {0, LIMIT_TICK}};
+
+  if (!t->m_armed)
+  {
+    if (timerfd_settime(t->m_fd, 0, &every, NULL) < 0)
+    {
+      log_warn("timerfd_settime:");
+      return;
+    }
+    t->m_armed = 1;
+  }
+}
+
+/*
+ * Keeps the socket of a connection dropped mid zerocopy send with its cold
+ * part, out of the event queue, until the sends are accounted for.
+ */
+static void linger_con(struct conn_t *c, struct data_for_worker *d)
+{
+  struct conn_cold *cold = c->m_cold;
+
+  queue_rem_fd(d->m_queue_fd, c->m_file_descriptor);
+  shutdown(c->m_file_descriptor, SHUT_RDWR);
+  cold->m_zc_fd = c->m_file_descriptor;
+  cold->m_zc_until = metrics_now() + (uint64_t)ZEROCOPY_LINGER * 1000000000;
+  cold->m_next = d->m_tick.m_linger;
+  d->m_tick.m_linger = cold;
+  arm_tick(&d->m_tick);
+  c->m_file_descriptor = 0;
+}
+
+/*
+ * Frees the lingering cold parts whose sends completed. One whose peer
+ * stopped reading is reset after ZEROCOPY_LINGER, and its body buffer is
+ * left to the kernel rather than handed out again.
+ */
+static void reap_lingering(struct data_for_worker *d)
+{
+  struct conn_cold **p = &d->m_tick.m_linger, *cold;
+  struct linger abort = {1, 0};
+  int err;
+
+  while ((cold = *p))
+  {
+    err = reap_zerocopy_http(cold->m_zc_fd, &cold->m_zc_done);
+    if (!err && cold->m_zc_issued != cold->m_zc_done &&
+        metrics_now() < cold->m_zc_until)
+    {
+      p = &cold->m_next;
+      continue;
+    }
+    *p = cold->m_next;
+    if (cold->m_zc_issued != cold->m_zc_done)
+    {
+      log_warn("zerocopy: %u sends still pinned, leaking %zu bytes",
+               cold->m_zc_issued - cold->m_zc_done, cold->body.size);
+      setsockopt(cold->m_zc_fd, SOL_SOCKET, SO_LINGER, &abort, sizeof(abort));
+      pool_forget(&d->m_pool, &cold->body);
+    }
+    close(cold->m_zc_fd);
+    cold->m_zc_fd = 0;
+    if (!cold->m_inflight)
+    {
+      free_cold(cold, d);
+    }
+  }
 }
 
-void reset_con(struct conn_t *c)
+void reset_con(struct conn_t *c, struct data_for_worker *d)
 {
   if (c != NULL)
   {
-    shutdown(c->m_file_descriptor, SHUT_RDWR);
-    log_info("closed fd: %d\n", c->m_file_descriptor);
-    close(c->m_file_descriptor);
+    if (c->m_file_descriptor > 0)
+    {
+      COUNTER_ADD(d->m_load.m_open, -1);
+      limit_disconnect(&d->m_limits, c->m_peer);
+    }
+    if (zerocopy_pending_con(c))
+    {
+      linger_con(c, d);
+    }
+    release_cold(c, d);
+    tls_free(c->m_ssl);
+    if (c->m_file_descriptor > 0)
+    {
+      shutdown(c->m_file_descriptor, SHUT_RDWR);
+      log_debug("closed fd: %d\n", c->m_file_descriptor);
+      close(c->m_file_descriptor);
+    }
     memset(c, 0, sizeof(*c));
   }
 }
 
-void serve_con(struct conn_t *c, const struct server *srv)
-{
-  enum status s;
-  int done;
+void drop_con(struct conn_t *c, struct data_for_worker *d)
+{
+  if (c->m_cold)
+  {
+    c->m_cold->m_resp.m_status = 0;
+  }
+  log_con(c);
+  reset_con(c, d);
+}
+
+/* the OpenSSL session reads go through, NULL if the socket gives plaintext */
+static struct ssl_st *rx_ssl(const struct conn_t *c)
+{
+  return (c->m_tls & TLS_USER_RX) ? c->m_ssl : NULL;
+}
+
+/* the same for writes; with one, nothing but plain writes reach the socket */
+static struct ssl_st *tx_ssl(const struct conn_t *c)
+{
+  return (c->m_tls & TLS_USER_TX) ? c->m_ssl : NULL;
+}
+
+/* milliseconds, wrapping; only differences are compared */
+static uint32_t idle_clock(void)
+{
+  return metrics_now() / 1000000;
+}
+
+static void recycle_con(struct conn_t *c, struct data_for_worker *d)
+{
+  struct conn_cold *cold = c->m_cold;
+  unsigned int unpaced = ~0U;
+
+  // the next response on this connection isn't necessarily paced
+  if (cold->m_pace_kernel)
+  {
+    setsockopt(c->m_file_descriptor, SOL_SOCKET, SO_MAX_PACING_RATE, &unpaced,
+               sizeof(unpaced));
+    cold->m_pace_kernel = 0;
+  }
+  cold->m_pace = 0;
+
+  c->m_progr = 0;
+  c->m_type = 0;
+  c->m_state = CONN_RECV_HEADER;
+
+  // without a pipelined request waiting the connection goes idle
+  if (cold->rbuf.length == 0 && !(rx_ssl(c) && tls_pending(c->m_ssl)))
+  {
+    release_cold(c, d);
+    return;
+  }
+
+  if (cold->m_body_fd > 0)
+  {
+    close(cold->m_body_fd);
+  }
+  cold->m_body_fd = 0;
+  cold->m_rd_progr = 0;
+  pool_release(&d->m_pool, &cold->buf);
+  pool_release(&d->m_pool, &cold->body);
+  pool_release(&d->m_pool, &cold->m_ahead);
+  memset(&cold->m_req, 0, sizeof(cold->m_req));
+}
+
+/* directory scans and buffered file reads may block on the disk */
+static int produces_blocking(const struct resp_t *res)
+{
+  return res->m_type == RESTYPE_FILE || res->m_type == RESTYPE_DIRLISTING;
+}
+
+/*
+ * Access-pattern hints for a freshly opened body. Long transfers are marked
+ * sequential and get their first window read ahead; a bounded range that
+ * stops short of EOF looks like media seeking, so the segment after it is
+ * prefetched too. Very large files are treated as one-shot downloads whose
+ * pages are dropped behind the cursor, see advise_progress().
+ */
+static void advise_open(struct conn_cold *cold)
+{
+  const struct resp_t *res = &cold->m_resp;
+  size_t len = res->m_file.upper - res->m_file.lower + 1;
+  struct stat st;
+
+  cold->m_ra_off = cold->m_drop_off = res->m_file.lower;
+  cold->m_ra_on = len >= READAHEAD_MIN;
+  cold->m_drop_on = 0;
+  if (fstat(cold->m_body_fd, &st) < 0)
+  {
+    return;
+  }
+  cold->m_drop_on = st.st_size >= DONTNEED_MIN;
+
+  if (cold->m_ra_on)
+  {
+    posix_fadvise(cold->m_body_fd, res->m_file.lower, len,
+                  POSIX_FADV_SEQUENTIAL);
+    readahead(cold->m_body_fd, res->m_file.lower, READAHEAD_WINDOW);
+    cold->m_ra_off += READAHEAD_WINDOW;
+  }
+  if (res->m_field[RES_CONTENT_RANGE][0] &&
+      res->m_file.upper + 1 < (size_t)st.st_size)
+  {
+    readahead(cold->m_body_fd, res->m_file.upper + 1,
+              MIN(len, READAHEAD_WINDOW));
+  }
+}
+
+/*
+ * Keeps readahead one window ahead of the send cursor and, for one-shot
+ * downloads, drops what is a window behind it. With final set, everything
+ * already sent is dropped.
+ */
+static void advise_progress(const struct conn_t *c, struct conn_cold *cold,
+                            int final)
+{
+  size_t cursor = cold->m_resp.m_file.lower + c->m_progr;
+  size_t end = cold->m_resp.m_file.upper + 1;
+  size_t n;
+
+  if (cold->m_ra_on && cold->m_ra_off < end &&
+      cursor + READAHEAD_WINDOW / 2 >= cold->m_ra_off)
+  {
+    n = MIN(READAHEAD_WINDOW, end - cold->m_ra_off);
+    readahead(cold->m_body_fd, cold->m_ra_off, n);
+    cold->m_ra_off += n;
+  }
+  if (cold->m_drop_on &&
+      (final || cursor >= cold->m_drop_off + 2 * READAHEAD_WINDOW))
+  {
+    n = final ? cursor - cold->m_drop_off
+              : cursor - READAHEAD_WINDOW - cold->m_drop_off;
+    posix_fadvise(cold->m_body_fd, cold->m_drop_off, n, POSIX_FADV_DONTNEED);
+    cold->m_drop_off += n;
+  }
+}
+
+/* runs on an offload thread, the owning worker doesn't touch c meanwhile */
+static void resolve_job(struct offload_job *job)
+{
+  struct conn_t *c = job->m_arg;
+  struct conn_cold *cold = c->m_cold;
+
+  prepare_resp_http(&cold->m_req, &cold->m_resp, cold->m_serv);
+  if (has_body(&cold->m_req, &cold->m_resp) &&
+      cold->m_resp.m_type == RESTYPE_FILE)
+  {
+    if ((cold->m_body_fd = open(cold->m_resp.m_internal_path,
+                                O_RDONLY | O_CLOEXEC)) < 0)
+    {
+      cold->m_body_fd = 0;
+      prepare_err_resp_http(&cold->m_req, &cold->m_resp, STATUS_FORBIDDEN);
+    }
+    else
+    {
+      cold->m_engine = data_fct[RESTYPE_FILE].m_engine;
+      cold->m_resp.m_file.fd = cold->m_body_fd;
+      advise_open(cold);
+    }
+  }
+}
+
+static void fill_job(struct offload_job *job)
+{
+  struct conn_t *c = job->m_arg;
+  struct conn_cold *cold = c->m_cold;
+
+  cold->m_job_status = data_fct[cold->m_resp.m_type].m_fill(
+      &cold->m_resp, &cold->body, &cold->m_job_progr);
+}
+
+static void wait_con(struct conn_t *c, enum conn_state_t resume)
+{
+  struct conn_cold *cold = c->m_cold;
+
+  cold->m_resume = resume;
+  cold->m_job_status = 0;
+  cold->m_job_progr = c->m_progr;
+  c->m_state = CONN_WAIT_IO;
+}
+
+/* hands the blocking part of a request to the offload pool */
+static void park_con(struct conn_t *c, struct data_for_worker *d,
+                     void (*fn)(struct offload_job *), enum conn_state_t resume)
+{
+  struct conn_cold *cold = c->m_cold;
+
+  wait_con(c, resume);
+  cold->m_serv = d->m_serv;
+  cold->m_job.m_fn = fn;
+  cold->m_job.m_arg = c;
+  cold->m_job.m_done = &d->m_done;
+
+  offload_submit(&cold->m_job);
+}
+
+int tick_init(struct tick *t)
+{
+  t->m_armed = 0;
+  t->m_head = t->m_tail = t->m_linger = NULL;
+  if ((t->m_fd = timerfd_create(CLOCK_MONOTONIC,
+                                TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+  {
+    log_warn("timerfd_create:");
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Puts a transfer out of byte tokens to sleep until the worker's next tick.
+ * It waits out of the event queue, where its writable socket would only
+ * wake it again at once. A job status left by a read in flight is kept.
+ */
+static void sleep_con(struct conn_t *c, struct data_for_worker *d)
+{
+  struct conn_cold *cold = c->m_cold;
+  struct tick *t = &d->m_tick;
+
+  cold->m_resume = c->m_state;
+  cold->m_job_progr = c->m_progr;
+  cold->m_asleep = 1;
+  c->m_state = CONN_WAIT_IO;
+
+  cold->m_next = NULL;
+  if (t->m_tail)
+  {
+    t->m_tail->m_next = cold;
+  }
+  else
+  {
+    t->m_head = cold;
+  }
+  t->m_tail = cold;
+  COUNTER_ADD(d->m_metrics.m_throttled, 1);
+  arm_tick(t);
+}
+
+/*
+ * The sleepers of the tick that just fired, after the lingering cold parts
+ * were looked at. A tick without either, and without a backlog waiting for
+ * idle slots to be reclaimed, stops it.
+ */
+struct conn_cold *wake_cons(struct data_for_worker *d)
+{
+  static const struct itimerspec never;
+  struct tick *t = &d->m_tick;
+  struct conn_cold *list, *cold;
+  uint64_t n;
+
+  if (read(t->m_fd, &n, sizeof(n)) < 0 && errno != EAGAIN)
+  {
+    log_warn("read:");
+  }
+  reap_lingering(d);
+  list = t->m_head;
+  t->m_head = t->m_tail = NULL;
+  if (!list && !t->m_linger && !d->m_backlog && t->m_armed)
+  {
+    timerfd_settime(t->m_fd, 0, &never, NULL);
+    t->m_armed = 0;
+  }
+  for (cold = list; cold; cold = cold->m_next)
+  {
+    cold->m_asleep = 0;
+  }
+
+  return list;
+}
+
+/* the rate of the first pacing rule matching a large file body, 0 if none */
+static size_t pace_rate(const struct req_t *req, const struct resp_t *res,
+                        const struct server *srv)
+{
+  const struct pace_rule *r;
+  const char *s;
+  size_t i;
+
+  if (res->m_type != RESTYPE_FILE || !has_body(req, res) ||
+      res->m_file.upper + 1 - res->m_file.lower < PACE_MIN)
+  {
+    return 0;
+  }
+  for (i = 0; i < srv->npace; i++)
+  {
+    r = &srv->pace[i];
+    s = r->m_match[0] == '/' ? req->m_path : res->m_field[RES_CONTENT_TYPE];
+    if (!strncmp(s, r->m_match, strlen(r->m_match)))
+    {
+      return r->m_rate;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Paces a large file body to its rule's rate. Where the kernel can, the
+ * socket gets SO_MAX_PACING_RATE (TCP paces itself without the fq qdisc)
+ * and the transfer runs as usual; otherwise it gets send credit for the
+ * time that passed and sleeps on the worker's tick when that runs out.
+ */
+static void pace_con(struct conn_t *c, struct data_for_worker *d)
+{
+  struct conn_cold *cold = c->m_cold;
+  unsigned int rate;
+  size_t want;
+
+  if (!(want = pace_rate(&cold->m_req, &cold->m_resp, d->m_serv)))
+  {
+    return;
+  }
+  COUNTER_ADD(d->m_metrics.m_paced, 1);
+  rate = MIN(want, (size_t)UINT_MAX - 1);
+  if (PACE_KERNEL && !setsockopt(c->m_file_descriptor, SOL_SOCKET,
+                                 SO_MAX_PACING_RATE, &rate, sizeof(rate)))
+  {
+    cold->m_pace_kernel = 1;
+    return;
+  }
+  cold->m_pace = want;
+  cold->m_pace_at = metrics_now();
+  cold->m_pace_sent = 0;
+}
+
+/*
+ * Send credit of a transfer paced by credit to pace bytes a second since
+ * at, *sent of them sent; SIZE_MAX for any other. It starts with a burst;
+ * what a stalled client leaves unused beyond one is forfeited rather than
+ * sent in one go later.
+ */
+static size_t pace_credit(size_t pace, uint64_t at, size_t *sent)
+{
+  size_t due, burst;
+  uint64_t us;
+
+  if (!pace)
+  {
+    return SIZE_MAX;
+  }
+  burst = MAX(PACE_BURST, pace / 10);
+  us = (metrics_now() - at) / 1000;
+  due = burst + pace * (us / 1000000) + pace * (us % 1000000) / 1000000;
+  if (due - *sent > burst)
+  {
+    *sent = due - burst;
+  }
+
+  return due - *sent;
+}
+
+/*
+ * Body bytes c may write now under its client's byte rate and its pace,
+ * SIZE_MAX if neither applies. At 0 c has been put to sleep.
+ */
+static size_t allowance(struct conn_t *c, struct data_for_worker *d)
+{
+  size_t n;
+
+  n = MIN(limit_bytes(&d->m_limits, c->m_peer),
+          pace_credit(c->m_cold->m_pace, c->m_cold->m_pace_at,
+                      &c->m_cold->m_pace_sent));
+  if (n == 0)
+  {
+    sleep_con(c, d);
+  }
+
+  return n;
+}
+
+/* bytes written, counted against the client's byte rate and the pace */
+static void charge(const struct conn_t *c, struct data_for_worker *d,
+                   size_t n)
+{
+  COUNTER_ADD(d->m_metrics.m_bytes_sent, n);
+  limit_charge(&d->m_limits, c->m_peer, n);
+  c->m_cold->m_pace_sent += n;
+}
+
+/*
+ * One step of the splice engine. The worker's pipe is only borrowed while
+ * it holds bytes of this response, so an idle pair serves every connection.
+ */
+static enum status splice_body(struct conn_t *c, struct data_for_worker *d,
+                               size_t max)
+{
+  struct conn_cold *cold = c->m_cold;
+  enum status s;
+
+  if (cold->m_pipe[0] <= 0 && take_pipe(cold, d))
+  {
+    return STATUS_INTERNAL_SERVER_ERROR;
+  }
+  s = send_splice_http(c->m_file_descriptor, cold->m_body_fd, cold->m_pipe,
+                       &cold->m_resp, &c->m_progr, &cold->m_pipe_len, max);
+  if (cold->m_pipe_len == 0)
+  {
+    give_pipe(cold, d);
+  }
+
+  return s;
+}
+
+/*
+ * Writes at most *max bytes of the body, taking what went out off *max.
+ * Big memory bodies are pinned rather than copied where enabled.
+ */
+static enum status send_body(const struct conn_t *c, struct data_for_worker *d,
+                             size_t *max)
+{
+  struct conn_cold *cold = c->m_cold;
+  struct my_buffer cut = cold->body;
+  size_t before, sent;
+  enum status s;
+
+  cut.length = cut.offset + MIN(pending(&cut), *max);
+  before = pending(&cut);
+  if (c->m_zerocopy && before >= ZEROCOPY_MIN)
+  {
+    s = send_buffer_zc_http(c->m_file_descriptor, &cut, &cold->m_zc_issued);
+  }
+  else
+  {
+    s = send_buffer_http(c->m_file_descriptor, tx_ssl(c), &cut);
+  }
+  sent = before - pending(&cut);
+  buffer_consume(&cold->body, sent);
+  *max -= sent;
+  charge(c, d, sent);
+
+  return s;
+}
+
+/*
+ * Whether the kernel may still read from a sent body buffer, 1 if so, 0 if
+ * the buffer is free to refill or release, -1 on a socket error.
+ */
+static int zerocopy_busy(const struct conn_t *c, struct conn_cold *cold)
+{
+  if (cold->m_zc_issued == cold->m_zc_done)
+  {
+    return 0;
+  }
+  if (reap_zerocopy_http(c->m_file_descriptor, &cold->m_zc_done))
+  {
+    return -1;
+  }
+
+  return cold->m_zc_issued != cold->m_zc_done;
+}
+
+int zerocopy_pending_con(const struct conn_t *c)
+{
+  return c->m_cold && c->m_cold->m_zc_issued != c->m_cold->m_zc_done;
+}
+
+/*
+ * One connection sends at most WRITE_QUOTA bytes per wakeup, then steps
+ * aside. Re-arming reports a still writable socket again, even edge
+ * triggered, so it resumes with the next queue_wait.
+ */
+static int out_of_quota(struct data_for_worker *d, size_t start)
+{
+  if (d->m_metrics.m_bytes_sent - start < WRITE_QUOTA)
+  {
+    return 0;
+  }
+  COUNTER_ADD(d->m_metrics.m_yields, 1);
+
+  return 1;
+}
+
+/* a file body with more than a quota left, served after everything else */
+int bulk_con(const struct conn_t *c)
+{
+  const struct resp_t *res;
+
+  if (c->m_state != CONN_SEND_BODY || c->m_type != RESTYPE_FILE)
+  {
+    return 0;
+  }
+  res = &c->m_cold->m_resp;
+
+  return res->m_file.upper + 1 - res->m_file.lower - c->m_progr > WRITE_QUOTA;
+}
+
+static int read_ahead(struct conn_t *c, struct data_for_worker *d)
+{
+  struct conn_cold *cold = c->m_cold;
+  size_t len = cold->m_resp.m_file.upper - cold->m_resp.m_file.lower + 1;
+
+  if (uring_read(&d->m_ring, cold->m_body_fd, cold->m_ahead.data,
+                 MIN(cold->m_ahead.size, len - cold->m_rd_progr),
+                 cold->m_resp.m_file.lower + cold->m_rd_progr, cold))
+  {
+    return -1;
+  }
+  cold->m_inflight = 1;
+
+  return 0;
+}
+
+/*
+ * Double-buffered file streaming: body is on the wire while the next chunk
+ * is read into m_ahead by io_uring. m_progr counts bytes handed to the
+ * socket. Returns 0 once the range is sent, 1 when waiting on the socket,
+ * (parked) on the ring or out of quota, -1 on error.
+ */
+static int stream_uring(struct conn_t *c, struct data_for_worker *d,
+                        size_t start)
+{
+  struct conn_cold *cold = c->m_cold;
+  size_t len = cold->m_resp.m_file.upper - cold->m_resp.m_file.lower + 1;
+  struct my_buffer tmp;
+  size_t max;
+
+  if ((cold->body.data == NULL &&
+       pool_lease(&d->m_pool, &cold->body,
+                  body_lease_size(&cold->m_resp))) ||
+      (cold->m_ahead.data == NULL &&
+       pool_lease(&d->m_pool, &cold->m_ahead,
+                  body_lease_size(&cold->m_resp))))
+  {
+    return -1;
+  }
+
+  for (;;)
+  {
+    if (cold->body.length > 0)
+    {
+      if (!(max = allowance(c, d)))
+      {
+        return 1;
+      }
+      if (send_body(c, d, &max))
+      {
+        return -1;
+      }
+      if (cold->body.length > 0)
+      {
+        // the allowance ran out rather than the socket's buffer
+        if (max == 0)
+        {
+          sleep_con(c, d);
+        }
+        return 1;
+      }
+    }
+    // the drained buffer gets reused for the next read
+    switch (zerocopy_busy(c, cold))
+    {
+    case 0:
+      break;
+    case 1:
+      c->m_state = CONN_WAIT_ZC;
+      return 1;
+    default:
+      return -1;
+    }
+    if (cold->m_job_status)
+    {
+      return -1;
+    }
+    if (c->m_progr == len)
+    {
+      return 0;
+    }
+    if (cold->m_inflight)
+    {
+      wait_con(c, CONN_SEND_BODY);
+      return 1;
+    }
+    if (cold->m_ahead.length == 0)
+    {
+      if (read_ahead(c, d))
+      {
+        return -1;
+      }
+      continue;
+    }
+    if (out_of_quota(d, start))
+    {
+      return 1;
+    }
+
+    tmp = cold->body;
+    cold->body = cold->m_ahead;
+    cold->m_ahead = tmp;
+    c->m_progr += cold->body.length;
+    advise_progress(c, cold, 0);
+    if (cold->m_rd_progr < len && read_ahead(c, d))
+    {
+      return -1;
+    }
+  }
+}
+
+/*
+ * Called by the worker for every io_uring completion. Returns the
+ * connection if it was parked on this read and has to be served again.
+ */
+struct conn_t *read_done_con(void *data, int res, struct data_for_worker *d)
+{
+  struct conn_cold *cold = data;
+
+  cold->m_inflight = 0;
+  if (cold->m_orphan)
+  {
+    // a lingering one is freed by the tick
+    if (cold->m_zc_fd == 0)
+    {
+      free_cold(cold, d);
+    }
+    return NULL;
+  }
+
+  // the size was checked when the range was resolved, EOF here is an error
+  if (res <= 0)
+  {
+    cold->m_job_status = STATUS_INTERNAL_SERVER_ERROR;
+  }
+  else
+  {
+    cold->m_ahead.offset = 0;
+    cold->m_ahead.length = res;
+    cold->m_rd_progr += res;
+  }
+
+  // a sleeper waits for its tick, the read is picked up then
+  if (cold->m_conn->m_state != CONN_WAIT_IO || cold->m_asleep)
+  {
+    return NULL;
+  }
+  cold->m_job_progr = cold->m_conn->m_progr;
+
+  return cold->m_conn;
+}
+
+/* resolve_job for a stream of an HTTP/2 session */
+static void resolve_stream_job(struct offload_job *job)
+{
+  struct h2_stream *s = job->m_arg;
+
+  prepare_resp_http(&s->m_req, &s->m_resp, s->m_serv);
+  if (has_body(&s->m_req, &s->m_resp) && s->m_resp.m_type == RESTYPE_FILE)
+  {
+    if ((s->m_body_fd = open(s->m_resp.m_internal_path,
+                             O_RDONLY | O_CLOEXEC)) < 0)
+    {
+      s->m_body_fd = 0;
+      prepare_err_resp_http(&s->m_req, &s->m_resp, STATUS_FORBIDDEN);
+    }
+    else
+    {
+      s->m_resp.m_file.fd = s->m_body_fd;
+    }
+  }
+}
+
+static void fill_stream_job(struct offload_job *job)
+{
+  struct h2_stream *s = job->m_arg;
+
+  s->m_job_status = data_fct[s->m_resp.m_type].m_fill(&s->m_resp, &s->body,
+                                                      &s->m_progr);
+}
+
+/* the stream's park_con, the connection itself goes on serving the rest */
+static void park_stream(struct h2_stream *s, struct data_for_worker *d,
+                        void (*fn)(struct offload_job *))
+{
+  s->m_busy = 1;
+  s->m_serv = d->m_serv;
+  s->m_job.m_fn = fn;
+  s->m_job.m_arg = s;
+  s->m_job.m_done = &d->m_done;
+  s->m_session->m_jobs++;
+
+  offload_submit(&s->m_job);
+}
+
+/*
+ * Called by the worker for every job back from the offload pool. Returns
+ * the connection to serve again, NULL for a stream whose session is gone.
+ */
+struct conn_t *job_done_con(struct offload_job *job,
+                            struct data_for_worker *d)
+{
+  struct h2_stream *s = job->m_arg;
+  struct h2_session *h;
+
+  if (job->m_fn != resolve_stream_job && job->m_fn != fill_stream_job)
+  {
+    return job->m_arg;
+  }
+  h = s->m_session;
+  s->m_busy = 0;
+  h->m_jobs--;
+  // an empty refill means the producer has nothing more to give
+  if (job->m_fn == fill_stream_job && s->body.length == 0)
+  {
+    s->m_eof = 1;
+  }
+  // a sleeping session picks the stream up when its tick wakes it
+  if (h->m_conn)
+  {
+    return h->m_conn->m_cold->m_asleep ? NULL : h->m_conn;
+  }
+
+  free_stream(s, d);
+  if (h->m_jobs == 0)
+  {
+    free_session(h, d);
+  }
+
+  return NULL;
+}
+
+/* free space after out's data, once what is still unsent moved to the front */
+static size_t room(struct my_buffer *out)
+{
+  if (out->offset > 0)
+  {
+    memmove(out->data, out->data + out->offset, out->length - out->offset);
+    out->length -= out->offset;
+    out->offset = 0;
+  }
+
+  return out->size - out->length;
+}
+
+static void reset_stream(struct my_buffer *out, uint32_t id,
+                         enum h2_error err)
+{
+  uint8_t p[4];
+
+  h2_put32(p, err);
+  h2_frame_append(out, H2_RST_STREAM, 0, id, p, sizeof(p));
+}
+
+/* a stream is done with: counted, logged, status 0 if it was dropped */
+static void end_stream(struct conn_t *c, struct h2_stream *s,
+                       enum status status, struct data_for_worker *d)
+{
+  if (status)
+  {
+    metrics_request(&d->m_metrics, status);
+  }
+  log_req(c->m_peer, &s->m_req, status);
+  free_stream(s, d);
+}
+
+/* a busy stream is only marked, it ends once its job is back */
+static void cancel_stream(struct conn_t *c, struct h2_stream *s,
+                          struct data_for_worker *d)
+{
+  if (s->m_busy)
+  {
+    s->m_cancelled = 1;
+    return;
+  }
+  end_stream(c, s, 0, d);
+}
+
+static struct h2_stream *find_stream(const struct h2_session *h, uint32_t id)
+{
+  size_t i;
+
+  for (i = 0; i < H2_STREAMS; i++)
+  {
+    if (h->m_stream[i] && h->m_stream[i]->m_id == id)
+    {
+      return h->m_stream[i];
+    }
+  }
+
+  return NULL;
+}
+
+/*
+ * A request's header block is complete. It is decoded whatever becomes of
+ * the stream, or the next block would decode against the wrong table; a
+ * valid request is then resolved like an HTTP/1.1 one. 0, or the error to
+ * end the session with.
+ */
+static int open_stream(struct conn_t *c, struct h2_session *h, uint32_t id,
+                       const void *block, size_t len,
+                       struct data_for_worker *d)
+{
+  static __thread char text[H2_REQUEST_MAX];
+  struct my_buffer *out = &c->m_cold->buf;
+  struct h2_stream *s;
+  enum status st;
+  size_t i;
+  int err;
+
+  err = h2_request(&h->m_dec, block, len, text, sizeof(text));
+  if (err == H2_COMPRESSION_ERROR)
+  {
+    return err;
+  }
+  // trailers of a request body, nothing we have a use for
+  if (id <= h->m_last_id)
+  {
+    return 0;
+  }
+  h->m_last_id = id;
+  if (err == H2_PROTOCOL_ERROR)
+  {
+    reset_stream(out, id, H2_PROTOCOL_ERROR);
+    return 0;
+  }
+  if (h->m_nstreams == H2_STREAMS || !(s = calloc(1, sizeof(*s))))
+  {
+    reset_stream(out, id, H2_REFUSED_STREAM);
+    return 0;
+  }
+  for (i = 0; h->m_stream[i]; i++)
+    ;
+  h->m_stream[i] = s;
+  h->m_nstreams++;
+  s->m_id = id;
+  s->m_window = h->m_initial;
+  s->m_session = h;
+  s->m_state = H2S_HEADERS;
+  COUNTER_ADD(d->m_metrics.m_h2_streams, 1);
+
+  // a request too big for its HTTP/1.1 form gets what a too big header gets
+  if (err)
+  {
+    prepare_err_resp_http(&s->m_req, &s->m_resp,
+                          STATUS_INTERNAL_SERVER_ERROR);
+  }
+  else if ((st = parse_header_http(text, &s->m_req)))
+  {
+    prepare_err_resp_http(&s->m_req, &s->m_resp, st);
+  }
+  else if (limit_request(&d->m_limits, c->m_peer))
+  {
+    prepare_err_resp_http(&s->m_req, &s->m_resp, STATUS_TOO_MANY_REQUESTS);
+  }
+  else
+  {
+    park_stream(s, d, resolve_stream_job);
+  }
+
+  return 0;
+}
+
+/* collects a header block split over CONTINUATION frames, up to HEADER_MAX */
+static int collect_block(struct h2_session *h, const void *p, size_t len,
+                         struct data_for_worker *d)
+{
+  struct my_buffer *b = &h->m_block;
+
+  if (b->data == NULL && pool_lease(&d->m_pool, b, len))
+  {
+    return -1;
+  }
+  if (len > b->size - b->length &&
+      (b->length + len > HEADER_MAX ||
+       pool_grow(&d->m_pool, b, b->length + len)))
+  {
+    return -1;
+  }
+
+  return buffer_append_mem(b, p, len) ? -1 : 0;
+}
+
+/* the peer's SETTINGS, 0 or the error to end the session with */
+static int settings_h2(struct h2_session *h, const uint8_t *p, size_t len)
+{
+  struct h2_stream *s;
+  uint32_t v;
+  size_t i, k;
+
+  for (i = 0; i + 6 <= len; i += 6)
+  {
+    v = h2_get32(p + i + 2);
+    switch (p[i] << 8 | p[i + 1])
+    {
+    case H2_HEADER_TABLE_SIZE:
+      hpack_resize(&h->m_enc, v);
+      break;
+    case H2_INITIAL_WINDOW_SIZE:
+      if (v > H2_WINDOW_MAX)
+      {
+        return H2_FLOW_CONTROL_ERROR;
+      }
+      // open streams move by the difference, into the negative if need be
+      for (k = 0; k < H2_STREAMS; k++)
+      {
+        if ((s = h->m_stream[k]))
+        {
+          s->m_window += (int64_t)v - h->m_initial;
+        }
+      }
+      h->m_initial = v;
+      break;
+    case H2_MAX_FRAME_SIZE:
+      if (v < H2_FRAME_MAX || v > 0xffffff)
+      {
+        return H2_PROTOCOL_ERROR;
+      }
+      h->m_max_frame = v;
+      break;
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * One frame from the peer, its payload at p. Request bodies aren't used,
+ * their bytes are handed back to the peer's windows right away. 0, or the
+ * error to end the session with.
+ */
+static int frame_h2(struct conn_t *c, struct h2_session *h,
+                    const struct h2_frame *f, const uint8_t *p,
+                    struct data_for_worker *d)
+{
+  struct my_buffer *out = &c->m_cold->buf;
+  struct h2_stream *s;
+  size_t skip = 0, pad = 0;
+  uint8_t inc[4];
+  uint32_t v;
+  int err;
+
+  // nothing may come between the pieces of a header block
+  if (h->m_cont &&
+      (f->m_type != H2_CONTINUATION || f->m_stream != h->m_cont))
+  {
+    return H2_PROTOCOL_ERROR;
+  }
+
+  switch (f->m_type)
+  {
+  case H2_DATA:
+    if (f->m_stream == 0)
+    {
+      return H2_PROTOCOL_ERROR;
+    }
+    if (f->m_len > 0)
+    {
+      h2_put32(inc, f->m_len);
+      h2_frame_append(out, H2_WINDOW_UPDATE, 0, 0, inc, sizeof(inc));
+      if (find_stream(h, f->m_stream))
+      {
+        h2_frame_append(out, H2_WINDOW_UPDATE, 0, f->m_stream, inc,
+                        sizeof(inc));
+      }
+    }
+    return 0;
+
+  case H2_HEADERS:
+    if (!(f->m_stream & 1))
+    {
+      return H2_PROTOCOL_ERROR;
+    }
+    if (f->m_flags & H2_PADDED)
+    {
+      if (f->m_len < 1)
+      {
+        return H2_PROTOCOL_ERROR;
+      }
+      pad = p[0];
+      skip = 1;
+    }
+    if (f->m_flags & H2_PRIORITY_FLAG)
+    {
+      skip += 5;
+    }
+    if (skip + pad > f->m_len)
+    {
+      return H2_PROTOCOL_ERROR;
+    }
+    if (f->m_flags & H2_END_HEADERS)
+    {
+      return open_stream(c, h, f->m_stream, p + skip, f->m_len - skip - pad,
+                         d);
+    }
+    h->m_cont = f->m_stream;
+    return collect_block(h, p + skip, f->m_len - skip - pad, d)
+               ? H2_ENHANCE_YOUR_CALM
+               : 0;
+
+  case H2_CONTINUATION:
+    if (!h->m_cont)
+    {
+      return H2_PROTOCOL_ERROR;
+    }
+    if (collect_block(h, p, f->m_len, d))
+    {
+      return H2_ENHANCE_YOUR_CALM;
+    }
+    if (!(f->m_flags & H2_END_HEADERS))
+    {
+      return 0;
+    }
+    h->m_cont = 0;
+    err = open_stream(c, h, f->m_stream, h->m_block.data, h->m_block.length,
+                      d);
+    pool_release(&d->m_pool, &h->m_block);
+    return err;
+
+  case H2_PRIORITY:
+    return (f->m_len == 5) ? 0 : H2_FRAME_SIZE_ERROR;
+
+  case H2_RST_STREAM:
+    if (f->m_stream == 0 || f->m_len != 4)
+    {
+      return f->m_stream ? H2_FRAME_SIZE_ERROR : H2_PROTOCOL_ERROR;
+    }
+    if ((s = find_stream(h, f->m_stream)))
+    {
+      cancel_stream(c, s, d);
+    }
+    return 0;
+
+  case H2_SETTINGS:
+    if (f->m_stream)
+    {
+      return H2_PROTOCOL_ERROR;
+    }
+    if (f->m_flags & H2_ACK)
+    {
+      return f->m_len ? H2_FRAME_SIZE_ERROR : 0;
+    }
+    if (f->m_len % 6)
+    {
+      return H2_FRAME_SIZE_ERROR;
+    }
+    if ((err = settings_h2(h, p, f->m_len)))
+    {
+      return err;
+    }
+    h2_frame_append(out, H2_SETTINGS, H2_ACK, 0, "", 0);
+    return 0;
+
+  case H2_PING:
+    if (f->m_stream || f->m_len != 8)
+    {
+      return f->m_stream ? H2_PROTOCOL_ERROR : H2_FRAME_SIZE_ERROR;
+    }
+    if (!(f->m_flags & H2_ACK))
+    {
+      h2_frame_append(out, H2_PING, H2_ACK, 0, p, 8);
+    }
+    return 0;
+
+  case H2_GOAWAY:
+    h->m_goaway = 1;
+    return 0;
+
+  case H2_WINDOW_UPDATE:
+    if (f->m_len != 4)
+    {
+      return H2_FRAME_SIZE_ERROR;
+    }
+    v = h2_get32(p) & 0x7fffffff;
+    if (f->m_stream == 0)
+    {
+      if (v == 0 || h->m_window + v > H2_WINDOW_MAX)
+      {
+        return v ? H2_FLOW_CONTROL_ERROR : H2_PROTOCOL_ERROR;
+      }
+      h->m_window += v;
+    }
+    else if ((s = find_stream(h, f->m_stream)))
+    {
+      if (v == 0 || s->m_window + v > H2_WINDOW_MAX)
+      {
+        reset_stream(out, s->m_id,
+                     v ? H2_FLOW_CONTROL_ERROR : H2_PROTOCOL_ERROR);
+        cancel_stream(c, s, d);
+      }
+      else
+      {
+        s->m_window += v;
+      }
+    }
+    return 0;
+
+  case H2_PUSH_PROMISE:
+    return H2_PROTOCOL_ERROR;
+
+  default:
+    // frames of extensions we don't know are ignored
+    return 0;
+  }
+}
+
+/*
+ * Reads and handles the peer's frames as long as out has room for what
+ * they may call for. 0, or the error to end the session with; *eof once
+ * the peer closed.
+ */
+static int input_h2(struct conn_t *c, struct h2_session *h,
+                    struct data_for_worker *d, int *eof)
+{
+  struct my_buffer *in = &c->m_cold->rbuf;
+  struct h2_frame f;
+  size_t before;
+  int err;
+
+  for (;;)
+  {
+    if (!h->m_preface && pending(in) >= H2_PREFACE_LEN)
+    {
+      if (memcmp(in->data + in->offset, H2_PREFACE, H2_PREFACE_LEN))
+      {
+        return H2_PROTOCOL_ERROR;
+      }
+      buffer_consume(in, H2_PREFACE_LEN);
+      h->m_preface = 1;
+      continue;
+    }
+    if (h->m_preface && pending(in) >= H2_FRAME_HEADER)
+    {
+      h2_frame_parse(in->data + in->offset, &f);
+      if (f.m_len > H2_FRAME_MAX)
+      {
+        return H2_FRAME_SIZE_ERROR;
+      }
+      if (pending(in) >= H2_FRAME_HEADER + f.m_len)
+      {
+        if (room(&c->m_cold->buf) < H2_CONTROL_ROOM)
+        {
+          return 0;
+        }
+        if ((err = frame_h2(c, h, &f,
+                            (uint8_t *)in->data + in->offset + H2_FRAME_HEADER,
+                            d)))
+        {
+          return err;
+        }
+        buffer_consume(in, H2_FRAME_HEADER + f.m_len);
+        continue;
+      }
+    }
+    if (*eof)
+    {
+      return 0;
+    }
+
+    // the rest of a frame goes right after its start
+    room(in);
+    before = in->length;
+    if (receive_buffer_http(c->m_file_descriptor, rx_ssl(c), in, eof))
+    {
+      return H2_INTERNAL_ERROR;
+    }
+    if (in->length == before)
+    {
+      return 0;
+    }
+  }
+}
+
+/* the response's header block in one HEADERS frame, END_STREAM if last */
+static int headers_h2(struct h2_session *h, struct h2_stream *s,
+                      struct my_buffer *out, int last)
+{
+  struct my_buffer block;
+
+  block.data = out->data + out->length + H2_FRAME_HEADER;
+  block.size = MIN(out->size - out->length - H2_FRAME_HEADER, h->m_max_frame);
+  buffer_reset(&block);
+  if (prep_header_h2_http(&s->m_resp, &h->m_enc, &block))
+  {
+    return -1;
+  }
+  h2_frame_header(out->data + out->length, block.length, H2_HEADERS,
+                  H2_END_HEADERS | (last ? H2_END_STREAM : 0), s->m_id);
+  out->length += H2_FRAME_HEADER + block.length;
+
+  return 0;
+}
+
+/*
+ * Moves a stream along by a frame, its HEADERS or the next DATA frame, with
+ * a refill of its body first where that ran dry. A DATA frame is as big as
+ * both windows, the peer's frame size, out, the client's byte rate and the
+ * stream's pace allow; the last two are always paced by credit, the socket
+ * is shared. 1 if the stream got anywhere, 0 if it waits on any of them,
+ * -1 if the session can't go on.
+ */
+static int step_stream(struct conn_t *c, struct h2_session *h,
+                       struct h2_stream *s, struct data_for_worker *d)
+{
+  struct my_buffer *out = &c->m_cold->buf;
+  const struct resp_t *res = &s->m_resp;
+  size_t n, avail, space, budget;
+  enum status st;
+  int last;
+
+  if (s->m_cancelled)
+  {
+    end_stream(c, s, 0, d);
+    return 1;
+  }
+  if ((st = s->m_job_status))
+  {
+    if (room(out) < H2_CONTROL_ROOM)
+    {
+      return 0;
+    }
+    reset_stream(out, s->m_id, H2_INTERNAL_ERROR);
+    end_stream(c, s, st, d);
+    return 1;
+  }
+
+  if (s->m_state == H2S_HEADERS)
+  {
+    if (room(out) < H2_FRAME_HEADER + H2_BLOCK_MAX)
+    {
+      return 0;
+    }
+    last = !has_body(&s->m_req, res);
+    if (headers_h2(h, s, out, last))
+    {
+      return -1;
+    }
+    if (last)
+    {
+      end_stream(c, s, res->m_status, d);
+      return 1;
+    }
+    // no more than a window or so per stream, however big the file
+    if (pool_lease(&d->m_pool, &s->body,
+                   MIN(body_lease_size(res), pool_size(POOL_BULK_S))))
+    {
+      s->m_job_status = STATUS_INTERNAL_SERVER_ERROR;
+      return 1;
+    }
+    if ((s->m_pace = pace_rate(&s->m_req, res, d->m_serv)))
+    {
+      COUNTER_ADD(d->m_metrics.m_paced, 1);
+      s->m_pace_at = metrics_now();
+    }
+    s->m_state = H2S_BODY;
+    return 1;
+  }
+
+  if (res->m_type == RESTYPE_FILE &&
+      s->m_progr == res->m_file.upper + 1 - res->m_file.lower)
+  {
+    s->m_eof = 1;
+  }
+  if (pending(&s->body) == 0 && !s->m_eof)
+  {
+    if (produces_blocking(res))
+    {
+      park_stream(s, d, fill_stream_job);
+      return 1;
+    }
+    if ((s->m_job_status =
+             data_fct[res->m_type].m_fill(res, &s->body, &s->m_progr)))
+    {
+      return 1;
+    }
+    s->m_eof = s->body.length == 0;
+  }
+
+  if ((space = room(out)) < H2_FRAME_HEADER)
+  {
+    return 0;
+  }
+  avail = pending(&s->body);
+  n = MIN(MIN(avail, h->m_max_frame), space - H2_FRAME_HEADER);
+  n = MIN(n, (size_t)MAX(MIN(s->m_window, h->m_window), 0));
+  if (avail > 0 && n == 0)
+  {
+    return 0;
+  }
+  // the session sleeps once a stream used what it was allowed
+  budget = MIN(limit_bytes(&d->m_limits, c->m_peer),
+               pace_credit(s->m_pace, s->m_pace_at, &s->m_pace_sent));
+  if (budget < n)
+  {
+    h->m_throttled = 1;
+    if ((n = budget) == 0)
+    {
+      return 0;
+    }
+  }
+  last = s->m_eof && n == avail;
+  h2_frame_header(out->data + out->length, n, H2_DATA,
+                  last ? H2_END_STREAM : 0, s->m_id);
+  out->length += H2_FRAME_HEADER;
+  buffer_append_mem(out, s->body.data + s->body.offset, n);
+  buffer_consume(&s->body, n);
+  limit_charge(&d->m_limits, c->m_peer, n);
+  s->m_pace_sent += n;
+  s->m_window -= n;
+  h->m_window -= n;
+  if (last)
+  {
+    end_stream(c, s, res->m_status, d);
+  }
+
+  return 1;
+}
+
+/*
+ * Frames what the streams have ready, a frame per stream and round so that
+ * a large body doesn't hold back the small ones sharing the connection.
+ */
+static int output_h2(struct conn_t *c, struct h2_session *h,
+                     struct data_for_worker *d)
+{
+  struct h2_stream *s;
+  size_t i;
+  int moved;
+
+  h->m_throttled = 0;
+  do
+  {
+    moved = 0;
+    h->m_turn++;
+    for (i = 0; i < H2_STREAMS; i++)
+    {
+      s = h->m_stream[(h->m_turn + i) % H2_STREAMS];
+      if (s == NULL || s->m_busy)
+      {
+        continue;
+      }
+      switch (step_stream(c, h, s, d))
+      {
+      case 1:
+        moved = 1;
+        break;
+      case -1:
+        return -1;
+      }
+    }
+  } while (moved && room(&c->m_cold->buf) > H2_FRAME_HEADER);
+
+  return 0;
+}
+
+static int flush_h2(struct conn_t *c, struct data_for_worker *d)
+{
+  struct my_buffer *out = &c->m_cold->buf;
+  size_t before = pending(out);
+  enum status s;
+
+  // DATA payloads were charged as they were framed
+  s = send_buffer_http(c->m_file_descriptor, tx_ssl(c), out);
+  COUNTER_ADD(d->m_metrics.m_bytes_sent, before - pending(out));
+
+  return s ? -1 : 0;
+}
+
+/*
+ * Turns a connection whose first header was the preface's into an HTTP/2
+ * session. Its buffers grow to hold a whole frame, and our SETTINGS are the
+ * first thing to go out.
+ */
+static int start_h2(struct conn_t *c, struct data_for_worker *d)
+{
+  static const uint8_t settings[] = {0, H2_MAX_CONCURRENT_STREAMS, 0, 0, 0,
+                                     H2_STREAMS};
+  struct conn_cold *cold = c->m_cold;
+  size_t frame = H2_FRAME_HEADER + H2_FRAME_MAX;
+  struct h2_session *h;
+
+  if ((cold->rbuf.size < frame && pool_grow(&d->m_pool, &cold->rbuf, frame)) ||
+      cold->rbuf.size < frame ||
+      (cold->buf.data == NULL && pool_lease(&d->m_pool, &cold->buf, frame)) ||
+      cold->buf.size < frame)
+  {
+    log_warn("h2: the buffer pool can't hold a %zu byte frame", frame);
+    return -1;
+  }
+  if (!(h = calloc(1, sizeof(*h))))
+  {
+    log_warn("calloc:");
+    return -1;
+  }
+  hpack_init(&h->m_dec);
+  hpack_init(&h->m_enc);
+  h->m_conn = c;
+  h->m_window = h->m_initial = H2_WINDOW;
+  h->m_max_frame = H2_FRAME_MAX;
+  cold->m_h2 = h;
+  cold->m_job_status = 0; // looked at when a sleep ends
+
+  h2_frame_append(&cold->buf, H2_SETTINGS, 0, 0, settings, sizeof(settings));
+  COUNTER_ADD(d->m_metrics.m_h2_sessions, 1);
+  c->m_state = CONN_H2_RECV;
+
+  return 0;
+}
+
+/*
+ * Serves an HTTP/2 connection as far as the socket lets it: flushes out,
+ * takes in the peer's frames and frames responses, and goes round again
+ * while out drains in full, up to the write quota. Once only streams out
+ * of byte tokens or pace credit are left, the session sleeps on the tick
+ * like a throttled HTTP/1.1 transfer. A session error is reported with
+ * GOAWAY before the connection is closed.
+ */
+static void serve_h2(struct conn_t *c, struct data_for_worker *d)
+{
+  struct conn_cold *cold = c->m_cold;
+  struct h2_session *h = cold->m_h2;
+  size_t start = d->m_metrics.m_bytes_sent;
+  uint8_t p[8];
+  int eof = 0, err;
+
+  for (;;)
+  {
+    if (flush_h2(c, d))
+    {
+      reset_con(c, d);
+      return;
+    }
+    if (pending(&cold->buf) > 0 || out_of_quota(d, start))
+    {
+      c->m_state = CONN_H2_SEND;
+      return;
+    }
+    if ((err = input_h2(c, h, d, &eof)))
+    {
+      break;
+    }
+    if (output_h2(c, h, d))
+    {
+      err = H2_INTERNAL_ERROR;
+      break;
+    }
+    // a throttled session doesn't go round again for a trickle of credit
+    if (h->m_throttled && flush_h2(c, d))
+    {
+      reset_con(c, d);
+      return;
+    }
+    if (pending(&cold->buf) == 0)
+    {
+      // done once the peer closed, or went away with nothing left open
+      if (eof || (h->m_goaway && h->m_nstreams == 0))
+      {
+        reset_con(c, d);
+        return;
+      }
+      c->m_state = CONN_H2_RECV;
+      if (h->m_throttled)
+      {
+        sleep_con(c, d);
+      }
+      return;
+    }
+    if (h->m_throttled)
+    {
+      c->m_state = CONN_H2_SEND;
+      return;
+    }
+  }
+
+  // best effort, the connection is closed either way
+  h2_put32(p, h->m_last_id);
+  h2_put32(p + 4, err);
+  if (room(&cold->buf) >= H2_FRAME_HEADER + sizeof(p) &&
+      !h2_frame_append(&cold->buf, H2_GOAWAY, 0, 0, p, sizeof(p)))
+  {
+    flush_h2(c, d);
+  }
+  reset_con(c, d);
+}
+
+void serve_con(struct conn_t *c, struct data_for_worker *d)
+{
+  struct buf_pool *pool = &d->m_pool;
+  struct conn_cold *cold;
+  enum status s;
+  size_t end, max, sent, start = d->m_metrics.m_bytes_sent;
+  char term;
+  int done;
+
+next:
+  switch (c->m_state)
+  {
+  case CONN_TLS_RECV:
+  case CONN_TLS_SEND:
+    if (!c->m_ssl && !(c->m_ssl = tls_new(c->m_file_descriptor)))
+    {
+      goto err;
+    }
+    switch (tls_handshake(c->m_ssl, &c->m_tls))
+    {
+    case 0:
+      break;
+    case 1:
+      c->m_state = CONN_TLS_RECV;
+      return;
+    case 2:
+      c->m_state = CONN_TLS_SEND;
+      return;
+    default:
+      goto err;
+    }
+    COUNTER_ADD(d->m_metrics.m_tls_handshakes, 1);
+    if (!(c->m_tls & TLS_USER_TX))
+    {
+      COUNTER_ADD(d->m_metrics.m_ktls, 1);
+    }
+    // the kernel has the whole session, OpenSSL has nothing left to do
+    if (!(c->m_tls & (TLS_USER_RX | TLS_USER_TX)))
+    {
+      tls_free(c->m_ssl);
+      c->m_ssl = NULL;
+    }
+    c->m_state = CONN_RECV_HEADER;
+    goto next;
+
+  case CONN_H2_RECV:
+  case CONN_H2_SEND:
+    serve_h2(c, d);
+    return;
 
-  switch (c->m_state)
-  {
   case CONN_VACANT:
-    memset(&c->buf, 0, sizeof(c->buf));
-
     c->m_state = CONN_RECV_HEADER;
 
   case CONN_RECV_HEADER:
 
     done = 0;
-    if ((s = receive_header_http(c->m_file_descriptor, &c->buf, &done)))
+    if (c->m_cold == NULL)
+    {
+      if (!(c->m_cold = acquire_cold(d)))
+      {
+        goto err;
+      }
+      COUNTER_ADD(d->m_load.m_active, 1);
+    }
+    cold = c->m_cold;
+    cold->m_conn = c;
+    cold->m_engine = ENGINE_BUFFER;
+    if (cold->rbuf.data == NULL &&
+        pool_lease(pool, &cold->rbuf, pool_size(POOL_HEADER)))
     {
-      prepare_err_resp_http(&c->m_req, &c->m_resp, s);
+      cold->m_resp.m_status = STATUS_INTERNAL_SERVER_ERROR;
+      goto err;
+    }
+    if ((s = receive_header_http(c->m_file_descriptor, rx_ssl(c), &cold->rbuf,
+                                 &end, &done)))
+    {
+      prepare_err_resp_http(&cold->m_req, &cold->m_resp, s);
       goto response;
     }
+    if (done < 0)
+    {
+      // idle connection closed by the peer, nothing to log
+      reset_con(c, d);
+      return;
+    }
+    if (cold->m_stamp[PHASE_RECV] == 0 && cold->rbuf.length > 0)
+    {
+      cold->m_stamp[PHASE_RECV] = metrics_now();
+    }
     if (!done)
     {
+      if (cold->rbuf.length == cold->rbuf.size - 1)
+      {
+        if (cold->rbuf.size >= HEADER_MAX ||
+            pool_grow(pool, &cold->rbuf, cold->rbuf.size + 1))
+        {
+          prepare_err_resp_http(&cold->m_req, &cold->m_resp,
+                                STATUS_INTERNAL_SERVER_ERROR); // too big
+          goto response;
+        }
+        goto next;
+      }
 
+      // nothing buffered, an idle connection holds no memory
+      if (cold->rbuf.length == 0)
+      {
+        release_cold(c, d);
+        c->m_idle_at = idle_clock();
+      }
       return;
     }
 
-    if ((s = parse_header_http(c->buf.data, &c->m_req)))
+    // the preface passes for a header of its own, HTTP/2 follows it
+    if (end - cold->rbuf.offset == H2_PREFACE_HEAD &&
+        !memcmp(cold->rbuf.data + cold->rbuf.offset, H2_PREFACE,
+                H2_PREFACE_HEAD))
+    {
+      if (start_h2(c, d))
+      {
+        cold->m_resp.m_status = STATUS_INTERNAL_SERVER_ERROR;
+        goto err;
+      }
+      goto next;
+    }
+
+    /* terminate the header in place, a pipelined request may follow it */
+    term = cold->rbuf.data[end];
+    cold->rbuf.data[end] = '\0';
+    cold->m_stamp[PHASE_PARSE] = metrics_now();
+    s = parse_header_http(cold->rbuf.data + cold->rbuf.offset, &cold->m_req);
+    cold->m_stamp[PHASE_RESOLVE] = metrics_now();
+    cold->rbuf.data[end] = term;
+    buffer_consume(&cold->rbuf, end - cold->rbuf.offset);
+    if (cold->rbuf.length == 0)
+    {
+      pool_release(pool, &cold->rbuf);
+    }
+    if (s)
+    {
+      prepare_err_resp_http(&cold->m_req, &cold->m_resp, s);
+      goto response;
+    }
+    if (limit_request(&d->m_limits, c->m_peer))
     {
-      prepare_err_resp_http(&c->m_req, &c->m_resp, s);
+      prepare_err_resp_http(&cold->m_req, &cold->m_resp,
+                            STATUS_TOO_MANY_REQUESTS);
       goto response;
     }
 
-    prepare_resp_http(&c->m_req, &c->m_resp, srv);
+    /* resolving the path touches the filesystem, leave it to the pool */
+    park_con(c, d, resolve_job, CONN_RESPOND);
+    return;
+
+  case CONN_RESPOND:
+    cold = c->m_cold;
   response:
+    cold->m_stamp[PHASE_HEADER] = metrics_now();
 
-    if ((s = prep_header_buf_http(&c->m_resp, &c->buf)))
+    set_keep_alive_http(&cold->m_req, &cold->m_resp);
+    if (cold->buf.data == NULL &&
+        pool_lease(pool, &cold->buf, pool_size(POOL_HEADER)))
+    {
+      cold->m_resp.m_status = STATUS_INTERNAL_SERVER_ERROR;
+      goto err;
+    }
+    if ((s = prep_header_buf_http(&cold->m_resp, &cold->buf)))
     {
-      prepare_err_resp_http(&c->m_req, &c->m_resp, s);
-      if ((s = prep_header_buf_http(&c->m_resp, &c->buf)))
+      prepare_err_resp_http(&cold->m_req, &cold->m_resp, s);
+      if ((s = prep_header_buf_http(&cold->m_resp, &cold->buf)))
       {
 
-        c->m_resp.m_status = s;
+        cold->m_resp.m_status = s;
+        goto err;
+      }
+    }
+    c->m_type = cold->m_resp.m_type;
+    // file pages can only go to the socket as is once the kernel encrypts
+    if (tx_ssl(c) && (cold->m_engine == ENGINE_SENDFILE ||
+                      cold->m_engine == ENGINE_SPLICE))
+    {
+      cold->m_engine = ENGINE_URING;
+    }
+    if (cold->m_engine == ENGINE_URING && d->m_ring.m_fd < 0)
+    {
+      cold->m_engine = ENGINE_BUFFER;
+    }
+
+    /*
+     * Memory-backed bodies get their first chunk produced right away so it
+     * leaves in the same writev as the header.
+     */
+    if (has_body(&cold->m_req, &cold->m_resp) &&
+        cold->m_engine == ENGINE_BUFFER)
+    {
+      if (pool_lease(pool, &cold->body, body_lease_size(&cold->m_resp)))
+      {
+        cold->m_resp.m_status = STATUS_INTERNAL_SERVER_ERROR;
+        goto err;
+      }
+      if (produces_blocking(&cold->m_resp))
+      {
+        park_con(c, d, fill_job, CONN_SEND_HEADER);
+        return;
+      }
+      if ((s = data_fct[cold->m_resp.m_type].m_fill(
+               &cold->m_resp, &cold->body, &c->m_progr)))
+      {
+        cold->m_resp.m_status = s;
         goto err;
       }
     }
@@ -108,58 +2103,226 @@ void serve_con(struct conn_t *c, const struct server *srv)
     c->m_state = CONN_SEND_HEADER;
 
   case CONN_SEND_HEADER:
-    if ((s = send_buffer_http(c->m_file_descriptor, &c->buf)))
+    cold = c->m_cold;
+    sent = pending(&cold->buf) + pending(&cold->body);
+    /* zero-copy bodies follow separately, hold the header back for them */
+    s = send_header_http(c->m_file_descriptor, tx_ssl(c), &cold->buf,
+                         &cold->body,
+                         (cold->m_engine == ENGINE_SENDFILE ||
+                          cold->m_engine == ENGINE_SPLICE) &&
+                             cold->m_resp.m_file.upper + 1 >
+                                 cold->m_resp.m_file.lower);
+    charge(c, d, sent - pending(&cold->buf) - pending(&cold->body));
+    if (s)
     {
-      c->m_resp.m_status = s;
+      cold->m_resp.m_status = s;
       goto err;
     }
-    if (c->buf.length > 0)
+    if (cold->buf.length > 0)
     {
 
       return;
     }
+    pool_release(pool, &cold->buf);
+    cold->m_stamp[PHASE_BODY] = metrics_now();
+    pace_con(c, d);
 
     c->m_state = CONN_SEND_BODY;
 
   case CONN_SEND_BODY:
-    if (c->m_req.m_method == METH_GET)
+    cold = c->m_cold;
+    if (!has_body(&cold->m_req, &cold->m_resp))
     {
-      if (c->buf.length == 0)
-      {
+      break;
+    }
 
-        if ((s = data_fct[c->m_resp.m_type](&c->m_resp, &c->buf,
-                                            &c->m_progr)))
+    if (cold->m_engine == ENGINE_SENDFILE || cold->m_engine == ENGINE_SPLICE)
+    {
+      if (!(max = allowance(c, d)))
+      {
+        return;
+      }
+      max = MIN(max, WRITE_QUOTA);
+      sent = c->m_progr;
+      if (cold->m_engine == ENGINE_SENDFILE)
+      {
+        s = send_file_http(c->m_file_descriptor, cold->m_body_fd,
+                           &cold->m_resp, &c->m_progr, max);
+      }
+      else
+      {
+        s = splice_body(c, d, max);
+      }
+      sent = c->m_progr - sent;
+      charge(c, d, sent);
+      advise_progress(c, cold, 0);
+      if (s)
+      {
+        if (c->m_progr != 0 || (errno != EINVAL && errno != ENOSYS))
         {
-
-          c->m_resp.m_status = s;
+          cold->m_resp.m_status = s;
           goto err;
         }
 
-        if (c->buf.length == 0)
+        /*
+         * The filesystem can't sendfile or splice, fall back to reads
+         * through the ring, or to the offload pool where there is no ring.
+         */
+        if (d->m_ring.m_fd >= 0)
         {
-          break;
+          cold->m_engine = ENGINE_URING;
+          goto next;
+        }
+        cold->m_engine = ENGINE_BUFFER;
+        if (pool_lease(pool, &cold->body, body_lease_size(&cold->m_resp)))
+        {
+          cold->m_resp.m_status = STATUS_INTERNAL_SERVER_ERROR;
+          goto err;
         }
       }
+      else if (c->m_progr ==
+               cold->m_resp.m_file.upper - cold->m_resp.m_file.lower + 1)
+      {
+        advise_progress(c, cold, 1);
+        break;
+      }
+      else if (sent == max && max < WRITE_QUOTA)
+      {
+        sleep_con(c, d); // the allowance ran out, not the socket's buffer
+        return;
+      }
       else
       {
+        out_of_quota(d, start); // counted if it wasn't EAGAIN that stopped it
+        return;
+      }
+    }
+
+    if (cold->m_engine == ENGINE_URING)
+    {
+      switch (stream_uring(c, d, start))
+      {
+      case 0:
+        advise_progress(c, cold, 1);
+        goto done;
+      case 1:
+        return;
+      default:
+        cold->m_resp.m_status = STATUS_INTERNAL_SERVER_ERROR;
+        goto err;
+      }
+    }
 
-        if ((s = send_buffer_http(c->m_file_descriptor, &c->buf)))
+    for (;;)
+    {
+      if (cold->body.length == 0)
+      {
+        if (out_of_quota(d, start))
+        {
+          return;
+        }
+        switch (zerocopy_busy(c, cold))
+        {
+        case 0:
+          break;
+        case 1:
+          c->m_state = CONN_WAIT_ZC;
+          return;
+        default:
+          cold->m_resp.m_status = STATUS_INTERNAL_SERVER_ERROR;
+          goto err;
+        }
+        if (produces_blocking(&cold->m_resp))
+        {
+          park_con(c, d, fill_job, CONN_SEND_BODY);
+          return;
+        }
+        if ((s = data_fct[cold->m_resp.m_type].m_fill(
+                 &cold->m_resp, &cold->body, &c->m_progr)))
         {
 
-          c->m_resp.m_status = s;
+          cold->m_resp.m_status = s;
           goto err;
         }
+
+        if (cold->body.length == 0)
+        {
+          goto done;
+        }
+      }
+
+      if (!(max = allowance(c, d)))
+      {
+        return;
+      }
+      if ((s = send_body(c, d, &max)))
+      {
+
+        cold->m_resp.m_status = s;
+        goto err;
+      }
+      if (cold->body.length > 0)
+      {
+        if (max == 0)
+        {
+          sleep_con(c, d);
+        }
+        return;
       }
+    }
+
+  case CONN_WAIT_IO:
+    cold = c->m_cold;
+    c->m_progr = cold->m_job_progr;
+    if ((s = cold->m_job_status))
+    {
+      cold->m_resp.m_status = s;
+      goto err;
+    }
+    c->m_state = cold->m_resume;
+    /* an empty refill means the producer has nothing more to give */
+    if (c->m_state == CONN_SEND_BODY && cold->m_engine == ENGINE_BUFFER &&
+        cold->body.length == 0)
+    {
+      goto done;
+    }
+    goto next;
+
+  case CONN_WAIT_ZC:
+    cold = c->m_cold;
+    switch (zerocopy_busy(c, cold))
+    {
+    case 0:
+      c->m_state = CONN_SEND_BODY;
+      goto next;
+    case 1:
       return;
+    default:
+      cold->m_resp.m_status = STATUS_INTERNAL_SERVER_ERROR;
+      goto err;
     }
-    break;
   default:
     log_warn("serve: invalid connection state");
     return;
   }
+done:
+  metrics_request(&d->m_metrics, cold->m_resp.m_status);
+  record_phases(c, d);
+  log_con(c);
+  if (cold->m_resp.m_keep_alive)
+  {
+    recycle_con(c, d);
+    goto next;
+  }
+  reset_con(c, d);
+  return;
 err:
+  if (c->m_cold)
+  {
+    metrics_request(&d->m_metrics, c->m_cold->m_resp.m_status);
+  }
   log_con(c);
-  reset_con(c);
+  reset_con(c, d);
 }
 
 static struct conn_t *connection_get_drop_candidate(struct conn_t *connection,
@@ -172,10 +2335,16 @@ static struct conn_t *connection_get_drop_candidate(struct conn_t *connection,
   {
     c = &connection[i];
 
+    // a job in flight still references the slot, it can't be dropped
+    if (c->m_state == CONN_WAIT_IO)
+    {
+      continue;
+    }
+
     for (j = 0, cnt = 0; j < nslots; j++)
     {
-      if (!sockets_same_addr(&connection[i].m_sock_storage,
-                             &connection[j].m_sock_storage))
+      if (connection[j].m_state == CONN_WAIT_IO ||
+          connection[i].m_peer_key != connection[j].m_peer_key)
       {
         continue;
       }
@@ -189,9 +2358,9 @@ static struct conn_t *connection_get_drop_candidate(struct conn_t *connection,
       {
 
         if (c->m_state == CONN_SEND_BODY &&
-            connection[i].m_resp.m_type != c->m_resp.m_type)
+            connection[i].m_type != c->m_type)
         {
-          if (connection[i].m_resp.m_type < c->m_resp.m_type)
+          if (connection[i].m_type < c->m_type)
           {
             c = &connection[j];
           }
@@ -214,46 +2383,365 @@ static struct conn_t *connection_get_drop_candidate(struct conn_t *connection,
   return minc;
 }
 
-struct conn_t *accept_con(int in_socket, struct conn_t *connection,
-                          size_t nslots)
+/*
+ * The connection that has held no work the longest, at least IDLE_RECLAIM:
+ * one that never sent a byte, or a keep-alive one between requests with
+ * nothing buffered. NULL if there is none.
+ */
+static struct conn_t *idle_slot(struct data_for_worker *d)
+{
+  struct conn_t *c, *best = NULL;
+  uint32_t now = idle_clock();
+  size_t i;
+
+  for (i = 0; i < d->m_num_slots; i++)
+  {
+    c = &d->m_conn[i];
+    if (c->m_file_descriptor <= 0 || c->m_cold != NULL ||
+        now - c->m_idle_at < IDLE_RECLAIM)
+    {
+      continue;
+    }
+    if (c->m_state != CONN_VACANT && c->m_state != CONN_RECV_HEADER &&
+        (c->m_state != CONN_TLS_RECV || c->m_ssl != NULL))
+    {
+      continue;
+    }
+    if (!best || now - c->m_idle_at > now - best->m_idle_at)
+    {
+      best = c;
+    }
+  }
+
+  return best;
+}
+
+/*
+ * A vacant slot, or one freed by dropping a connection: the best drop
+ * candidate when evicting, only an idle one under the other policies.
+ */
+static struct conn_t *take_slot(struct data_for_worker *d)
 {
   struct conn_t *c = NULL;
   size_t i;
 
-  for (i = 0; i < nslots; i++)
+  for (i = 0; i < d->m_num_slots; i++)
   {
-    if (connection[i].m_file_descriptor == 0)
+    if (d->m_conn[i].m_file_descriptor == 0)
     {
-      c = &connection[i];
+      c = &d->m_conn[i];
       break;
     }
   }
-  if (i == nslots)
+  if (i == d->m_num_slots)
   {
-    c = connection_get_drop_candidate(connection, nslots);
+    c = d->m_overload == OVERLOAD_EVICT
+            ? connection_get_drop_candidate(d->m_conn, d->m_num_slots)
+            : idle_slot(d);
     if (c == NULL) 
       return NULL;
-    c->m_resp.m_status = 0;
-    log_con(c);
-    reset_con(c);
+    i = c - d->m_conn;
+    drop_con(c, d);
+    COUNTER_ADD(d->m_metrics.m_evicted, 1);
+  }
+  c->m_peer = &d->m_peer[i];
+
+  return c;
+}
+
+/*
+ * The options every connection gets before it is served, 0 or -1. TLS
+ * connections go without MSG_ZEROCOPY: kTLS refuses it and OpenSSL copies
+ * anyway.
+ */
+static int prepare_socket(int fd, int tls, int *zerocopy)
+{
+  // without it MSG_ZEROCOPY is silently a copy
+  *zerocopy = ZEROCOPY && !tls &&
+              !setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &(int){1}, sizeof(int));
+
+  return unblock_socket(fd) ? -1 : 0;
+}
+
+/*
+ * Turns a connection away with a canned response, without reading its
+ * request. Whatever already arrived is drained first: closing with unread
+ * data resets the connection, and the reset can overtake the response on
+ * its way to the client. A TLS client couldn't read it, it is just closed.
+ */
+static void turn_away(const struct handoff *h, const char *resp, size_t len)
+{
+  char junk[HEADER_BUFFER_SIZE];
+
+  if (h->m_tls)
+  {
+    tls_free(h->m_ssl);
+    close(h->m_fd);
+    return;
+  }
+  recv(h->m_fd, junk, sizeof(junk), MSG_DONTWAIT);
+  send(h->m_fd, resp, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+  shutdown(h->m_fd, SHUT_WR);
+  close(h->m_fd);
+}
+
+static void shed_con(const struct handoff *h, struct data_for_worker *d)
+{
+  static const char resp[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                             "Retry-After: " RETRY_AFTER "\r\n"
+                             "Content-Length: 0\r\n"
+                             "Connection: close\r\n\r\n";
+
+  turn_away(h, resp, sizeof(resp) - 1);
+  COUNTER_ADD(d->m_metrics.m_shed, 1);
+}
+
+static void limit_con(const struct handoff *h, struct data_for_worker *d)
+{
+  static const char resp[] = "HTTP/1.1 429 Too Many Requests\r\n"
+                             "Retry-After: " RETRY_AFTER "\r\n"
+                             "Content-Length: 0\r\n"
+                             "Connection: close\r\n\r\n";
+
+  turn_away(h, resp, sizeof(resp) - 1);
+  COUNTER_ADD(d->m_metrics.m_limited, 1);
+}
+
+/* a connection that found every slot taken waits for one or is shed */
+static void overflow_con(const struct handoff *h, struct data_for_worker *d)
+{
+  struct handoff *b;
+
+  if (d->m_overload == OVERLOAD_BACKLOG && d->m_nbacklog < d->m_backlog_max &&
+      (b = malloc(sizeof(*b))))
+  {
+    *b = *h;
+    b->m_next = NULL;
+    if (d->m_backlog_tail)
+    {
+      d->m_backlog_tail->m_next = b;
+    }
+    else
+    {
+      d->m_backlog = b;
+    }
+    d->m_backlog_tail = b;
+    d->m_nbacklog++;
+    COUNTER_ADD(d->m_metrics.m_backlogged, 1);
+    // no event may come to admit it, the tick looks for idle slots
+    arm_tick(&d->m_tick);
+    return;
+  }
+  shed_con(h, d);
+}
+
+static int full(const struct data_for_worker *d)
+{
+  return d->m_overload != OVERLOAD_EVICT &&
+         COUNTER_GET(d->m_load.m_open) >= d->m_num_slots;
+}
+
+/*
+ * Gives a connection, fresh from accept or from the backlog, a slot. Over
+ * its client's connection limit it is refused with a 429; when every slot
+ * is taken by work the overload policy decides. One a sibling handed over
+ * was admitted there and may be between two requests, an unasked-for
+ * response would answer the next one: it is only counted.
+ */
+static struct conn_t *place_con(const struct handoff *h,
+                                struct data_for_worker *d)
+{
+  struct conn_t *c;
+
+  if (h->m_admitted)
+  {
+    limit_adopt(&d->m_limits, &h->m_peer);
+  }
+  else if (full(d) && !idle_slot(d))
+  {
+    overflow_con(h, d);
+    return NULL;
+  }
+  else if (limit_connect(&d->m_limits, &h->m_peer))
+  {
+    limit_con(h, d);
+    return NULL;
+  }
+  if (!(c = take_slot(d)))
+  {
+    // every slot waits on a job, nothing to make room with
+    limit_disconnect(&d->m_limits, &h->m_peer);
+    if (h->m_admitted)
+    {
+      // the sibling filled up meanwhile, close it like an idle connection
+      tls_free(h->m_ssl);
+      close(h->m_fd);
+      return NULL;
+    }
+    shed_con(h, d);
+    return NULL;
+  }
+  c->m_file_descriptor = h->m_fd;
+  c->m_zerocopy = h->m_zerocopy;
+  c->m_tls = h->m_tls;
+  c->m_ssl = h->m_ssl;
+  // a TLS connection without a handshake yet starts with one
+  if (c->m_tls == TLS_ON)
+  {
+    c->m_state = CONN_TLS_RECV;
   }
+  memcpy(c->m_peer, &h->m_peer, sizeof(*c->m_peer));
+  c->m_peer_key = get_socket_key(c->m_peer);
+  c->m_idle_at = idle_clock();
+  COUNTER_ADD(d->m_load.m_open, 1);
+
+  return c;
+}
 
-  if ((c->m_file_descriptor =
-           accept(in_socket, (struct sockaddr *)&c->m_sock_storage,
-                  &(socklen_t){sizeof(c->m_sock_storage)})) < 0)
+/* accepts from the TLS listener if tls is set, from the plain one if not */
+struct conn_t *accept_con(struct data_for_worker *d, int tls)
+{
+  struct handoff h;
+
+  if ((h.m_fd = accept(tls ? d->m_tls_socket : d->m_in_socket,
+                       (struct sockaddr *)&h.m_peer,
+                       &(socklen_t){sizeof(h.m_peer)})) < 0)
   {
+    // another worker may have won the race
     if (errno != EAGAIN && errno != EWOULDBLOCK)
     {
       log_warn("accept:");
     }
     return NULL;
   }
-
-  if (unblock_socket(c->m_file_descriptor))
+  COUNTER_ADD(d->m_metrics.m_accepted, 1);
+  h.m_tls = tls ? TLS_ON : 0;
+  h.m_ssl = NULL;
+  h.m_admitted = 0;
+  if (prepare_socket(h.m_fd, tls, &h.m_zerocopy))
   {
+    close(h.m_fd);
+    return NULL;
+  }
+
+  return place_con(&h, d);
+}
+
+/* what a sibling's queue_wait and requests in flight add up to */
+static size_t worker_load(struct data_for_worker *d)
+{
+  return COUNTER_GET(d->m_load.m_active) +
+         (COUNTER_GET(d->m_load.m_depth) >> LOAD_SHIFT);
+}
+
+/*
+ * The least loaded sibling with a vacant slot, if it is HANDOFF_MARGIN
+ * below this worker and at most half as loaded; NULL keeps the work here.
+ * A worker hands off at most one connection per HANDOFF_INTERVAL. Only the
+ * loads are read, a sibling that got busier meanwhile just evens out on its
+ * next decision.
+ */
+struct data_for_worker *handoff_target(struct data_for_worker *d)
+{
+  struct data_for_worker *w, *best = NULL;
+  size_t i, load, least;
+  uint64_t now;
 
+  if (HANDOFF_MARGIN == 0 || d->m_num_workers < 2)
+  {
+    return NULL;
+  }
+  // a trickle is enough to even out, a flood only moves the hot spot around
+  now = metrics_now();
+  if (now - d->m_handoff_at < HANDOFF_INTERVAL)
+  {
     return NULL;
   }
+  if ((load = worker_load(d)) < HANDOFF_MARGIN)
+  {
+    return NULL;
+  }
+  // relative too, or evenly loaded workers trade connections on every jitter
+  least = MIN(load - HANDOFF_MARGIN, load / 2);
+
+  for (i = 0; i < d->m_num_workers; i++)
+  {
+    w = &d->m_workers[i];
+    if (w == d || COUNTER_GET(w->m_load.m_open) >= w->m_num_slots)
+    {
+      continue;
+    }
+    if ((load = worker_load(w)) < least)
+    {
+      best = w;
+      least = load;
+    }
+  }
+  if (best)
+  {
+    d->m_handoff_at = now;
+  }
+
+  return best;
+}
+
+/*
+ * Moves an idle connection, fresh from accept or between two requests, to
+ * the worker to. It must be out of this worker's event queue already; its
+ * slot is vacant afterwards.
+ */
+void handoff_con(struct conn_t *c, struct data_for_worker *d,
+                 struct data_for_worker *to)
+{
+  struct handoff *h;
+
+  if (!(h = malloc(sizeof(*h))))
+  {
+    log_warn("malloc:");
+    drop_con(c, d);
+    return;
+  }
+  h->m_fd = c->m_file_descriptor;
+  h->m_zerocopy = c->m_zerocopy;
+  h->m_tls = c->m_tls;
+  h->m_ssl = c->m_ssl;
+  memcpy(&h->m_peer, c->m_peer, sizeof(h->m_peer));
+  h->m_admitted = 1;
+
+  // an idle connection holds no cold part, only the slot is left to clear
+  memset(c, 0, sizeof(*c));
+  COUNTER_ADD(d->m_load.m_open, -1);
+  limit_disconnect(&d->m_limits, &h->m_peer);
+  COUNTER_ADD(d->m_metrics.m_handoffs, 1);
+
+  handoff_push(&to->m_handoff, h);
+}
+
+/* takes over a handed off or backlogged connection, freeing h */
+struct conn_t *adopt_con(struct handoff *h, struct data_for_worker *d)
+{
+  struct conn_t *c;
+
+  c = place_con(h, d);
+  free(h);
 
   return c;
 }
+
+/* the oldest backlogged connection once a slot is vacant or idle, else NULL */
+struct conn_t *admit_con(struct data_for_worker *d)
+{
+  struct handoff *h;
+
+  if (!(h = d->m_backlog) || (full(d) && !idle_slot(d)))
+  {
+    return NULL;
+  }
+  if (!(d->m_backlog = h->m_next))
+  {
+    d->m_backlog_tail = NULL;
+  }
+  d->m_nbacklog--;
+
+  return adopt_con(h, d);
+}
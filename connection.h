@@ -1,30 +1,262 @@
 #pragma once
 
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "buffer.h"
+#include "h2.h"
+#include "handoff.h"
 #include "http.h"
+#include "limit.h"
+#include "metrics.h"
+#include "offload.h"
+#include "pool.h"
 #include "srv.h"
+#include "tls.h"
+#include "uring.h"
 #include "util.h"
 
 enum conn_state_t
 {
   CONN_VACANT,
+  CONN_TLS_RECV,
+  CONN_TLS_SEND,
   CONN_RECV_HEADER,
+  CONN_RESPOND,
   CONN_SEND_HEADER,
   CONN_SEND_BODY,
+  CONN_H2_RECV,
+  CONN_H2_SEND,
+  CONN_WAIT_ZC,
+  CONN_WAIT_IO,
   NUM_CONNECT_STATES,
 };
 
-struct conn_t
+/*
+ * Per-connection state is split in two. The hot part is what the event loop
+ * and the drop-candidate sweep look at for every slot, it fits in one cache
+ * line. Everything only needed while a request is in flight lives in the
+ * cold part, which is attached on the first byte of a request and returned
+ * to the worker's cache once the connection goes idle.
+ *
+ * While a filesystem job is out with the offload pool the connection sits in
+ * CONN_WAIT_IO, out of the event queue, and resumes in m_resume. The same
+ * state covers waiting on an io_uring read; a read still in flight when the
+ * connection goes away leaves the cold part orphaned until it completes.
+ * CONN_WAIT_ZC holds a sent body buffer until MSG_ZEROCOPY completions say
+ * the kernel is done with its pages. A transfer out of its client's byte
+ * tokens waits in CONN_WAIT_IO too, asleep on the worker's tick.
+ *
+ * A connection from the TLS listener starts in CONN_TLS_RECV or
+ * CONN_TLS_SEND, whichever way the handshake waits on the socket. Once it
+ * is done m_tls says which directions OpenSSL still encrypts through m_ssl;
+ * the object is freed as soon as the kernel took both.
+ *
+ * A connection that opens with the HTTP/2 preface stays in CONN_H2_RECV or
+ * CONN_H2_SEND for good, with its session hanging off the cold part. It
+ * stays in the event queue while its streams' jobs are out; a session
+ * dropped meanwhile is orphaned until the last of them is back. One whose
+ * streams are all throttled sleeps in CONN_WAIT_IO like any transfer.
+ *
+ * A connection dropped with MSG_ZEROCOPY sends outstanding can't give its
+ * body buffer back: the kernel may still transmit from it. Its cold part is
+ * orphaned too, holding on to the socket, and lingers on the worker's tick
+ * until the completions are in. The linger list shares m_next with the
+ * sleepers: only a reset lingers, and a sleeper is in CONN_WAIT_IO, which
+ * gets no events and is never evicted or handed off, so it is woken (and
+ * off the list) before anything can reset it.
+ */
+struct conn_cold
 {
-  enum conn_state_t m_state;
-  int m_file_descriptor;
-  struct sockaddr_storage m_sock_storage;
   struct req_t m_req;
   struct resp_t m_resp;
+  struct my_buffer rbuf;
   struct my_buffer buf;
+  struct my_buffer body;
+  struct my_buffer m_ahead;
+  enum body_engine m_engine;
+  int m_body_fd;
+  int m_pipe[2];
+  size_t m_pipe_len;
+  uint32_t m_zc_issued;
+  uint32_t m_zc_done;
+  int m_zc_fd; /* the socket of a dropped connection, kept for them */
+  uint64_t m_zc_until;
+  size_t m_rd_progr;
+  size_t m_ra_off;
+  size_t m_drop_off;
+  int m_ra_on;
+  int m_drop_on;
+  int m_inflight;
+  int m_orphan;
+  int m_asleep;
+  size_t m_pace; /* send credit per second, 0 unless paced by credit */
+  uint64_t m_pace_at;
+  size_t m_pace_sent;
+  int m_pace_kernel; /* the socket's pacing rate is set */
+  struct conn_t *m_conn;
+  struct offload_job m_job;
+  const struct server *m_serv;
+  enum conn_state_t m_resume;
+  enum status m_job_status;
+  size_t m_job_progr;
+  uint64_t m_stamp[PHASE_TOTAL]; // when each phase began, 0 if it didn't
+  struct h2_session *m_h2;
+  struct conn_cold *m_next; /* on the free list or one of the tick's lists */
+};
+
+#define H2_STREAMS 32 /* our SETTINGS_MAX_CONCURRENT_STREAMS */
+
+enum h2_stream_state
+{
+  H2S_HEADERS, /* the response is resolved, its HEADERS are due */
+  H2S_BODY,
+};
+
+/*
+ * One request of an HTTP/2 session, with the same request, response and
+ * body buffer an HTTP/1.1 connection has. Resolving and blocking refills
+ * go to the offload pool like theirs do; while m_busy the worker leaves
+ * all of it alone. m_window is what the peer lets us send, it goes
+ * negative when a SETTINGS frame shrinks the initial window.
+ */
+struct h2_stream
+{
+  uint32_t m_id;
+  enum h2_stream_state m_state;
+  int64_t m_window;
+  int m_busy;
+  int m_cancelled; /* reset by the peer while busy */
+  int m_eof;       /* the producer has nothing more */
+  struct req_t m_req;
+  struct resp_t m_resp;
+  struct my_buffer body;
   size_t m_progr;
+  int m_body_fd;
+  enum status m_job_status;
+  struct offload_job m_job;
+  const struct server *m_serv;
+  size_t m_pace; /* like the cold part's, always by credit */
+  uint64_t m_pace_at;
+  size_t m_pace_sent;
+  struct h2_session *m_session;
+};
+
+/*
+ * Input frames are parsed out of the cold part's rbuf, output frames are
+ * put together in its buf. m_conn is NULL once the connection is gone and
+ * only m_jobs stream jobs keep the session around.
+ */
+struct h2_session
+{
+  struct conn_t *m_conn;
+  struct hpack_table m_dec;
+  struct hpack_table m_enc;
+  int64_t m_window; /* the session's send window */
+  int64_t m_initial; /* the peer's SETTINGS_INITIAL_WINDOW_SIZE */
+  size_t m_max_frame; /* the peer's SETTINGS_MAX_FRAME_SIZE */
+  int m_preface; /* the client preface was seen */
+  uint32_t m_last_id; /* the highest stream the peer opened */
+  uint32_t m_cont; /* the stream a header block continues on, 0 if none */
+  struct my_buffer m_block; /* such a header block, so far */
+  int m_goaway; /* the peer is going away */
+  struct h2_stream *m_stream[H2_STREAMS];
+  size_t m_nstreams;
+  size_t m_turn; /* where the next round over the streams starts */
+  size_t m_jobs;
+  int m_throttled; /* a stream waits for byte tokens or pace credit */
+};
+
+struct conn_t
+{
+  enum conn_state_t m_state;
+  int m_file_descriptor;
+  uint64_t m_peer_key;
+  size_t m_progr;
+  enum res_type m_type;
+  int m_zerocopy;
+  struct conn_cold *m_cold;
+  struct sockaddr_storage *m_peer;
+  struct ssl_st *m_ssl;
+  int m_tls; /* enum tls_mode bits, 0 for plain HTTP */
+  uint32_t m_idle_at; /* ms, since when it holds no work */
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+#define LOAD_SHIFT 3 /* queue depth averages over about 2^LOAD_SHIFT waits */
+
+/*
+ * What siblings read to decide whether to hand this worker work: requests
+ * in flight (connections holding a cold part), events per queue_wait as a
+ * moving average scaled by 2^LOAD_SHIFT, and slots in use. Only the owner
+ * writes them.
+ */
+struct worker_load
+{
+  size_t m_active;
+  size_t m_depth;
+  size_t m_open;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/*
+ * A timerfd firing every LIMIT_TICK while any transfer sleeps on it, with
+ * the sleepers' cold parts in a list, oldest first. Cold parts lingering
+ * for zerocopy completions keep it going as well, and so does a backlog.
+ */
+struct tick
+{
+  int m_fd;
+  int m_armed;
+  struct conn_cold *m_head;
+  struct conn_cold *m_tail;
+  struct conn_cold *m_linger;
+};
+
+struct data_for_worker
+{
+  int m_queue_fd;
+  int m_in_socket;
+  int m_tls_socket; /* -1 without a TLS listener */
+  size_t m_num_slots;
+  size_t m_num_events;
+  int m_cpu; /* pinned to it, -1 for anywhere */
+  const struct server *m_serv;
+  struct conn_t *m_conn;
+  struct sockaddr_storage *m_peer;
+  struct conn_cold *m_cold_free;
+  size_t m_cold_nfree;
+  struct offload_done m_done;
+  struct uring m_ring;
+  int m_pipes[SPLICE_MAX_FREE][2];
+  size_t m_npipes;
+  struct buf_pool m_pool;
+  struct worker_metrics m_metrics;
+  struct data_for_worker *m_workers; /* all of them, this one included */
+  size_t m_num_workers;
+  struct handoff_queue m_handoff;
+  uint64_t m_handoff_at; /* when this worker last handed one off */
+  enum overload_policy m_overload;
+  struct handoff *m_backlog; /* accepted while full, oldest first */
+  struct handoff *m_backlog_tail;
+  size_t m_nbacklog;
+  size_t m_backlog_max;
+  struct limits m_limits;
+  struct tick m_tick;
+  struct worker_load m_load;
 };
 
-struct conn_t *accept_con(int, struct conn_t *, size_t);
+struct conn_t *accept_con(struct data_for_worker *, int);
+struct conn_t *admit_con(struct data_for_worker *);
+struct conn_t *adopt_con(struct handoff *, struct data_for_worker *);
+int bulk_con(const struct conn_t *);
+void drop_con(struct conn_t *, struct data_for_worker *);
+void handoff_con(struct conn_t *, struct data_for_worker *,
+                 struct data_for_worker *);
+struct data_for_worker *handoff_target(struct data_for_worker *);
+struct conn_t *job_done_con(struct offload_job *, struct data_for_worker *);
 void log_con(const struct conn_t *);
-void reset_con(struct conn_t *);
-void serve_con(struct conn_t *, const struct server *);
+struct conn_t *read_done_con(void *, int, struct data_for_worker *);
+int zerocopy_pending_con(const struct conn_t *);
+void reset_con(struct conn_t *, struct data_for_worker *);
+void serve_con(struct conn_t *, struct data_for_worker *);
+int tick_init(struct tick *);
+struct conn_cold *wake_cons(struct data_for_worker *);
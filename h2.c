@@ -0,0 +1,775 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "configuration.h"
+#include "h2.h"
+#include "http.h"
+#include "util.h"
+
+#define STATIC_STATUS 8 /* ":status: 200", the other codes follow it */
+
+static const struct
+{
+  const char *m_name;
+  const char *m_value;
+} static_table[] = {
+    {":authority", ""},
+    {":method", "GET"},
+    {":method", "POST"},
+    {":path", "/"},
+    {":path", "/index.html"},
+    {":scheme", "http"},
+    {":scheme", "https"},
+    {":status", "200"},
+    {":status", "204"},
+    {":status", "206"},
+    {":status", "304"},
+    {":status", "400"},
+    {":status", "404"},
+    {":status", "500"},
+    {"accept-charset", ""},
+    {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""},
+    {"accept-ranges", ""},
+    {"accept", ""},
+    {"access-control-allow-origin", ""},
+    {"age", ""},
+    {"allow", ""},
+    {"authorization", ""},
+    {"cache-control", ""},
+    {"content-disposition", ""},
+    {"content-encoding", ""},
+    {"content-language", ""},
+    {"content-length", ""},
+    {"content-location", ""},
+    {"content-range", ""},
+    {"content-type", ""},
+    {"cookie", ""},
+    {"date", ""},
+    {"etag", ""},
+    {"expect", ""},
+    {"expires", ""},
+    {"from", ""},
+    {"host", ""},
+    {"if-match", ""},
+    {"if-modified-since", ""},
+    {"if-none-match", ""},
+    {"if-range", ""},
+    {"if-unmodified-since", ""},
+    {"last-modified", ""},
+    {"link", ""},
+    {"location", ""},
+    {"max-forwards", ""},
+    {"proxy-authenticate", ""},
+    {"proxy-authorization", ""},
+    {"range", ""},
+    {"referer", ""},
+    {"refresh", ""},
+    {"retry-after", ""},
+    {"server", ""},
+    {"set-cookie", ""},
+    {"strict-transport-security", ""},
+    {"transfer-encoding", ""},
+    {"user-agent", ""},
+    {"vary", ""},
+    {"via", ""},
+    {"www-authenticate", ""},
+};
+
+/*
+ * The Huffman code of RFC 7541 appendix B is canonical: codes are handed
+ * out in order of length, then symbol. So the count of codes per length and
+ * the symbols in that order are all a decoder needs. 256 is EOS.
+ */
+static const uint8_t huff_count[31] = {
+    0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5,  3,  2,  6,  2, 3,
+    0, 0, 0, 3, 8, 13, 26, 29, 12, 4, 15, 19, 29, 0, 4,
+};
+
+static const uint16_t huff_sym[257] = {
+    48,  49,  50,  97,  99,  101, 105, 111, 115, 116, 32,  37,  45,  46,  47,
+    51,  52,  53,  54,  55,  56,  57,  61,  65,  95,  98,  100, 102, 103, 104,
+    108, 109, 110, 112, 114, 117, 58,  66,  67,  68,  69,  70,  71,  72,  73,
+    74,  75,  76,  77,  78,  79,  80,  81,  82,  83,  84,  85,  86,  87,  89,
+    106, 107, 113, 118, 119, 120, 121, 122, 38,  42,  44,  59,  88,  90,  33,
+    34,  40,  41,  63,  39,  43,  124, 35,  62,  0,   36,  64,  91,  93,  126,
+    94,  125, 60,  96,  123, 92,  195, 208, 128, 130, 131, 162, 184, 194, 224,
+    226, 153, 161, 167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+    132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170, 173, 178, 181,
+    185, 186, 187, 189, 190, 196, 198, 228, 232, 233, 1,   135, 137, 138, 139,
+    140, 141, 143, 147, 149, 150, 151, 152, 155, 157, 158, 165, 166, 168, 174,
+    175, 180, 182, 183, 188, 191, 197, 231, 239, 9,   142, 144, 145, 148, 159,
+    171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193, 200, 201, 202,
+    205, 210, 213, 218, 219, 238, 240, 242, 243, 255, 203, 204, 211, 212, 214,
+    221, 222, 223, 241, 244, 245, 246, 247, 248, 250, 251, 252, 253, 254, 2,
+    3,   4,   5,   6,   7,   8,   11,  12,  14,  15,  16,  17,  18,  19,  20,
+    21,  23,  24,  25,  26,  27,  28,  29,  30,  31,  127, 220, 249, 10,  13,
+    22,  256,
+};
+
+uint32_t h2_get32(const void *p)
+{
+  const uint8_t *b = p;
+
+  return (uint32_t)b[0] << 24 | (uint32_t)b[1] << 16 | (uint32_t)b[2] << 8 |
+         b[3];
+}
+
+void h2_put32(void *p, uint32_t v)
+{
+  uint8_t *b = p;
+
+  b[0] = v >> 24;
+  b[1] = v >> 16;
+  b[2] = v >> 8;
+  b[3] = v;
+}
+
+void h2_frame_parse(const void *p, struct h2_frame *f)
+{
+  const uint8_t *b = p;
+
+  f->m_len = (uint32_t)b[0] << 16 | (uint32_t)b[1] << 8 | b[2];
+  f->m_type = b[3];
+  f->m_flags = b[4];
+  f->m_stream = h2_get32(b + 5) & 0x7fffffff;
+}
+
+void h2_frame_header(void *p, size_t len, enum h2_frame_type type, int flags,
+                     uint32_t stream)
+{
+  uint8_t *b = p;
+
+  b[0] = len >> 16;
+  b[1] = len >> 8;
+  b[2] = len;
+  b[3] = type;
+  b[4] = flags;
+  h2_put32(b + 5, stream);
+}
+
+/* 1 if the frame doesn't fit, nothing is appended then */
+int h2_frame_append(struct my_buffer *buf, enum h2_frame_type type, int flags,
+                    uint32_t stream, const void *payload, size_t len)
+{
+  if (H2_FRAME_HEADER + len > buf->size - buf->length)
+  {
+    return 1;
+  }
+  h2_frame_header(buf->data + buf->length, len, type, flags, stream);
+  buf->length += H2_FRAME_HEADER;
+
+  return buffer_append_mem(buf, payload, len);
+}
+
+void hpack_init(struct hpack_table *t)
+{
+  memset(t, 0, sizeof(*t));
+  t->m_max = H2_TABLE_MAX;
+}
+
+static void evict(struct hpack_table *t, size_t room)
+{
+  struct hpack_entry *e;
+
+  while (t->m_count > 0 && t->m_size + room > t->m_max)
+  {
+    e = &t->m_entry[(t->m_first + t->m_count - 1) % H2_TABLE_ENTRIES];
+    t->m_size -= e->m_nlen + e->m_vlen + 32;
+    free(e->m_name);
+    free(e->m_value);
+    t->m_count--;
+  }
+}
+
+void hpack_free(struct hpack_table *t)
+{
+  t->m_max = 0;
+  evict(t, 0);
+}
+
+/* an encoder follows the size its peer's decoder allows, up to ours */
+void hpack_resize(struct hpack_table *t, size_t max)
+{
+  max = MIN(max, H2_TABLE_MAX);
+  if (max != t->m_max)
+  {
+    t->m_max = max;
+    t->m_resized = 1;
+    evict(t, 0);
+  }
+}
+
+/*
+ * Makes the field the newest entry, evicting as needed; one too big for the
+ * table empties it (RFC 7541 section 4.4). -1 if it can't be allocated,
+ * nothing is evicted then.
+ */
+static int add(struct hpack_table *t, const char *name, size_t nlen,
+               const char *value, size_t vlen)
+{
+  struct hpack_entry *e;
+  char *n, *v;
+
+  if (nlen + vlen + 32 > t->m_max)
+  {
+    evict(t, t->m_max + 1);
+    return 0;
+  }
+  if (!(n = malloc(nlen + 1)) || !(v = malloc(vlen + 1)))
+  {
+    free(n);
+    return -1;
+  }
+  memcpy(n, name, nlen);
+  memcpy(v, value, vlen);
+  n[nlen] = v[vlen] = '\0';
+
+  evict(t, nlen + vlen + 32);
+  t->m_first = (t->m_first + H2_TABLE_ENTRIES - 1) % H2_TABLE_ENTRIES;
+  e = &t->m_entry[t->m_first];
+  e->m_name = n;
+  e->m_value = v;
+  e->m_nlen = nlen;
+  e->m_vlen = vlen;
+  t->m_size += nlen + vlen + 32;
+  t->m_count++;
+
+  return 0;
+}
+
+/* static entries are 1 to 61, the dynamic table follows newest first */
+static int lookup(const struct hpack_table *t, size_t i, const char **name,
+                  size_t *nlen, const char **value, size_t *vlen)
+{
+  const struct hpack_entry *e;
+
+  if (i >= 1 && i <= LEN(static_table))
+  {
+    *name = static_table[i - 1].m_name;
+    *value = static_table[i - 1].m_value;
+    *nlen = strlen(*name);
+    *vlen = strlen(*value);
+    return 0;
+  }
+  i -= LEN(static_table) + 1;
+  if (i >= t->m_count)
+  {
+    return -1;
+  }
+  e = &t->m_entry[(t->m_first + i) % H2_TABLE_ENTRIES];
+  *name = e->m_name;
+  *value = e->m_value;
+  *nlen = e->m_nlen;
+  *vlen = e->m_vlen;
+
+  return 0;
+}
+
+/* an integer with an n-bit prefix, RFC 7541 section 5.1 */
+static int get_int(const uint8_t **p, const uint8_t *end, int n, size_t *out)
+{
+  size_t max = (1U << n) - 1, v;
+  int shift = 0;
+
+  if (*p == end)
+  {
+    return -1;
+  }
+  if ((v = *(*p)++ & max) < max)
+  {
+    *out = v;
+    return 0;
+  }
+  do
+  {
+    if (*p == end || shift > 21)
+    {
+      return -1;
+    }
+    v += (size_t)(**p & 0x7f) << shift;
+    shift += 7;
+  } while (*(*p)++ & 0x80);
+  *out = v;
+
+  return 0;
+}
+
+/*
+ * Walks the code bit by bit: a code of length n is the first of that length
+ * plus an offset into the symbols of that length. What is left at the end
+ * must be padding, under 8 bits and all ones.
+ */
+static int huffman_decode(const uint8_t *in, size_t n, char *out,
+                          size_t *len)
+{
+  uint32_t code = 0, first = 0;
+  size_t bits = 0, index = 0, o = 0, i;
+  int b;
+
+  for (i = 0; i < n; i++)
+  {
+    for (b = 7; b >= 0; b--)
+    {
+      code = code << 1 | ((in[i] >> b) & 1);
+      bits++;
+      if (code - first < huff_count[bits])
+      {
+        if (huff_sym[index + code - first] == 256)
+        {
+          return -1;
+        }
+        if (o < H2_STRING_MAX)
+        {
+          out[o] = huff_sym[index + code - first];
+        }
+        o++;
+        code = first = bits = index = 0;
+        continue;
+      }
+      if (bits == LEN(huff_count) - 1)
+      {
+        return -1;
+      }
+      index += huff_count[bits];
+      first = (first + huff_count[bits]) << 1;
+    }
+  }
+  if (bits > 7 || code != (1U << bits) - 1)
+  {
+    return -1;
+  }
+  *len = (o > H2_STRING_MAX) ? SIZE_MAX : o;
+
+  return 0;
+}
+
+/* a string literal into out, of H2_STRING_MAX; longer ones get SIZE_MAX */
+static int get_string(const uint8_t **p, const uint8_t *end, char *out,
+                      size_t *len)
+{
+  size_t n;
+  int huff;
+
+  if (*p == end)
+  {
+    return -1;
+  }
+  huff = **p & 0x80;
+  if (get_int(p, end, 7, &n) || n > (size_t)(end - *p))
+  {
+    return -1;
+  }
+  if (huff)
+  {
+    if (huffman_decode(*p, n, out, len))
+    {
+      return -1;
+    }
+  }
+  else if (n > H2_STRING_MAX)
+  {
+    *len = SIZE_MAX;
+  }
+  else
+  {
+    memcpy(out, *p, n);
+    *len = n;
+  }
+  *p += n;
+
+  return 0;
+}
+
+/*
+ * Decodes a whole header block, calling fn for each field in order. The
+ * table is updated as the block says even for fields fn has no use for,
+ * or the next block would decode wrong. -1 on a compression error.
+ */
+int hpack_decode(struct hpack_table *t, const void *block, size_t len,
+                 hpack_field_fn fn, void *arg)
+{
+  static __thread char name[H2_STRING_MAX], value[H2_STRING_MAX];
+  const uint8_t *p = block, *end = p + len;
+  const char *n, *v;
+  size_t i, nlen, vlen;
+  uint8_t c;
+
+  while (p < end)
+  {
+    c = *p;
+    if (c & 0x80)
+    {
+      if (get_int(&p, end, 7, &i) || lookup(t, i, &n, &nlen, &v, &vlen))
+      {
+        return -1;
+      }
+      if (fn(arg, n, nlen, v, vlen))
+      {
+        return -1;
+      }
+      continue;
+    }
+    if ((c & 0xe0) == 0x20)
+    {
+      // a dynamic table size update, within what our settings allow
+      if (get_int(&p, end, 5, &i) || i > H2_TABLE_MAX)
+      {
+        return -1;
+      }
+      t->m_max = i;
+      evict(t, 0);
+      continue;
+    }
+
+    // a literal, with incremental indexing, without, or never indexed
+    if (get_int(&p, end, (c & 0x40) ? 6 : 4, &i))
+    {
+      return -1;
+    }
+    if (i == 0)
+    {
+      if (get_string(&p, end, name, &nlen))
+      {
+        return -1;
+      }
+    }
+    else
+    {
+      // copied, adding the field may evict the entry its name came from
+      if (lookup(t, i, &n, &nlen, &v, &vlen))
+      {
+        return -1;
+      }
+      memcpy(name, n, nlen);
+    }
+    if (get_string(&p, end, value, &vlen))
+    {
+      return -1;
+    }
+    if (fn(arg, (nlen == SIZE_MAX) ? NULL : name, nlen,
+           (vlen == SIZE_MAX) ? NULL : value, vlen))
+    {
+      return -1;
+    }
+    if (c & 0x40)
+    {
+      if (nlen == SIZE_MAX || vlen == SIZE_MAX)
+      {
+        evict(t, t->m_max + 1);
+      }
+      else if (add(t, name, nlen, value, vlen))
+      {
+        return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/* the first static entry with this name, 0 if there is none */
+int hpack_static_name(const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < LEN(static_table); i++)
+  {
+    if (!strcmp(static_table[i].m_name, name))
+    {
+      return i + 1;
+    }
+  }
+
+  return 0;
+}
+
+static int put_int(struct my_buffer *buf, uint8_t first, int n, size_t v)
+{
+  size_t max = (1U << n) - 1;
+  uint8_t b[16];
+  size_t len = 0;
+
+  if (v < max)
+  {
+    b[len++] = first | v;
+  }
+  else
+  {
+    b[len++] = first | max;
+    for (v -= max; v >= 0x80; v >>= 7)
+    {
+      b[len++] = 0x80 | (v & 0x7f);
+    }
+    b[len++] = v;
+  }
+
+  return buffer_append_mem(buf, b, len);
+}
+
+/* our strings go out as they are, Huffman would save little on them */
+static int put_string(struct my_buffer *buf, const char *s, size_t len)
+{
+  return put_int(buf, 0, 7, len) || buffer_append_mem(buf, s, len);
+}
+
+/*
+ * Starts a response block with :status. The common codes are one byte, a
+ * static table entry; a size update the peer's settings call for goes
+ * first.
+ */
+int hpack_encode_status(struct hpack_table *t, struct my_buffer *buf,
+                        int status)
+{
+  static const int indexed[] = {200, 204, 206, 304, 400, 404, 500};
+  char code[3];
+  size_t i;
+
+  if (t->m_resized)
+  {
+    if (put_int(buf, 0x20, 5, t->m_max))
+    {
+      return 1;
+    }
+    t->m_resized = 0;
+  }
+  for (i = 0; i < LEN(indexed); i++)
+  {
+    if (indexed[i] == status)
+    {
+      return put_int(buf, 0x80, 7, STATIC_STATUS + i);
+    }
+  }
+  code[0] = '0' + status / 100 % 10;
+  code[1] = '0' + status / 10 % 10;
+  code[2] = '0' + status % 10;
+
+  return put_int(buf, 0, 4, STATIC_STATUS) || put_string(buf, code, 3);
+}
+
+/*
+ * A field by the static index of its name (0 to spell the name out). With
+ * index set, values that repeat across responses, like a content type, are
+ * added to the table and sent as one index from then on; the rest go as
+ * literals that leave the table alone.
+ */
+int hpack_encode_field(struct hpack_table *t, struct my_buffer *buf,
+                       int name_index, const char *name, const char *value,
+                       int index)
+{
+  const struct hpack_entry *e;
+  size_t i, nlen = strlen(name), vlen = strlen(value);
+  int first = 0x00, n = 4;
+
+  if (index)
+  {
+    for (i = 0; i < t->m_count; i++)
+    {
+      e = &t->m_entry[(t->m_first + i) % H2_TABLE_ENTRIES];
+      if (e->m_nlen == nlen && e->m_vlen == vlen &&
+          !memcmp(e->m_name, name, nlen) && !memcmp(e->m_value, value, vlen))
+      {
+        return put_int(buf, 0x80, 7, LEN(static_table) + 1 + i);
+      }
+    }
+    // the peer adds what we send, so only send what we could add
+    if (!add(t, name, nlen, value, vlen))
+    {
+      first = 0x40;
+      n = 6;
+    }
+  }
+
+  if (put_int(buf, first, n, name_index) ||
+      (name_index == 0 && put_string(buf, name, nlen)))
+  {
+    return 1;
+  }
+
+  return put_string(buf, value, vlen);
+}
+
+struct request
+{
+  char m_method[16];
+  char m_path[PATH_MAX + 2 * FIELD_MAX];
+  char m_authority[FIELD_MAX];
+  int m_regular; /* a regular field came, pseudo-fields may not follow */
+  enum h2_error m_error;
+  char *m_out;
+  size_t m_size;
+  size_t m_len;
+};
+
+/* copies a pseudo-field once, INTERNAL_ERROR if it doesn't fit */
+static enum h2_error pseudo(char *dst, size_t size, const char *v,
+                            size_t vlen)
+{
+  if (dst[0] != '\0')
+  {
+    return H2_PROTOCOL_ERROR;
+  }
+  if (v == NULL || vlen == 0 || vlen >= size)
+  {
+    return v && vlen == 0 ? H2_PROTOCOL_ERROR : H2_INTERNAL_ERROR;
+  }
+  memcpy(dst, v, vlen);
+  dst[vlen] = '\0';
+
+  return 0;
+}
+
+/* the request line and Host, once every pseudo-field is known */
+static void request_line(struct request *r)
+{
+  int n;
+
+  if (r->m_method[0] == '\0' || r->m_path[0] == '\0')
+  {
+    r->m_error = H2_PROTOCOL_ERROR;
+    return;
+  }
+  n = snprintf(r->m_out, r->m_size, "%s %s HTTP/1.1\r\n", r->m_method,
+               r->m_path);
+  if (n >= 0 && (size_t)n < r->m_size && r->m_authority[0])
+  {
+    n += snprintf(r->m_out + n, r->m_size - n, "Host: %s\r\n",
+                  r->m_authority);
+  }
+  if (n < 0 || (size_t)n >= r->m_size)
+  {
+    r->m_error = H2_INTERNAL_ERROR;
+    return;
+  }
+  r->m_len = n;
+}
+
+static int request_field(void *arg, const char *name, size_t nlen,
+                         const char *value, size_t vlen)
+{
+  struct request *r = arg;
+  size_t i;
+  int n;
+
+  // the first error sticks, the block is still decoded to the end
+  if (r->m_error || name == NULL)
+  {
+    return 0;
+  }
+  for (i = 0; i < nlen; i++)
+  {
+    if ((name[i] >= 'A' && name[i] <= 'Z') || (unsigned char)name[i] <= ' ')
+    {
+      r->m_error = H2_PROTOCOL_ERROR;
+      return 0;
+    }
+  }
+  if (value && (memchr(value, '\r', vlen) || memchr(value, '\n', vlen) ||
+                memchr(value, '\0', vlen)))
+  {
+    r->m_error = H2_PROTOCOL_ERROR;
+    return 0;
+  }
+
+  if (nlen > 0 && name[0] == ':')
+  {
+    if (r->m_regular)
+    {
+      r->m_error = H2_PROTOCOL_ERROR;
+    }
+    else if (nlen == 7 && !memcmp(name, ":method", 7))
+    {
+      r->m_error = pseudo(r->m_method, sizeof(r->m_method), value, vlen);
+    }
+    else if (nlen == 5 && !memcmp(name, ":path", 5))
+    {
+      r->m_error = pseudo(r->m_path, sizeof(r->m_path), value, vlen);
+    }
+    else if (nlen == 10 && !memcmp(name, ":authority", 10))
+    {
+      r->m_error =
+          pseudo(r->m_authority, sizeof(r->m_authority), value, vlen);
+    }
+    else if (nlen != 7 || memcmp(name, ":scheme", 7))
+    {
+      r->m_error = H2_PROTOCOL_ERROR;
+    }
+    return 0;
+  }
+
+  if (!r->m_regular)
+  {
+    r->m_regular = 1;
+    request_line(r);
+    if (r->m_error)
+    {
+      return 0;
+    }
+  }
+  // only what parse_header_http looks at, the rest would just take room
+  for (i = 0; i < NUM_REQ_FIELDS; i++)
+  {
+    if (strlen(req_field_str[i]) == nlen &&
+        !strncasecmp(req_field_str[i], name, nlen))
+    {
+      break;
+    }
+  }
+  if (i == NUM_REQ_FIELDS || i == REQ_CONNECTION)
+  {
+    return 0;
+  }
+  if (value == NULL)
+  {
+    r->m_error = H2_INTERNAL_ERROR;
+    return 0;
+  }
+  n = snprintf(r->m_out + r->m_len, r->m_size - r->m_len, "%s: %.*s\r\n",
+               req_field_str[i], (int)vlen, value);
+  if (n < 0 || (size_t)n >= r->m_size - r->m_len)
+  {
+    r->m_error = H2_INTERNAL_ERROR;
+    return 0;
+  }
+  r->m_len += n;
+
+  return 0;
+}
+
+/*
+ * Decodes a request's header block into the HTTP/1.1 header it stands for,
+ * NUL-terminated in out, so parse_header_http can take it from there. Any
+ * error but COMPRESSION_ERROR is the stream's: PROTOCOL_ERROR for a
+ * malformed request, INTERNAL_ERROR for one too big for out.
+ */
+int h2_request(struct hpack_table *t, const void *block, size_t len,
+               char *out, size_t size)
+{
+  struct request r;
+
+  memset(&r, 0, sizeof(r));
+  r.m_out = out;
+  r.m_size = size;
+  if (hpack_decode(t, block, len, request_field, &r))
+  {
+    return H2_COMPRESSION_ERROR;
+  }
+  if (!r.m_error && !r.m_regular)
+  {
+    request_line(&r);
+  }
+  if (!r.m_error && r.m_len + 3 > size)
+  {
+    r.m_error = H2_INTERNAL_ERROR;
+  }
+  if (r.m_error)
+  {
+    return r.m_error;
+  }
+  memcpy(out + r.m_len, "\r\n", 3);
+
+  return 0;
+}
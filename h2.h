@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "util.h"
+
+/*
+ * HTTP/2 over cleartext TCP, for clients that know the server speaks it
+ * (h2c with prior knowledge, RFC 9113 section 3.3): a connection whose first
+ * bytes are the preface is served as one. This is the protocol half, frames
+ * and HPACK (RFC 7541); the connection code maps streams onto requests.
+ */
+#define H2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LEN (sizeof(H2_PREFACE) - 1)
+#define H2_PREFACE_HEAD 18 /* what an HTTP/1.1 parser takes for a header */
+#define H2_FRAME_HEADER 9
+#define H2_FRAME_MAX 16384   /* the default SETTINGS_MAX_FRAME_SIZE, ours */
+#define H2_WINDOW 65535      /* the initial window of streams and sessions */
+#define H2_WINDOW_MAX 0x7fffffff
+#define H2_TABLE_MAX 4096    /* the default SETTINGS_HEADER_TABLE_SIZE */
+#define H2_TABLE_ENTRIES (H2_TABLE_MAX / 32) /* an entry costs 32 + strings */
+#define H2_STRING_MAX 8192   /* longer strings are decoded but not kept */
+#define H2_CONTROL_ROOM 64   /* enough for what any frame has us answer */
+
+enum h2_frame_type
+{
+  H2_DATA,
+  H2_HEADERS,
+  H2_PRIORITY,
+  H2_RST_STREAM,
+  H2_SETTINGS,
+  H2_PUSH_PROMISE,
+  H2_PING,
+  H2_GOAWAY,
+  H2_WINDOW_UPDATE,
+  H2_CONTINUATION,
+};
+
+enum h2_flag
+{
+  H2_ACK = 0x1,
+  H2_END_STREAM = 0x1,
+  H2_END_HEADERS = 0x4,
+  H2_PADDED = 0x8,
+  H2_PRIORITY_FLAG = 0x20,
+};
+
+enum h2_error
+{
+  H2_NO_ERROR,
+  H2_PROTOCOL_ERROR,
+  H2_INTERNAL_ERROR,
+  H2_FLOW_CONTROL_ERROR,
+  H2_SETTINGS_TIMEOUT,
+  H2_STREAM_CLOSED,
+  H2_FRAME_SIZE_ERROR,
+  H2_REFUSED_STREAM,
+  H2_CANCEL,
+  H2_COMPRESSION_ERROR,
+  H2_CONNECT_ERROR,
+  H2_ENHANCE_YOUR_CALM,
+};
+
+enum h2_setting
+{
+  H2_HEADER_TABLE_SIZE = 1,
+  H2_ENABLE_PUSH,
+  H2_MAX_CONCURRENT_STREAMS,
+  H2_INITIAL_WINDOW_SIZE,
+  H2_MAX_FRAME_SIZE,
+  H2_MAX_HEADER_LIST_SIZE,
+};
+
+struct h2_frame
+{
+  uint32_t m_len;
+  uint8_t m_type;
+  uint8_t m_flags;
+  uint32_t m_stream;
+};
+
+struct hpack_entry
+{
+  char *m_name;
+  char *m_value;
+  size_t m_nlen;
+  size_t m_vlen;
+};
+
+/*
+ * A dynamic table, the decoder's for the client's header blocks or the
+ * encoder's for ours: a ring with the newest entry at m_first. m_max is
+ * the size the blocks agreed on; an encoder whose peer lowered it owes a
+ * size update at the start of its next block.
+ */
+struct hpack_table
+{
+  struct hpack_entry m_entry[H2_TABLE_ENTRIES];
+  size_t m_first;
+  size_t m_count;
+  size_t m_size;
+  size_t m_max;
+  int m_resized;
+};
+
+/* one decoded field, a NULL string was too long to keep; nonzero stops */
+typedef int (*hpack_field_fn)(void *, const char *, size_t, const char *,
+                              size_t);
+
+void h2_frame_parse(const void *, struct h2_frame *);
+int h2_frame_append(struct my_buffer *, enum h2_frame_type, int, uint32_t,
+                    const void *, size_t);
+void h2_frame_header(void *, size_t, enum h2_frame_type, int, uint32_t);
+uint32_t h2_get32(const void *);
+void h2_put32(void *, uint32_t);
+void hpack_init(struct hpack_table *);
+void hpack_free(struct hpack_table *);
+void hpack_resize(struct hpack_table *, size_t);
+int hpack_decode(struct hpack_table *, const void *, size_t, hpack_field_fn,
+                 void *);
+int hpack_static_name(const char *);
+int hpack_encode_status(struct hpack_table *, struct my_buffer *, int);
+int hpack_encode_field(struct hpack_table *, struct my_buffer *, int,
+                       const char *, const char *, int);
+int h2_request(struct hpack_table *, const void *, size_t, char *, size_t);
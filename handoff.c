@@ -0,0 +1,59 @@
+#include <errno.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "handoff.h"
+#include "util.h"
+
+int handoff_init(struct handoff_queue *q)
+{
+  q->m_head = NULL;
+  if ((q->m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+  {
+    log_warn("eventfd:");
+    return -1;
+  }
+
+  return 0;
+}
+
+/* the queue owns h afterwards, the consumer frees it */
+void handoff_push(struct handoff_queue *q, struct handoff *h)
+{
+  h->m_next = __atomic_load_n(&q->m_head, __ATOMIC_RELAXED);
+  while (!__atomic_compare_exchange_n(&q->m_head, &h->m_next, h, 1,
+                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+  {
+    ;
+  }
+
+  // the owner drains everything per wakeup, a failed bump only coalesces
+  if (write(q->m_eventfd, &(uint64_t){1}, sizeof(uint64_t)) < 0 &&
+      errno != EAGAIN)
+  {
+    log_warn("write:");
+  }
+}
+
+/* everything pushed so far, oldest first */
+struct handoff *handoff_pop(struct handoff_queue *q)
+{
+  struct handoff *h, *next, *list = NULL;
+  uint64_t cnt;
+
+  if (read(q->m_eventfd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+  {
+    log_warn("read:");
+  }
+
+  h = __atomic_exchange_n(&q->m_head, NULL, __ATOMIC_ACQUIRE);
+  for (; h; h = next)
+  {
+    next = h->m_next;
+    h->m_next = list;
+    list = h;
+  }
+
+  return list;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <sys/socket.h>
+
+#include "tls.h"
+
+/*
+ * Connections move between workers through handoff queues. Any worker may
+ * push onto a sibling's queue, only the owner pops: a push is a CAS onto a
+ * stack and a pop takes the whole stack at once, so neither side locks and
+ * there is no ABA. The queue's eventfd, registered in the owner's event
+ * queue, is bumped after every push.
+ */
+struct handoff
+{
+  int m_fd;
+  int m_zerocopy;
+  int m_tls;
+  struct ssl_st *m_ssl;
+  struct sockaddr_storage m_peer;
+  int m_admitted; /* it held a slot already, admission doesn't apply */
+  struct handoff *m_next;
+};
+
+struct handoff_queue
+{
+  struct handoff *m_head;
+  int m_eventfd;
+};
+
+int handoff_init(struct handoff_queue *);
+void handoff_push(struct handoff_queue *, struct handoff *);
+struct handoff *handoff_pop(struct handoff_queue *);
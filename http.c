@@ -1,7 +1,10 @@
+#define _GNU_SOURCE /* splice */
 #include <arpa/inet.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
+#include <linux/errqueue.h>
 #include <netinet/in.h>
 #include <regex.h>
 #include <stddef.h>
@@ -9,20 +12,27 @@
 #include <stdio.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "configuration.h"
+#include "h2.h"
 #include "http.h"
+#include "tls.h"
 #include "util.h"
 
 const char *req_field_str[] = {
     [REQ_RANGE] = "Range",
     [REQ_HOST] = "Host",
     [REQ_IF_MODIFIED_SINCE] = "If-Modified-Since",
+    [REQ_CONNECTION] = "Connection",
+    [REQ_CONTENT_LENGTH] = "Content-Length",
+    [REQ_TRANSFER_ENCODING] = "Transfer-Encoding",
 };
 
 const char *req_method_str[] = {
@@ -31,10 +41,11 @@ const char *req_method_str[] = {
 };
 
 const char *status_str[] = {[STATUS_OK] = "OK",
+                            [STATUS_NOT_MODIFIED] = "Not Modified",
                             [STATUS_FORBIDDEN] = "Forbidden",
                             [STATUS_NOT_FOUND] = "Not Found",
                             [STATUS_METHOD_NOT_ALLOWED] = "Method Not Allowed",
-                            [STATUS_METHOD_NOT_ALLOWED] = "Not Modified",
+                            [STATUS_TOO_MANY_REQUESTS] = "Too Many Requests",
                             [STATUS_INTERNAL_SERVER_ERROR] =
                                 "Internal Server Error"};
 
@@ -46,6 +57,23 @@ const char *res_field_str[] = {
     [RES_CONTENT_LENGTH] = "Content-Length",
     [RES_CONTENT_RANGE] = "Content-Range",
     [RES_CONTENT_TYPE] = "Content-Type",
+    [RES_RETRY_AFTER] = "Retry-After",
+};
+
+/* HTTP/2 spells them in lower case; values that repeat get indexed */
+static const struct
+{
+  const char *m_name;
+  int m_indexed;
+} res_field_h2[] = {
+    [RES_ACCEPT_RANGES] = {"accept-ranges", 1},
+    [RES_ALLOW] = {"allow", 1},
+    [RES_LOCATION] = {"location", 0},
+    [RES_LAST_MODIFIED] = {"last-modified", 0},
+    [RES_CONTENT_LENGTH] = {"content-length", 0},
+    [RES_CONTENT_RANGE] = {"content-range", 0},
+    [RES_CONTENT_TYPE] = {"content-type", 1},
+    [RES_RETRY_AFTER] = {"retry-after", 1},
 };
 
 static void decode(const char src[PATH_MAX], char dest[PATH_MAX])
@@ -71,7 +99,20 @@ static void decode(const char src[PATH_MAX], char dest[PATH_MAX])
   dest[i] = '\0';
 }
 
-enum status send_buffer_http(int fd, struct my_buffer *buf)
+/* ssl is NULL where the socket carries plaintext, kTLS included */
+static ssize_t sock_read(int fd, struct ssl_st *ssl, void *buf, size_t len)
+{
+  return ssl ? tls_read(ssl, buf, len) : read(fd, buf, len);
+}
+
+static ssize_t sock_write(int fd, struct ssl_st *ssl, const void *buf,
+                          size_t len)
+{
+  return ssl ? tls_write(ssl, buf, len) : write(fd, buf, len);
+}
+
+enum status send_buffer_http(int fd, struct ssl_st *ssl,
+                             struct my_buffer *buf)
 {
   ssize_t r;
 
@@ -82,7 +123,8 @@ enum status send_buffer_http(int fd, struct my_buffer *buf)
 
   while (buf->length > 0)
   {
-    if ((r = write(fd, buf->data, buf->length)) <= 0)
+    if ((r = sock_write(fd, ssl, buf->data + buf->offset,
+                        buf->length - buf->offset)) <= 0)
     {
       if (errno == EAGAIN || errno == EWOULDBLOCK)
       {
@@ -93,22 +135,289 @@ enum status send_buffer_http(int fd, struct my_buffer *buf)
         return STATUS_INTERNAL_SERVER_ERROR;
       }
     }
-    memmove(buf->data, buf->data + r, buf->length - r);
-    buf->length -= r;
+    buffer_consume(buf, r);
+  }
+
+  return 0;
+}
+
+/*
+ * Like send_buffer_http, but the kernel pins the pages instead of copying
+ * them. buf must stay untouched until reap_zerocopy_http() has accounted
+ * for every send counted in *issued.
+ */
+enum status send_buffer_zc_http(int fd, struct my_buffer *buf,
+                                uint32_t *issued)
+{
+  ssize_t r;
+  int flags = MSG_ZEROCOPY;
+
+  while (buf->length > 0)
+  {
+    if ((r = send(fd, buf->data + buf->offset, buf->length - buf->offset,
+                  flags | MSG_NOSIGNAL)) < 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        return 0;
+      }
+      // out of pinnable memory (optmem), copy this one instead
+      if (errno == ENOBUFS && flags)
+      {
+        flags = 0;
+        continue;
+      }
+      return STATUS_INTERNAL_SERVER_ERROR;
+    }
+    if (flags)
+    {
+      (*issued)++;
+    }
+    flags = MSG_ZEROCOPY;
+    buffer_consume(buf, r);
   }
 
   return 0;
 }
 
-enum status receive_header_http(int fd, struct my_buffer *buf, int *done)
+/*
+ * Drains zerocopy completions from the socket error queue into *done.
+ * Anything else found there is a real socket error.
+ */
+enum status reap_zerocopy_http(int fd, uint32_t *done)
+{
+  char control[CMSG_SPACE(sizeof(struct sock_extended_err)) * 4];
+  struct sock_extended_err *ee;
+  struct msghdr msg;
+  struct cmsghdr *cm;
+
+  for (;;)
+  {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+    {
+      return (errno == EAGAIN || errno == EWOULDBLOCK)
+                 ? 0
+                 : STATUS_INTERNAL_SERVER_ERROR;
+    }
+
+    for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+    {
+      if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+            (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+      {
+        continue;
+      }
+      ee = (struct sock_extended_err *)CMSG_DATA(cm);
+      if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+      {
+        return STATUS_INTERNAL_SERVER_ERROR;
+      }
+      // notifications carry an inclusive range of send ids
+      *done += ee->ee_data - ee->ee_info + 1;
+    }
+  }
+}
+
+/*
+ * Writes the header, and as much of a buffered body as fits along with it.
+ * Through OpenSSL they go one after the other, there is no writev.
+ */
+enum status send_header_http(int fd, struct ssl_st *ssl, struct my_buffer *hdr,
+                             struct my_buffer *body, int more)
+{
+  struct iovec iov[2];
+  ssize_t r;
+  size_t n;
+
+  if (hdr == NULL || body == NULL)
+  {
+    return STATUS_INTERNAL_SERVER_ERROR;
+  }
+
+  while (hdr->length > 0)
+  {
+    if (ssl)
+    {
+      r = tls_write(ssl, hdr->data + hdr->offset, hdr->length - hdr->offset);
+    }
+    else if (body->length > 0)
+    {
+      iov[0].iov_base = hdr->data + hdr->offset;
+      iov[0].iov_len = hdr->length - hdr->offset;
+      iov[1].iov_base = body->data + body->offset;
+      iov[1].iov_len = body->length - body->offset;
+      r = writev(fd, iov, LEN(iov));
+    }
+    else
+    {
+      r = send(fd, hdr->data + hdr->offset, hdr->length - hdr->offset,
+               MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+    }
+    if (r <= 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        return 0;
+      }
+      else
+      {
+        return STATUS_INTERNAL_SERVER_ERROR;
+      }
+    }
+
+    n = MIN((size_t)r, hdr->length - hdr->offset);
+    buffer_consume(hdr, n);
+    if ((size_t)r > n)
+    {
+      buffer_consume(body, r - n);
+    }
+  }
+  if (ssl && body->length > 0)
+  {
+    return send_buffer_http(fd, ssl, body);
+  }
+
+  return 0;
+}
+
+/* sends at most max bytes of the range, the caller takes turns with others */
+enum status send_file_http(int fd, int file_fd, const struct resp_t *res,
+                           size_t *progress, size_t max)
+{
+  off_t off;
+  size_t len;
+  ssize_t r;
+
+  len = res->m_file.upper - res->m_file.lower + 1;
+  len = *progress + MIN(len - *progress, max);
+
+  while (*progress < len)
+  {
+    off = res->m_file.lower + *progress;
+    if ((r = sendfile(fd, file_fd, &off, len - *progress)) < 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        return 0;
+      }
+      else
+      {
+        return STATUS_INTERNAL_SERVER_ERROR;
+      }
+    }
+    else if (r == 0)
+    {
+      // file shrank under us
+      return STATUS_INTERNAL_SERVER_ERROR;
+    }
+    *progress += r;
+  }
+
+  return 0;
+}
+
+/*
+ * Moves a file range to the socket through a pipe, file to pipe then pipe
+ * to socket, without copying through user space. *in_pipe counts bytes
+ * sitting in the pipe that the socket didn't take yet; they belong to this
+ * response, so the pipe can't be shared until it's zero. *progress counts
+ * bytes delivered to the socket, the next file offset is derived from both.
+ * At most max bytes are delivered per call.
+ */
+enum status send_splice_http(int fd, int file_fd, const int pipe_fd[2],
+                             const struct resp_t *res, size_t *progress,
+                             size_t *in_pipe, size_t max)
+{
+  loff_t off;
+  size_t len, end;
+  ssize_t r;
+
+  len = res->m_file.upper - res->m_file.lower + 1;
+  end = *progress + MIN(len - *progress, max);
+
+  while (*progress < end)
+  {
+    if (*in_pipe == 0)
+    {
+      off = res->m_file.lower + *progress;
+      if ((r = splice(file_fd, &off, pipe_fd[1], NULL,
+                      MIN(len - *progress, SPLICE_PIPE_SIZE),
+                      SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) < 0)
+      {
+        return STATUS_INTERNAL_SERVER_ERROR;
+      }
+      else if (r == 0)
+      {
+        // file shrank under us
+        return STATUS_INTERNAL_SERVER_ERROR;
+      }
+      *in_pipe = r;
+    }
+
+    if ((r = splice(pipe_fd[0], NULL, fd, NULL, *in_pipe,
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK |
+                        (*progress + *in_pipe < len ? SPLICE_F_MORE : 0))) < 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        return 0;
+      }
+      return STATUS_INTERNAL_SERVER_ERROR;
+    }
+    *in_pipe -= r;
+    *progress += r;
+  }
+
+  return 0;
+}
+
+/*
+ * Reads until the unconsumed part of buf holds a complete header, which then
+ * spans [buf->offset, *end). Bytes after it belong to the next pipelined
+ * request and stay where they are. *done is negative if the peer closed the
+ * connection before sending anything. A buffer left full without *done means
+ * the header doesn't fit.
+ */
+enum status receive_header_http(int fd, struct ssl_st *ssl,
+                                struct my_buffer *buf, size_t *end, int *done)
 {
   enum status s;
   ssize_t r;
+  size_t i;
 
-  while (1)
+  for (i = buf->offset;; )
   {
-    if ((r = read(fd, buf->data + buf->length,
-                  sizeof(buf->data) - buf->length)) < 0)
+    for (i = MAX(i, buf->offset + 3); i < buf->length; i++)
+    {
+      if (buf->data[i] == '\n' && buf->data[i - 1] == '\r' &&
+          buf->data[i - 2] == '\n' && buf->data[i - 3] == '\r')
+      {
+        *end = i + 1;
+        *done = 1;
+        return 0;
+      }
+    }
+
+    // one byte stays spare so the header can be NUL-terminated in place
+    if (buf->length == buf->size - 1)
+    {
+      if (buf->offset == 0)
+      {
+        // the caller may lease a bigger buffer and try again
+        *done = 0;
+        return 0;
+      }
+      memmove(buf->data, buf->data + buf->offset, buf->length - buf->offset);
+      buf->length -= buf->offset;
+      i -= buf->offset;
+      buf->offset = 0;
+    }
+
+    if ((r = sock_read(fd, ssl, buf->data + buf->length,
+                       buf->size - 1 - buf->length)) < 0)
     {
       if (errno == EAGAIN || errno == EWOULDBLOCK)
       {
@@ -123,76 +432,321 @@ enum status receive_header_http(int fd, struct my_buffer *buf, int *done)
     }
     else if (r == 0)
     {
+      if (buf->length == 0)
+      {
+        *done = -1;
+        return 0;
+      }
       // unexpected EOF
       s = STATUS_INTERNAL_SERVER_ERROR; // Bad request
       goto err;
     }
     buf->length += r;
+  }
+
+err:
+  buffer_reset(buf);
+  return s;
+}
+
+/*
+ * Reads whatever the socket has into the free space after buf's data. *eof
+ * is set once the peer closed, bytes read before that are kept.
+ */
+enum status receive_buffer_http(int fd, struct ssl_st *ssl,
+                                struct my_buffer *buf, int *eof)
+{
+  ssize_t r;
 
-    if (buf->length >= 4 &&
-        !memcmp(buf->data + buf->length - 4, "\r\n\r\n", 4))
+  while (buf->length < buf->size)
+  {
+    if ((r = sock_read(fd, ssl, buf->data + buf->length,
+                       buf->size - buf->length)) < 0)
     {
-      break;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        return 0;
+      }
+      return STATUS_INTERNAL_SERVER_ERROR;
+    }
+    if (r == 0)
+    {
+      *eof = 1;
+      return 0;
     }
+    buf->length += r;
+  }
+
+  return 0;
+}
 
-    if (r == 0 || buf->length == sizeof(buf->data))
+/*
+ * Responses that don't depend on the requested resource are serialized once
+ * at startup, with and without keep-alive. Only the Date value is patched in
+ * when they are sent.
+ */
+static struct canned_resp
+{
+  enum status m_status;
+  char m_head[2][FIELD_MAX * 2];
+  size_t m_head_len[2];
+  size_t m_date_off[2];
+  size_t m_date_len;
+  char m_body[FIELD_MAX * 2];
+  size_t m_body_len;
+} canned_resp[] = {
+    {.m_status = STATUS_NOT_MODIFIED},
+    {.m_status = STATUS_FORBIDDEN},
+    {.m_status = STATUS_NOT_FOUND},
+    {.m_status = STATUS_METHOD_NOT_ALLOWED},
+    {.m_status = STATUS_TOO_MANY_REQUESTS},
+    {.m_status = STATUS_INTERNAL_SERVER_ERROR},
+};
+
+static size_t res_field_len[NUM_RES_FIELDS];
+static int res_field_hpack[NUM_RES_FIELDS]; /* static index of the name */
+static int date_hpack;
+
+static const struct canned_resp *get_canned_resp(enum status s)
+{
+  size_t i;
+
+  for (i = 0; i < LEN(canned_resp); i++)
+  {
+    if (canned_resp[i].m_status == s)
     {
-      s = STATUS_INTERNAL_SERVER_ERROR; // response is too big
-      goto err;
+      return &canned_resp[i];
+    }
+  }
+
+  return NULL;
+}
+
+static int get_date_http(const char **date, size_t *len)
+{
+  static __thread time_t cached_t;
+  static __thread char cached[FIELD_MAX];
+  static __thread size_t cached_len;
+  time_t t;
+
+  if ((t = time(NULL)) != cached_t || cached_len == 0)
+  {
+    if (get_time_stamp(cached, sizeof(cached), t))
+    {
+      return 1;
     }
+    cached_len = strlen(cached);
+    cached_t = t;
   }
 
-  buf->length -= 2;
-  *done = 1;
+  *date = cached;
+  *len = cached_len;
 
   return 0;
-err:
-  memset(buf, 0, sizeof(*buf));
-  return s;
 }
 
-enum status prep_header_buf_http(const struct resp_t *res,
-                                 struct my_buffer *buf)
+static int assemble_header(const struct resp_t *res, const char *date,
+                           size_t date_len, struct my_buffer *buf,
+                           size_t *date_off)
 {
-  char tstmp[FIELD_MAX];
+  const char *reason;
   size_t i;
 
-  memset(buf, 0, sizeof(*buf));
+  reason = status_str[res->m_status] ? status_str[res->m_status] : "";
 
-  if (get_time_stamp(tstmp, sizeof(tstmp), time(NULL)))
+  if (buffer_append(buf, "HTTP/1.1 %d %s\r\n", res->m_status, reason) ||
+      buffer_append_mem(buf, "Date: ", sizeof("Date: ") - 1))
   {
-    goto err;
+    return 1;
+  }
+  if (date_off != NULL)
+  {
+    *date_off = buf->length;
+  }
+  if (buffer_append_mem(buf, date, date_len) ||
+      (res->m_keep_alive
+           ? buffer_append_mem(buf, "\r\nConnection: keep-alive\r\n",
+                               sizeof("\r\nConnection: keep-alive\r\n") - 1)
+           : buffer_append_mem(buf, "\r\nConnection: close\r\n",
+                               sizeof("\r\nConnection: close\r\n") - 1)))
+  {
+    return 1;
   }
 
-  if (buffer_append(buf,
-                    "HTTP/1.1 %d %s\r\n"
-                    "Date: %s\r\n"
-                    "Connection: close\r\n",
-                    res->m_status, status_str[res->m_status], tstmp))
+  for (i = 0; i < NUM_RES_FIELDS; i++)
   {
-    goto err;
+    if (res->m_field[i][0] == '\0')
+    {
+      continue;
+    }
+    if (buffer_append_mem(buf, res_field_str[i], res_field_len[i]) ||
+        buffer_append_mem(buf, ": ", 2) ||
+        buffer_append_mem(buf, res->m_field[i], strlen(res->m_field[i])) ||
+        buffer_append_mem(buf, "\r\n", 2))
+    {
+      return 1;
+    }
   }
 
+  return buffer_append_mem(buf, "\r\n", 2);
+}
+
+void init_canned_http(void)
+{
+  static struct resp_t res;
+  static char mem[FIELD_MAX * 4];
+  struct my_buffer buf = {mem, sizeof(mem), 0, 0};
+  char date[FIELD_MAX];
+  struct canned_resp *cr;
+  size_t i, k;
+
   for (i = 0; i < NUM_RES_FIELDS; i++)
   {
-    if (res->m_field[i][0] != '\0' &&
-        buffer_append(buf, "%s: %s\r\n", res_field_str[i], res->m_field[i]))
+    res_field_len[i] = strlen(res_field_str[i]);
+    res_field_hpack[i] = hpack_static_name(res_field_h2[i].m_name);
+  }
+  date_hpack = hpack_static_name("date");
+
+  /* bodies go first, prepare_err_resp_http takes Content-Length from them */
+  for (i = 0; i < LEN(canned_resp); i++)
+  {
+    cr = &canned_resp[i];
+    if (cr->m_status == STATUS_NOT_MODIFIED)
     {
-      goto err;
+      continue;
     }
+    if (esnprintf(cr->m_body, sizeof(cr->m_body),
+                  "<!DOCTYPE html>\n<html>\n\t<head>\n"
+                  "\t\t<title>%d %s</title>\n\t</head>\n"
+                  "\t<body>\n\t\t<h1>%d %s</h1>\n"
+                  "\t</body>\n</html>\n",
+                  cr->m_status, status_str[cr->m_status], cr->m_status,
+                  status_str[cr->m_status]))
+    {
+      die("init_canned_http: body of %d doesn't fit", cr->m_status);
+    }
+    cr->m_body_len = strlen(cr->m_body);
   }
 
-  if (buffer_append(buf, "\r\n"))
+  if (get_time_stamp(date, sizeof(date), time(NULL)))
+  {
+    die("init_canned_http: get_time_stamp failed");
+  }
+
+  for (i = 0; i < LEN(canned_resp); i++)
+  {
+    cr = &canned_resp[i];
+    if (cr->m_status == STATUS_NOT_MODIFIED)
+    {
+      memset(&res, 0, sizeof(res));
+      res.m_status = STATUS_NOT_MODIFIED;
+    }
+    else
+    {
+      prepare_err_resp_http(NULL, &res, cr->m_status);
+    }
+
+    for (k = 0; k < LEN(cr->m_head); k++)
+    {
+      res.m_keep_alive = k;
+      buffer_reset(&buf);
+      if (assemble_header(&res, date, strlen(date), &buf,
+                          &cr->m_date_off[k]) ||
+          buf.length > sizeof(cr->m_head[k]))
+      {
+        die("init_canned_http: header of %d doesn't fit", cr->m_status);
+      }
+      memcpy(cr->m_head[k], buf.data, buf.length);
+      cr->m_head_len[k] = buf.length;
+    }
+    cr->m_date_len = strlen(date);
+  }
+}
+
+int get_canned_body_http(enum status s, const char **body, size_t *len)
+{
+  const struct canned_resp *cr;
+
+  if (!(cr = get_canned_resp(s)))
+  {
+    return 1;
+  }
+
+  *body = cr->m_body;
+  *len = cr->m_body_len;
+
+  return 0;
+}
+
+enum status prep_header_buf_http(const struct resp_t *res,
+                                 struct my_buffer *buf)
+{
+  const struct canned_resp *cr;
+  const char *date;
+  size_t date_len, k;
+
+  buffer_reset(buf);
+
+  if (get_date_http(&date, &date_len))
+  {
+    goto err;
+  }
+
+  if ((res->m_type == RESTYPE_ERROR || res->m_status == STATUS_NOT_MODIFIED) &&
+      res->m_field[RES_CONTENT_RANGE][0] == '\0' &&
+      (cr = get_canned_resp(res->m_status)) &&
+      cr->m_date_len == date_len)
+  {
+    /* the Date format has a fixed width, so the template can be patched */
+    k = res->m_keep_alive ? 1 : 0;
+    memcpy(buf->data, cr->m_head[k], cr->m_head_len[k]);
+    memcpy(buf->data + cr->m_date_off[k], date, date_len);
+    buf->length = cr->m_head_len[k];
+
+    return 0;
+  }
+
+  if (assemble_header(res, date, date_len, buf, NULL))
   {
     goto err;
   }
 
   return 0;
 err:
-  memset(buf, 0, sizeof(*buf));
+  buffer_reset(buf);
   return STATUS_INTERNAL_SERVER_ERROR;
 }
 
+/*
+ * The same header as an HPACK block, for an HTTP/2 HEADERS frame. Values
+ * that repeat from one response to the next go into the connection's
+ * dynamic table, the ones particular to a resource are sent as literals.
+ */
+enum status prep_header_h2_http(const struct resp_t *res,
+                                struct hpack_table *enc, struct my_buffer *buf)
+{
+  const char *date;
+  size_t date_len, i;
+
+  if (get_date_http(&date, &date_len) ||
+      hpack_encode_status(enc, buf, res->m_status) ||
+      hpack_encode_field(enc, buf, date_hpack, "date", date, 0))
+  {
+    return STATUS_INTERNAL_SERVER_ERROR;
+  }
+  for (i = 0; i < NUM_RES_FIELDS; i++)
+  {
+    if (res->m_field[i][0] != '\0' &&
+        hpack_encode_field(enc, buf, res_field_hpack[i], res_field_h2[i].m_name,
+                           res->m_field[i], res_field_h2[i].m_indexed))
+    {
+      return STATUS_INTERNAL_SERVER_ERROR;
+    }
+  }
+
+  return 0;
+}
+
 enum status parse_header_http(const char *header_str, struct req_t *req)
 {
   struct in6_addr addr;
@@ -200,6 +754,7 @@ enum status parse_header_http(const char *header_str, struct req_t *req)
   const char *path_start, *end, *query_start;
   const char *fragment_start, *temp;
   char *m, *n;
+  int http11;
   /*
    * Here is a quick overview of whats going on
    * path?query#fragment
@@ -332,8 +887,8 @@ enum status parse_header_http(const char *header_str, struct req_t *req)
     return STATUS_INTERNAL_SERVER_ERROR;
   }
   path_start += sizeof("HTTP/") - 1;
-  if (strncmp(path_start, "1.0", sizeof("1.0") - 1) &&
-      strncmp(path_start, "1.1", sizeof("1.1") - 1))
+  http11 = !strncmp(path_start, "1.1", sizeof("1.1") - 1);
+  if (strncmp(path_start, "1.0", sizeof("1.0") - 1) && !http11)
   {
     return STATUS_INTERNAL_SERVER_ERROR; // Unsupported version of http
   }
@@ -391,6 +946,18 @@ enum status parse_header_http(const char *header_str, struct req_t *req)
 
     path_start = end + (sizeof("\r\n") - 1);
   }
+
+  // 1.1 connections persist unless told otherwise, 1.0 ones only on request
+  if (http11)
+  {
+    req->m_keep_alive = strcasecmp(req->m_field[REQ_CONNECTION], "close");
+  }
+  else
+  {
+    req->m_keep_alive =
+        !strcasecmp(req->m_field[REQ_CONNECTION], "keep-alive");
+  }
+
   return 0;
 }
 
@@ -508,6 +1075,25 @@ static enum status ensure_dirslash(char uri[PATH_MAX], int *redirect)
   return 0;
 }
 
+static const char *get_mime_type(const char *path)
+{
+  const char *p;
+  size_t i;
+
+  if ((p = strrchr(path, '.')))
+  {
+    for (i = 0; i < LEN(mime_types_list); i++)
+    {
+      if (!strcmp(mime_types_list[i].extension, p + 1))
+      {
+        return mime_types_list[i].typestr;
+      }
+    }
+  }
+
+  return "application/octet-stream";
+}
+
 static enum status handle_range(const char *str, size_t size, size_t *lower,
                                 size_t *upper)
 {
@@ -638,10 +1224,9 @@ void prepare_resp_http(const struct req_t *req, struct resp_t *res,
   struct in6_addr addr;
   struct stat st;
   struct tm tm = {0};
-  size_t i;
   int redirect, hasport, ipv6host;
   static char tmppath[PATH_MAX];
-  char *p, *mime;
+  const char *mime;
 
   memset(res, 0, sizeof(*res));
 
@@ -654,6 +1239,21 @@ void prepare_resp_http(const struct req_t *req, struct resp_t *res,
     goto err;
   }
 
+  // reserved, served from the workers' counters rather than the filesystem
+  if (!strcmp(res->m_path, STATS_PATH))
+  {
+    res->m_type = RESTYPE_STATS;
+    res->m_status = STATUS_OK;
+    if (esnprintf(res->m_field[RES_CONTENT_TYPE],
+                  sizeof(res->m_field[RES_CONTENT_TYPE]), "%s",
+                  "text/plain; version=0.0.4"))
+    {
+      s = STATUS_INTERNAL_SERVER_ERROR;
+      goto err;
+    }
+    return;
+  }
+
   if (strstr(res->m_path, "/.") &&
       strncmp(res->m_path, "/.well-known/", sizeof("/.well-known/") - 1))
   {
@@ -705,7 +1305,7 @@ void prepare_resp_http(const struct req_t *req, struct resp_t *res,
         if (access(res->m_internal_path, R_OK) != 0)
         {
           s = STATUS_FORBIDDEN;
-          log_info("Directory was inaccessible\n");
+          log_debug("Directory was inaccessible\n");
           goto err;
         }
         else
@@ -729,7 +1329,7 @@ void prepare_resp_http(const struct req_t *req, struct resp_t *res,
 
         if (!S_ISREG(st.st_mode) || errno == EACCES)
         {
-          log_info("S_ISREG is forbidden after errno EACCES\n");
+          log_debug("S_ISREG is forbidden after errno EACCES\n");
           s = STATUS_FORBIDDEN;
         }
         else
@@ -764,7 +1364,7 @@ void prepare_resp_http(const struct req_t *req, struct resp_t *res,
     if (difftime(st.st_mtim.tv_sec, timegm(&tm)) <= 0)
     {
       res->m_status = STATUS_NOT_MODIFIED;
-      log_info("Not modified status 304\n");
+      log_debug("Not modified status 304\n");
       return;
     }
   }
@@ -774,7 +1374,7 @@ void prepare_resp_http(const struct req_t *req, struct resp_t *res,
   {
     if (s == STATUS_INTERNAL_SERVER_ERROR)
     {
-      res->m_status = STATUS_INTERNAL_SERVER_ERROR;
+      prepare_err_resp_http(req, res, s);
 
       if (esnprintf(res->m_field[RES_CONTENT_RANGE],
                     sizeof(res->m_field[RES_CONTENT_RANGE]), "bytes */%zu",
@@ -792,25 +1392,14 @@ void prepare_resp_http(const struct req_t *req, struct resp_t *res,
     }
   }
 
-  mime = "application/octet-stream";
-  if ((p = strrchr(res->m_internal_path, '.')))
-  {
-    for (i = 0; i < LEN(mime_types_list); i++)
-    {
-      if (!strcmp(mime_types_list[i].extension, p + 1))
-      {
-        mime = mime_types_list[i].typestr;
-        break;
-      }
-    }
-  }
+  mime = get_mime_type(res->m_internal_path);
 
   res->m_type = RESTYPE_FILE;
 
   if (access(res->m_internal_path, R_OK))
   {
     res->m_status = STATUS_FORBIDDEN;
-    log_info("Access forbidden file\n");
+    log_debug("Access forbidden file\n");
   }
   else
   {
@@ -860,9 +1449,35 @@ err:
   prepare_err_resp_http(req, res, s);
 }
 
+static int has_req_body(const struct req_t *req)
+{
+  return req->m_field[REQ_TRANSFER_ENCODING][0] != '\0' ||
+         (req->m_field[REQ_CONTENT_LENGTH][0] != '\0' &&
+          strspn(req->m_field[REQ_CONTENT_LENGTH], "0") !=
+              strlen(req->m_field[REQ_CONTENT_LENGTH]));
+}
+
+void set_keep_alive_http(const struct req_t *req, struct resp_t *res)
+{
+  /*
+   * The next request can only be found if this response is delimited and
+   * the current one was understood. Request bodies are never read, so one
+   * that came with a body ends the connection instead of being taken for
+   * the next request.
+   */
+  res->m_keep_alive =
+      req->m_keep_alive && !has_req_body(req) &&
+      res->m_status != STATUS_INTERNAL_SERVER_ERROR &&
+      res->m_status != STATUS_METHOD_NOT_ALLOWED &&
+      (req->m_method == METH_HEAD || res->m_status == STATUS_NOT_MODIFIED ||
+       res->m_field[RES_CONTENT_LENGTH][0] != '\0');
+}
+
 void prepare_err_resp_http(const struct req_t *req, struct resp_t *res,
                            enum status s)
 {
+  const char *body;
+  size_t body_len;
 
   (void)req;
 
@@ -881,9 +1496,24 @@ void prepare_err_resp_http(const struct req_t *req, struct resp_t *res,
   if (res->m_status == STATUS_METHOD_NOT_ALLOWED)
   {
     if (esnprintf(res->m_field[RES_ALLOW], sizeof(res->m_field[RES_ALLOW]),
-                  "Allow: GET, HEAD"))
+                  "GET, HEAD"))
+    {
+      res->m_status = STATUS_INTERNAL_SERVER_ERROR;
+    }
+  }
+  else if (res->m_status == STATUS_TOO_MANY_REQUESTS)
+  {
+    if (esnprintf(res->m_field[RES_RETRY_AFTER],
+                  sizeof(res->m_field[RES_RETRY_AFTER]), RETRY_AFTER))
     {
       res->m_status = STATUS_INTERNAL_SERVER_ERROR;
     }
   }
+
+  if (!get_canned_body_http(res->m_status, &body, &body_len) &&
+      esnprintf(res->m_field[RES_CONTENT_LENGTH],
+                sizeof(res->m_field[RES_CONTENT_LENGTH]), "%zu", body_len))
+  {
+    res->m_status = STATUS_INTERNAL_SERVER_ERROR;
+  }
 }
@@ -1,10 +1,13 @@
 #pragma once
 
 #include <limits.h>
+#include <stdint.h>
 #include <sys/socket.h>
 
 #include "configuration.h"
+#include "h2.h"
 #include "srv.h"
+#include "tls.h"
 #include "util.h"
 
 enum req_field
@@ -12,6 +15,9 @@ enum req_field
   REQ_HOST,
   REQ_RANGE,
   REQ_IF_MODIFIED_SINCE,
+  REQ_CONNECTION,
+  REQ_CONTENT_LENGTH,
+  REQ_TRANSFER_ENCODING,
   NUM_REQ_FIELDS,
 };
 
@@ -33,6 +39,7 @@ struct req_t
   char m_query[FIELD_MAX];
   char m_fragment[FIELD_MAX];
   char m_field[NUM_REQ_FIELDS][FIELD_MAX];
+  int m_keep_alive;
 };
 
 enum status
@@ -42,6 +49,7 @@ enum status
   STATUS_FORBIDDEN = 403,
   STATUS_NOT_FOUND = 404,
   STATUS_METHOD_NOT_ALLOWED = 405,
+  STATUS_TOO_MANY_REQUESTS = 429,
   STATUS_INTERNAL_SERVER_ERROR = 500,
 };
 
@@ -56,6 +64,7 @@ enum response_field
   RES_CONTENT_LENGTH,
   RES_CONTENT_RANGE,
   RES_CONTENT_TYPE,
+  RES_RETRY_AFTER,
   NUM_RES_FIELDS,
 };
 
@@ -66,6 +75,7 @@ enum res_type
   RESTYPE_DIRLISTING,
   RESTYPE_ERROR,
   RESTYPE_FILE,
+  RESTYPE_STATS,
   NUM_RES_TYPES,
 };
 
@@ -78,15 +88,32 @@ struct resp_t
   {
     size_t lower;
     size_t upper;
+    int fd; // borrowed from the connection, read by prepare_file_buffer
   } m_file;
   enum res_type m_type;
   char m_field[NUM_RES_FIELDS][FIELD_MAX];
+  int m_keep_alive;
 };
 
-enum status send_buffer_http(int, struct my_buffer *);
+void init_canned_http(void);
+int get_canned_body_http(enum status, const char **, size_t *);
+enum status send_buffer_http(int, struct ssl_st *, struct my_buffer *);
+enum status send_buffer_zc_http(int, struct my_buffer *, uint32_t *);
+enum status reap_zerocopy_http(int, uint32_t *);
+enum status send_header_http(int, struct ssl_st *, struct my_buffer *,
+                             struct my_buffer *, int);
+enum status send_file_http(int, int, const struct resp_t *, size_t *, size_t);
+enum status send_splice_http(int, int, const int[2], const struct resp_t *,
+                             size_t *, size_t *, size_t);
 enum status prep_header_buf_http(const struct resp_t *, struct my_buffer *);
+enum status prep_header_h2_http(const struct resp_t *, struct hpack_table *,
+                                struct my_buffer *);
 enum status parse_header_http(const char *, struct req_t *);
 void prepare_err_resp_http(const struct req_t *, struct resp_t *, enum status);
 void prepare_resp_http(const struct req_t *, struct resp_t *,
                        const struct server *);
-enum status receive_header_http(int, struct my_buffer *, int *);
+void set_keep_alive_http(const struct req_t *, struct resp_t *);
+enum status receive_header_http(int, struct ssl_st *, struct my_buffer *,
+                                size_t *, int *);
+enum status receive_buffer_http(int, struct ssl_st *, struct my_buffer *,
+                                int *);
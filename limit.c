@@ -0,0 +1,297 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "configuration.h"
+#include "limit.h"
+#include "metrics.h"
+#include "mysock.h"
+#include "util.h"
+
+#define TOKEN 1000000 /* a token in millionths, one per microsecond at 1/s */
+#define WINDOW 1000000000ULL /* ns a full bucket lasts, and an idle entry */
+
+static int enabled(const struct limit_rates *r)
+{
+  return r->m_conns || r->m_rps || r->m_bps;
+}
+
+int limit_init(struct limits *l, const struct limit_config *cfg)
+{
+  l->m_cfg = *cfg;
+  l->m_table = NULL;
+  l->m_decay_at = 0;
+  if (!enabled(&cfg->m_ip) && !enabled(&cfg->m_prefix))
+  {
+    return 0;
+  }
+  if (!(l->m_table = calloc(LIMIT_TABLE, sizeof(*l->m_table))))
+  {
+    log_warn("calloc:");
+    return -1;
+  }
+
+  return 0;
+}
+
+static const struct limit_rates *rates(const struct limits *l,
+                                       const struct limit_entry *e)
+{
+  return e->m_kind == LIMIT_IP ? &l->m_cfg.m_ip : &l->m_cfg.m_prefix;
+}
+
+/* a bucket holds at most one second of its rate */
+static void refill(struct limit_entry *e, const struct limit_rates *r,
+                   uint64_t now)
+{
+  uint64_t us;
+
+  if (now - e->m_stamp >= WINDOW)
+  {
+    us = WINDOW / 1000;
+    e->m_stamp = now;
+  }
+  else
+  {
+    us = (now - e->m_stamp) / 1000;
+    e->m_stamp += us * 1000;
+  }
+  e->m_reqs = MIN(e->m_reqs + (int64_t)(us * r->m_rps),
+                  (int64_t)(r->m_rps * TOKEN));
+  e->m_bytes = MIN(e->m_bytes + (int64_t)(us * r->m_bps),
+                   (int64_t)(r->m_bps * TOKEN));
+}
+
+/*
+ * The entry of key, refilled up to now. A new one starts with full buckets
+ * in a free entry of the window or one idle for long enough; with neither
+ * the client goes untracked (NULL) rather than take a busy entry's place.
+ */
+static struct limit_entry *find(struct limits *l, uint64_t key,
+                                enum limit_kind kind, int create, uint64_t now)
+{
+  const struct limit_rates *r;
+  struct limit_entry *e, *spare = NULL;
+  size_t h, i;
+
+  h = (key * 0x9e3779b97f4a7c15ULL) >> 32;
+  for (i = 0; i < LIMIT_PROBE; i++)
+  {
+    e = &l->m_table[(h + i) & (LIMIT_TABLE - 1)];
+    if (e->m_kind == kind && e->m_key == key)
+    {
+      refill(e, rates(l, e), now);
+      return e;
+    }
+    if (!spare && (e->m_kind == LIMIT_FREE ||
+                   (e->m_conns == 0 && now - e->m_stamp >= WINDOW)))
+    {
+      spare = e;
+    }
+  }
+  if (!create || !spare)
+  {
+    return NULL;
+  }
+
+  spare->m_key = key;
+  spare->m_kind = kind;
+  spare->m_stamp = now;
+  spare->m_conns = 0;
+  r = rates(l, spare);
+  spare->m_reqs = r->m_rps * TOKEN;
+  spare->m_bytes = r->m_bps * TOKEN;
+
+  return spare;
+}
+
+/* the client's address and prefix entries, NULL for a level without limits */
+static void lookup(struct limits *l, const struct sockaddr_storage *sa,
+                   int create, struct limit_entry *e[2])
+{
+  uint64_t now = metrics_now(), key;
+
+  e[0] = e[1] = NULL;
+  if (enabled(&l->m_cfg.m_ip))
+  {
+    e[0] = find(l, get_socket_key(sa), LIMIT_IP, create, now);
+  }
+  if (enabled(&l->m_cfg.m_prefix) && (key = get_prefix_key(sa)))
+  {
+    e[1] = find(l, key, LIMIT_PREFIX, create, now);
+  }
+}
+
+/* counts a new connection of the client, -1 if it has too many already */
+int limit_connect(struct limits *l, const struct sockaddr_storage *sa)
+{
+  struct limit_entry *e[2];
+  size_t i, max;
+
+  if (!l->m_table)
+  {
+    return 0;
+  }
+  lookup(l, sa, 1, e);
+  for (i = 0; i < LEN(e); i++)
+  {
+    if (e[i] && (max = rates(l, e[i])->m_conns) && e[i]->m_conns >= max)
+    {
+      return -1;
+    }
+  }
+  for (i = 0; i < LEN(e); i++)
+  {
+    if (e[i])
+    {
+      e[i]->m_conns++;
+    }
+  }
+
+  return 0;
+}
+
+/* counts a connection admitted by a sibling, whatever the limit says */
+void limit_adopt(struct limits *l, const struct sockaddr_storage *sa)
+{
+  struct limit_entry *e[2];
+  size_t i;
+
+  if (!l->m_table)
+  {
+    return;
+  }
+  lookup(l, sa, 1, e);
+  for (i = 0; i < LEN(e); i++)
+  {
+    if (e[i])
+    {
+      e[i]->m_conns++;
+    }
+  }
+}
+
+void limit_disconnect(struct limits *l, const struct sockaddr_storage *sa)
+{
+  struct limit_entry *e[2];
+  size_t i;
+
+  if (!l->m_table)
+  {
+    return;
+  }
+  lookup(l, sa, 0, e);
+  for (i = 0; i < LEN(e); i++)
+  {
+    // an untracked connection may meet an entry made after it
+    if (e[i] && e[i]->m_conns > 0)
+    {
+      e[i]->m_conns--;
+    }
+  }
+}
+
+/* takes a request token from each level, -1 if one is out */
+int limit_request(struct limits *l, const struct sockaddr_storage *sa)
+{
+  struct limit_entry *e[2];
+  size_t i;
+
+  if (!l->m_table)
+  {
+    return 0;
+  }
+  lookup(l, sa, 1, e);
+  for (i = 0; i < LEN(e); i++)
+  {
+    if (e[i] && rates(l, e[i])->m_rps && e[i]->m_reqs < TOKEN)
+    {
+      return -1;
+    }
+  }
+  for (i = 0; i < LEN(e); i++)
+  {
+    if (e[i] && rates(l, e[i])->m_rps)
+    {
+      e[i]->m_reqs -= TOKEN;
+    }
+  }
+
+  return 0;
+}
+
+/* body bytes the client may send now, SIZE_MAX without a byte rate */
+size_t limit_bytes(struct limits *l, const struct sockaddr_storage *sa)
+{
+  struct limit_entry *e[2];
+  size_t i, n = SIZE_MAX;
+
+  if (!l->m_table)
+  {
+    return n;
+  }
+  lookup(l, sa, 1, e);
+  for (i = 0; i < LEN(e); i++)
+  {
+    if (e[i] && rates(l, e[i])->m_bps)
+    {
+      n = MIN(n, e[i]->m_bytes > 0 ? (size_t)e[i]->m_bytes / TOKEN : 0);
+    }
+  }
+
+  return n;
+}
+
+/* bytes the client sent, whether or not limit_bytes allowed them */
+void limit_charge(struct limits *l, const struct sockaddr_storage *sa,
+                  size_t n)
+{
+  struct limit_entry *e[2];
+  size_t i;
+
+  if (!l->m_table || n == 0)
+  {
+    return;
+  }
+  lookup(l, sa, 0, e);
+  for (i = 0; i < LEN(e); i++)
+  {
+    if (e[i] && rates(l, e[i])->m_bps)
+    {
+      e[i]->m_bytes -= (int64_t)n * TOKEN;
+    }
+  }
+}
+
+/*
+ * Once per second frees the entries of clients without connections whose
+ * buckets have refilled: a fresh entry would look just the same.
+ */
+void limit_decay(struct limits *l)
+{
+  const struct limit_rates *r;
+  struct limit_entry *e;
+  uint64_t now;
+  size_t i;
+
+  if (!l->m_table || (now = metrics_now()) < l->m_decay_at)
+  {
+    return;
+  }
+  l->m_decay_at = now + WINDOW;
+
+  for (i = 0; i < LIMIT_TABLE; i++)
+  {
+    e = &l->m_table[i];
+    if (e->m_kind == LIMIT_FREE || e->m_conns > 0)
+    {
+      continue;
+    }
+    r = rates(l, e);
+    refill(e, r, now);
+    if (e->m_reqs == (int64_t)(r->m_rps * TOKEN) &&
+        e->m_bytes == (int64_t)(r->m_bps * TOKEN))
+    {
+      e->m_kind = LIMIT_FREE;
+    }
+  }
+}
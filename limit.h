@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/* what one client (an address, or a /24 or /64 prefix) may use, 0 is off */
+struct limit_rates
+{
+  size_t m_conns; /* connections open at once */
+  size_t m_rps;   /* requests per second */
+  size_t m_bps;   /* body bytes per second */
+};
+
+struct limit_config
+{
+  struct limit_rates m_ip;
+  struct limit_rates m_prefix;
+};
+
+enum limit_kind
+{
+  LIMIT_FREE,
+  LIMIT_IP,
+  LIMIT_PREFIX,
+};
+
+/*
+ * A client's token buckets, in millionths of a token so a refill is exact
+ * for every whole microsecond. Byte tokens may go into debt when a write
+ * couldn't be cut to the allowance, the debt is paid before the next one.
+ */
+struct limit_entry
+{
+  uint64_t m_key;
+  uint64_t m_stamp; /* refilled up to here */
+  uint32_t m_kind;
+  uint32_t m_conns;
+  int64_t m_reqs;
+  int64_t m_bytes;
+};
+
+/*
+ * Per-worker limits: an open-addressed table, every key probed within a
+ * small window so entries can be freed without tombstones. Buckets refill
+ * lazily when their client is seen, limit_decay frees the entries of
+ * clients gone idle. Without any limit set there is no table and every
+ * call is a no-op.
+ */
+struct limits
+{
+  struct limit_config m_cfg;
+  struct limit_entry *m_table;
+  uint64_t m_decay_at;
+};
+
+int limit_init(struct limits *, const struct limit_config *);
+int limit_connect(struct limits *, const struct sockaddr_storage *);
+void limit_adopt(struct limits *, const struct sockaddr_storage *);
+void limit_disconnect(struct limits *, const struct sockaddr_storage *);
+int limit_request(struct limits *, const struct sockaddr_storage *);
+size_t limit_bytes(struct limits *, const struct sockaddr_storage *);
+void limit_charge(struct limits *, const struct sockaddr_storage *, size_t);
+void limit_decay(struct limits *);
@@ -0,0 +1,249 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "configuration.h"
+#include "logger.h"
+#include "util.h"
+
+/*
+ * Single producer, single consumer. Positions run freely and are masked on
+ * access; the owning thread only moves m_head, the writer only m_tail.
+ */
+struct log_ring
+{
+  size_t m_head __attribute__((aligned(CACHE_LINE_SIZE)));
+  size_t m_dropped;
+  size_t m_tail __attribute__((aligned(CACHE_LINE_SIZE)));
+  size_t m_reported;
+  struct log_ring *m_next;
+  char m_data[LOG_RING_SIZE];
+};
+
+static struct log_ring *rings;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t drain_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct log_ring *own;
+
+static int log_fd = STDOUT_FILENO;
+static int dir_fd = -1;
+static char log_name[NAME_MAX + 1];
+static int reopen;
+
+/* the directory stays open so the file can be recreated after the chroot */
+static int open_log(const char *path)
+{
+  char dir[PATH_MAX];
+  const char *slash;
+
+  if (!(slash = strrchr(path, '/')))
+  {
+    slash = path - 1;
+    strcpy(dir, ".");
+  }
+  else if (esnprintf(dir, sizeof(dir), "%.*s", (int)(slash - path + 1), path))
+  {
+    return -1;
+  }
+  if (esnprintf(log_name, sizeof(log_name), "%s", slash + 1) ||
+      (dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+  {
+    return -1;
+  }
+
+  return openat(dir_fd, log_name, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                0644);
+}
+
+static void reopen_log(void)
+{
+  int fd;
+
+  if (dir_fd < 0)
+  {
+    return;
+  }
+  if ((fd = openat(dir_fd, log_name,
+                   O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644)) < 0)
+  {
+    log_warn("access log: can't reopen %s, keeping the old file:", log_name);
+    return;
+  }
+  close(log_fd);
+  log_fd = fd;
+}
+
+static void drain(struct log_ring *r)
+{
+  struct iovec iov[2];
+  size_t head, off, n;
+  ssize_t w;
+
+  head = __atomic_load_n(&r->m_head, __ATOMIC_ACQUIRE);
+  if ((n = head - r->m_tail) > 0)
+  {
+    off = r->m_tail & (LOG_RING_SIZE - 1);
+    iov[0].iov_base = r->m_data + off;
+    iov[0].iov_len = MIN(n, LOG_RING_SIZE - off);
+    iov[1].iov_base = r->m_data;
+    iov[1].iov_len = n - iov[0].iov_len;
+
+    // a broken log file loses lines instead of stalling the ring
+    w = writev(log_fd, iov, iov[1].iov_len ? 2 : 1);
+    __atomic_store_n(&r->m_tail, r->m_tail + (w > 0 ? (size_t)w : n),
+                     __ATOMIC_RELEASE);
+  }
+
+  n = COUNTER_GET(r->m_dropped);
+  if (n != r->m_reported)
+  {
+    log_warn("access log: %zu lines dropped", n - r->m_reported);
+    r->m_reported = n;
+  }
+}
+
+void logger_flush(void)
+{
+  struct log_ring *r;
+
+  // rings are only ever pushed at the head, the rest of the list is stable
+  pthread_mutex_lock(&rings_mutex);
+  r = rings;
+  pthread_mutex_unlock(&rings_mutex);
+
+  pthread_mutex_lock(&drain_mutex);
+  if (__atomic_exchange_n(&reopen, 0, __ATOMIC_ACQ_REL))
+  {
+    reopen_log();
+  }
+  for (; r; r = r->m_next)
+  {
+    drain(r);
+  }
+  pthread_mutex_unlock(&drain_mutex);
+}
+
+static void *writer(void *arg)
+{
+  struct timespec ts = {0, LOG_FLUSH_MS * 1000000L};
+
+  (void)arg;
+
+  for (;;)
+  {
+    logger_flush();
+    nanosleep(&ts, NULL);
+  }
+
+  return NULL;
+}
+
+int logger_init(const char *path)
+{
+  pthread_t thread;
+  sigset_t all, old;
+
+  if (path && (log_fd = open_log(path)) < 0)
+  {
+    log_warn("access log: can't open %s:", path);
+    return -1;
+  }
+
+  // signals belong to the main thread's sigwait
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  errno = pthread_create(&thread, NULL, writer, NULL);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  if (errno)
+  {
+    log_warn("pthread_create:");
+    return -1;
+  }
+  pthread_detach(thread);
+
+  return 0;
+}
+
+void logger_reopen(void)
+{
+  __atomic_store_n(&reopen, 1, __ATOMIC_RELEASE);
+}
+
+/* 1 for every LOG_SAMPLE-th call of a thread */
+int log_sample(void)
+{
+  static __thread size_t nth;
+
+  return nth++ % LOG_SAMPLE == 0;
+}
+
+static struct log_ring *own_ring(void)
+{
+  struct log_ring *r;
+
+  if (own)
+  {
+    return own;
+  }
+  if (posix_memalign((void **)&r, CACHE_LINE_SIZE, sizeof(*r)))
+  {
+    return NULL;
+  }
+  memset(r, 0, offsetof(struct log_ring, m_data));
+
+  pthread_mutex_lock(&rings_mutex);
+  r->m_next = rings;
+  rings = r;
+  pthread_mutex_unlock(&rings_mutex);
+
+  return own = r;
+}
+
+void log_access(const char *fmt, ...)
+{
+  struct log_ring *r;
+  char line[LOG_LINE_MAX];
+  size_t len, head, off, first;
+  va_list ap;
+  int n;
+
+  if (!(r = own_ring()))
+  {
+    return;
+  }
+
+  va_start(ap, fmt);
+  n = vsnprintf(line, sizeof(line), fmt, ap);
+  va_end(ap);
+  if (n <= 0)
+  {
+    return;
+  }
+  if ((len = n) >= sizeof(line))
+  {
+    len = sizeof(line) - 1;
+    line[len - 1] = '\n';
+  }
+
+  head = r->m_head;
+  if (len > LOG_RING_SIZE - (head - __atomic_load_n(&r->m_tail,
+                                                     __ATOMIC_ACQUIRE)))
+  {
+    COUNTER_ADD(r->m_dropped, 1);
+    return;
+  }
+  off = head & (LOG_RING_SIZE - 1);
+  first = MIN(len, LOG_RING_SIZE - off);
+  memcpy(r->m_data + off, line, first);
+  memcpy(r->m_data, line + first, len - first);
+  __atomic_store_n(&r->m_head, head + len, __ATOMIC_RELEASE);
+}
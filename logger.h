@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Access log. Every thread formats its lines into a ring of its own, a
+ * writer thread drains all rings every LOG_FLUSH_MS with one write per ring.
+ * When a ring is full the line is dropped and counted, a worker never waits
+ * for the disk.
+ */
+int logger_init(const char *);
+void logger_reopen(void);
+void logger_flush(void);
+int log_sample(void);
+void log_access(const char *, ...);
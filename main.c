@@ -15,43 +15,182 @@
 #include <unistd.h>
 #include <sched.h>
 
+#include "config.h"
+#include "http.h"
+#include "logger.h"
 #include "mysock.h"
+#include "pool.h"
 #include "srv.h"
+#include "tls.h"
 #include "util.h"
 #include <linux/sched.h>
 
+#define OPTSTRING "c:t:s:e:ao:"
+
+static const char *overload_str[] = {
+    [OVERLOAD_EVICT] = "evict",
+    [OVERLOAD_SHED] = "shed",
+    [OVERLOAD_BACKLOG] = "backlog",
+};
+
+static void usage(void)
+{
+  die("usage: sudo misha_server [-c config] [-t threads|auto] [-s slots] "
+      "[-e events] [-a] [-o key=value] [port run_as_user serve_dir]");
+}
+
+/*
+ * Descriptors at full capacity: stdio, the listeners and the access log; per
+ * worker its queue, three eventfds, a timer, a ring, the spare splice pipes
+ * and the accept backlog; per slot the socket, the body and a borrowed pipe
+ * pair; and what the offload pool holds while scanning directories.
+ */
+static void raise_nofile(const struct topology *t)
+{
+  struct rlimit rlim;
+  rlim_t want = 3 + 2 + 2 + OFFLOAD_THREADS +
+                t->m_threads * (6 + 2 * SPLICE_MAX_FREE + 4 * t->m_slots +
+                                (t->m_overload == OVERLOAD_BACKLOG
+                                     ? t->m_backlog
+                                     : 0));
+
+#ifndef EPOLLFL
+  if (want > FD_SETSIZE)
+  {
+    log_warn("select can't watch descriptors past %d, use fewer slots or "
+             "the epoll build",
+             FD_SETSIZE);
+  }
+#endif
+  if (getrlimit(RLIMIT_NOFILE, &rlim) < 0)
+  {
+    die("getrlimit:");
+  }
+  if (rlim.rlim_cur >= want)
+  {
+    return;
+  }
+  rlim.rlim_cur = want;
+  rlim.rlim_max = MAX(rlim.rlim_max, want);
+  if (setrlimit(RLIMIT_NOFILE, &rlim) == 0)
+  {
+    return;
+  }
+
+  // without CAP_SYS_RESOURCE the hard limit is as far as it goes
+  if (getrlimit(RLIMIT_NOFILE, &rlim) < 0)
+  {
+    die("getrlimit:");
+  }
+  rlim.rlim_cur = rlim.rlim_max;
+  if (setrlimit(RLIMIT_NOFILE, &rlim) < 0)
+  {
+    die("setrlimit:");
+  }
+  log_warn("RLIMIT_NOFILE is %llu, %llu needed for every slot to be usable",
+           (unsigned long long)rlim.rlim_cur, (unsigned long long)want);
+}
+
 int main(int argc, char **argv)
 {
   printf("Misha's webserver (re) started!\n");
   struct group *grp = NULL;
   struct passwd *pwd = NULL;
-  struct rlimit rlim;
+  struct config cfg;
   struct server srv = {
       .doc_idx = "index.html",
   };
-  size_t i;
-  int in_socket, status = 0;
+  int in_socket, tls_socket = -1, status = 0, ch, bad;
   const char *err;
-  char *tok[4];
+  char *p;
 
-  if (argc != 4)
+  config_defaults(&cfg);
+
+  // the file goes first so that flags override it wherever they stand
+  while ((ch = getopt(argc, argv, OPTSTRING)) != -1)
+  {
+    if (ch == '?')
+    {
+      usage();
+    }
+    if (ch == 'c' && config_load(&cfg, optarg))
+    {
+      die("config: errors in %s", optarg);
+    }
+  }
+  for (optind = 1; (ch = getopt(argc, argv, OPTSTRING)) != -1;)
   {
-    die("usage: sudo misha_server 8080 run_as_user ./path/to/serve/dir\n");
+    switch (ch)
+    {
+    case 't':
+      bad = config_set(&cfg, "threads", optarg);
+      break;
+    case 's':
+      bad = config_set(&cfg, "slots", optarg);
+      break;
+    case 'e':
+      bad = config_set(&cfg, "events", optarg);
+      break;
+    case 'a':
+      bad = config_set(&cfg, "pin", "1");
+      break;
+    case 'o':
+      if (!(p = strchr(optarg, '=')))
+      {
+        usage();
+      }
+      *p = '\0';
+      bad = config_set(&cfg, optarg, p + 1);
+      break;
+    default:
+      bad = 0;
+    }
+    if (bad)
+    {
+      die("bad value for -%c %s", ch, optarg);
+    }
+  }
+  if (argc - optind == 3)
+  {
+    cfg.m_port = argv[optind];
+    cfg.m_user = argv[optind + 1];
+    cfg.m_root = argv[optind + 2];
+  }
+  else if (argc != optind)
+  {
+    usage();
+  }
+  if ((err = config_check(&cfg)))
+  {
+    die("config: %s", err);
   }
 
-  srv.port = argv[1];
-  char *user = argv[2];
-  char *group = argv[2];
-
-  size_t nthreads = 8;
-  size_t nslots = 1;
-  char *servedir = argv[3];
+  if (cfg.m_topo.m_threads == 0)
+  {
+    cfg.m_topo.m_threads = config_cpus();
+  }
+  if (cfg.m_topo.m_events == 0)
+  {
+    cfg.m_topo.m_events = cfg.m_topo.m_slots;
+  }
+  pool_configure(cfg.m_header_buffer, cfg.m_bulk_buffer_min,
+                 cfg.m_bulk_buffer_max);
+  log_info("%zu workers%s, %zu slots and %zu events per wait each, %s when "
+           "full\n",
+           cfg.m_topo.m_threads, cfg.m_topo.m_pin ? " pinned" : "",
+           cfg.m_topo.m_slots, cfg.m_topo.m_events,
+           overload_str[cfg.m_topo.m_overload]);
 
-  srv.list_directories = 1;
-  srv.host = "0.0.0.0";
+  srv.port = (char *)cfg.m_port;
+  srv.host = (char *)cfg.m_host;
+  srv.list_directories = cfg.m_list_directories;
+  srv.pace = cfg.m_pace;
+  srv.npace = cfg.m_npace;
+  const char *user = cfg.m_user;
+  const char *group = cfg.m_user;
+  const char *servedir = cfg.m_root;
 
-  rlim.rlim_cur = rlim.rlim_max =
-      3 + nthreads + nthreads * nslots + 5 * nthreads;
+  raise_nofile(&cfg.m_topo);
 
   in_socket = create_socket(srv.host, srv.port);
   if (unblock_socket(in_socket))
@@ -59,6 +198,22 @@ int main(int argc, char **argv)
     return 1;
   }
 
+  // the certificate and key are read while the chroot doesn't hide them
+  if (cfg.m_tls_port)
+  {
+    if (tls_init(cfg.m_tls_cert, cfg.m_tls_key, cfg.m_ktls) < 0)
+    {
+      return 1;
+    }
+    tls_socket = create_socket(srv.host, cfg.m_tls_port);
+    if (unblock_socket(tls_socket))
+    {
+      return 1;
+    }
+    log_info("HTTPS on port %s, kTLS %s\n", cfg.m_tls_port,
+             cfg.m_ktls ? "where the kernel can" : "off");
+  }
+
   errno = 0;
   if (!user || !(pwd = getpwnam(user)))
   {
@@ -72,6 +227,12 @@ int main(int argc, char **argv)
         errno ? strerror(errno) : "Entry not found");
   }
 
+  // the log lives outside the chroot, open it while it can still be found
+  if (logger_init(ACCESS_LOG) < 0)
+  {
+    return 1;
+  }
+
   if (chdir(servedir) < 0)
   {
     die("chdir '%s':", servedir);
@@ -127,6 +288,10 @@ int main(int argc, char **argv)
     }
   }
 
-  init_thread_pool_for_server(in_socket, nthreads, nslots, &srv);
+  // a peer hanging up mid-transfer must not take the server down
+  signal(SIGPIPE, SIG_IGN);
+
+  init_canned_http();
+  init_thread_pool_for_server(in_socket, tls_socket, &cfg.m_topo, &srv);
   return status;
 }
@@ -0,0 +1,425 @@
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include "buffer.h"
+#include "configuration.h"
+#include "connection.h"
+#include "metrics.h"
+#include "pool.h"
+#include "util.h"
+
+static const struct
+{
+  enum status m_status;
+  const char *m_code;
+} metric_status[] = {
+    [METRIC_STATUS_OK] = {STATUS_OK, "200"},
+    [METRIC_STATUS_NOT_MODIFIED] = {STATUS_NOT_MODIFIED, "304"},
+    [METRIC_STATUS_FORBIDDEN] = {STATUS_FORBIDDEN, "403"},
+    [METRIC_STATUS_NOT_FOUND] = {STATUS_NOT_FOUND, "404"},
+    [METRIC_STATUS_METHOD_NOT_ALLOWED] = {STATUS_METHOD_NOT_ALLOWED, "405"},
+    [METRIC_STATUS_TOO_MANY_REQUESTS] = {STATUS_TOO_MANY_REQUESTS, "429"},
+    [METRIC_STATUS_INTERNAL_SERVER_ERROR] = {STATUS_INTERNAL_SERVER_ERROR,
+                                             "500"},
+};
+
+static const char *state_str[] = {
+    [CONN_VACANT] = "vacant",
+    [CONN_TLS_RECV] = "tls_recv",
+    [CONN_TLS_SEND] = "tls_send",
+    [CONN_RECV_HEADER] = "recv_header",
+    [CONN_RESPOND] = "respond",
+    [CONN_SEND_HEADER] = "send_header",
+    [CONN_SEND_BODY] = "send_body",
+    [CONN_H2_RECV] = "h2_recv",
+    [CONN_H2_SEND] = "h2_send",
+    [CONN_WAIT_ZC] = "wait_zc",
+    [CONN_WAIT_IO] = "wait_io",
+};
+
+static const char *phase_str[] = {
+    [PHASE_RECV] = "recv",       [PHASE_PARSE] = "parse",
+    [PHASE_RESOLVE] = "resolve", [PHASE_HEADER] = "header",
+    [PHASE_BODY] = "body",       [PHASE_TOTAL] = "total",
+};
+
+static const char *type_str[] = {
+    [RESTYPE_DIRLISTING] = "dirlisting",
+    [RESTYPE_ERROR] = "error",
+    [RESTYPE_FILE] = "file",
+    [RESTYPE_STATS] = "stats",
+};
+
+static const double quantile[] = {0.5, 0.99, 0.999};
+
+/* every worker's counters, so a scrape on any worker can sum them */
+static struct worker_metrics *workers;
+static pthread_mutex_t workers_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void metrics_init(struct worker_metrics *m, const struct conn_t *conn,
+                  size_t nslots)
+{
+  memset(m, 0, sizeof(*m));
+  m->m_conn = conn;
+  m->m_num_slots = nslots;
+
+  pthread_mutex_lock(&workers_mutex);
+  m->m_next = workers;
+  workers = m;
+  pthread_mutex_unlock(&workers_mutex);
+}
+
+void metrics_request(struct worker_metrics *m, enum status s)
+{
+  size_t i;
+
+  for (i = 0; i < NUM_METRIC_STATUSES; i++)
+  {
+    if (metric_status[i].m_status == s)
+    {
+      COUNTER_ADD(m->m_requests[i], 1);
+      return;
+    }
+  }
+}
+
+uint64_t metrics_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static size_t hist_index(uint64_t v)
+{
+  int k;
+
+  if (v < (1 << HIST_SUB_BITS))
+  {
+    return v;
+  }
+  if ((k = 63 - __builtin_clzll(v)) >= HIST_MAX_BITS)
+  {
+    return HIST_BUCKETS - 1;
+  }
+
+  return ((size_t)(k - HIST_SUB_BITS + 1) << HIST_SUB_BITS) |
+         ((v >> (k - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+/* lowest value that lands in bucket i */
+static uint64_t hist_value(size_t i)
+{
+  size_t hi = i >> HIST_SUB_BITS, lo = i & ((1 << HIST_SUB_BITS) - 1);
+
+  if (hi == 0)
+  {
+    return lo;
+  }
+
+  return (uint64_t)((1 << HIST_SUB_BITS) | lo) << (hi - 1);
+}
+
+void metrics_latency(struct worker_metrics *m, enum phase p, enum res_type t,
+                     uint64_t ns)
+{
+  struct latency_hist *h = &m->m_latency[p][t];
+  size_t i = hist_index(ns);
+
+  COUNTER_ADD(h->m_bucket[i], 1);
+  COUNTER_ADD(h->m_sum, ns);
+  COUNTER_ADD(h->m_count, 1);
+}
+
+/* one phase and type merged over all workers */
+static void hist_merge(struct latency_hist *sum, enum phase p, enum res_type t)
+{
+  const struct worker_metrics *m;
+  const struct latency_hist *h;
+  size_t i;
+
+  memset(sum, 0, sizeof(*sum));
+
+  pthread_mutex_lock(&workers_mutex);
+  for (m = workers; m; m = m->m_next)
+  {
+    h = &m->m_latency[p][t];
+    for (i = 0; i < HIST_BUCKETS; i++)
+    {
+      sum->m_bucket[i] += COUNTER_GET(h->m_bucket[i]);
+    }
+    sum->m_sum += COUNTER_GET(h->m_sum);
+  }
+  pthread_mutex_unlock(&workers_mutex);
+
+  // racing writers may have bumped a bucket after the count, trust buckets
+  for (i = 0; i < HIST_BUCKETS; i++)
+  {
+    sum->m_count += sum->m_bucket[i];
+  }
+}
+
+/* highest value of the bucket holding the q-th sample, like HdrHistogram */
+static uint64_t hist_quantile(const struct latency_hist *h, double q)
+{
+  uint64_t want = q * h->m_count, seen = 0;
+  size_t i;
+
+  for (i = 0; i < HIST_BUCKETS - 1; i++)
+  {
+    if ((seen += h->m_bucket[i]) > want)
+    {
+      break;
+    }
+  }
+
+  return hist_value(i + 1) - 1;
+}
+
+static int render_latency(struct my_buffer *buf)
+{
+  struct latency_hist h;
+  size_t p, t, i;
+  int err = 0;
+
+  for (p = 0; p < NUM_PHASES; p++)
+  {
+    for (t = 0; t < NUM_RES_TYPES; t++)
+    {
+      hist_merge(&h, p, t);
+      if (h.m_count == 0)
+      {
+        continue;
+      }
+      for (i = 0; i < LEN(quantile); i++)
+      {
+        err |= buffer_append(buf,
+                             "misha_phase_seconds{phase=\"%s\",type=\"%s\","
+                             "quantile=\"%g\"} %.9f\n",
+                             phase_str[p], type_str[t], quantile[i],
+                             hist_quantile(&h, quantile[i]) / 1e9);
+      }
+      err |= buffer_append(
+          buf,
+          "misha_phase_seconds_sum{phase=\"%s\",type=\"%s\"} %.9f\n"
+          "misha_phase_seconds_count{phase=\"%s\",type=\"%s\"} %llu\n",
+          phase_str[p], type_str[t], h.m_sum / 1e9, phase_str[p], type_str[t],
+          (unsigned long long)h.m_count);
+    }
+  }
+
+  return err;
+}
+
+/* the scalar counters of all workers, histograms are merged one at a time */
+struct metrics_sum
+{
+  size_t m_workers;
+  size_t m_num_slots;
+  size_t m_states[NUM_CONNECT_STATES];
+  size_t m_accepted;
+  size_t m_evicted;
+  size_t m_handoffs;
+  size_t m_shed;
+  size_t m_backlogged;
+  size_t m_limited;
+  size_t m_requests[NUM_METRIC_STATUSES];
+  size_t m_bytes_sent;
+  size_t m_yields;
+  size_t m_throttled;
+  size_t m_paced;
+  size_t m_tls_handshakes;
+  size_t m_ktls;
+  size_t m_h2_sessions;
+  size_t m_h2_streams;
+  size_t m_cold_hits;
+  size_t m_cold_misses;
+  size_t m_waits;
+  size_t m_events;
+};
+
+/* a snapshot of all workers, the slot states are racy reads of a gauge */
+static void metrics_sum(struct metrics_sum *sum)
+{
+  const struct worker_metrics *m;
+  size_t i;
+
+  memset(sum, 0, sizeof(*sum));
+
+  pthread_mutex_lock(&workers_mutex);
+  for (m = workers; m; m = m->m_next)
+  {
+    sum->m_accepted += COUNTER_GET(m->m_accepted);
+    sum->m_evicted += COUNTER_GET(m->m_evicted);
+    sum->m_handoffs += COUNTER_GET(m->m_handoffs);
+    sum->m_shed += COUNTER_GET(m->m_shed);
+    sum->m_backlogged += COUNTER_GET(m->m_backlogged);
+    sum->m_limited += COUNTER_GET(m->m_limited);
+    for (i = 0; i < NUM_METRIC_STATUSES; i++)
+    {
+      sum->m_requests[i] += COUNTER_GET(m->m_requests[i]);
+    }
+    sum->m_bytes_sent += COUNTER_GET(m->m_bytes_sent);
+    sum->m_yields += COUNTER_GET(m->m_yields);
+    sum->m_throttled += COUNTER_GET(m->m_throttled);
+    sum->m_paced += COUNTER_GET(m->m_paced);
+    sum->m_tls_handshakes += COUNTER_GET(m->m_tls_handshakes);
+    sum->m_ktls += COUNTER_GET(m->m_ktls);
+    sum->m_h2_sessions += COUNTER_GET(m->m_h2_sessions);
+    sum->m_h2_streams += COUNTER_GET(m->m_h2_streams);
+    sum->m_cold_hits += COUNTER_GET(m->m_cold_hits);
+    sum->m_cold_misses += COUNTER_GET(m->m_cold_misses);
+    sum->m_waits += COUNTER_GET(m->m_waits);
+    sum->m_events += COUNTER_GET(m->m_events);
+    sum->m_num_slots += m->m_num_slots;
+    for (i = 0; i < m->m_num_slots; i++)
+    {
+      sum->m_states[__atomic_load_n(&m->m_conn[i].m_state,
+                                    __ATOMIC_RELAXED)]++;
+    }
+    sum->m_workers++;
+  }
+  pthread_mutex_unlock(&workers_mutex);
+}
+
+#define METRIC(buf, name, type, help)                                         \
+  buffer_append(buf, "# HELP " name " " help "\n# TYPE " name " " type "\n")
+
+/* the whole exposition is rendered at once, the body fits a bulk buffer */
+enum status prepare_stats_buffer(const struct resp_t *res,
+                                 struct my_buffer *buf, size_t *progress)
+{
+  struct metrics_sum sum;
+  struct pool_stats pool[NUM_POOL_CLASSES];
+  size_t i;
+  int err = 0;
+
+  (void)res;
+
+  buffer_reset(buf);
+  if (*progress != 0)
+  {
+    return 0;
+  }
+  metrics_sum(&sum);
+  pool_get_stats(pool);
+
+  err |= METRIC(buf, "misha_workers", "gauge", "Worker threads.");
+  err |= buffer_append(buf, "misha_workers %zu\n", sum.m_workers);
+  err |= METRIC(buf, "misha_slots", "gauge", "Connection slots of all workers.");
+  err |= buffer_append(buf, "misha_slots %zu\n", sum.m_num_slots);
+  err |= METRIC(buf, "misha_connections", "gauge",
+                "Connection slots by state.");
+  for (i = 0; i < NUM_CONNECT_STATES; i++)
+  {
+    err |= buffer_append(buf, "misha_connections{state=\"%s\"} %zu\n",
+                         state_str[i], sum.m_states[i]);
+  }
+  err |= METRIC(buf, "misha_accepted_total", "counter",
+                "Connections accepted.");
+  err |= buffer_append(buf, "misha_accepted_total %zu\n", sum.m_accepted);
+  err |= METRIC(buf, "misha_evicted_total", "counter",
+                "Connections dropped to make room for a new one.");
+  err |= buffer_append(buf, "misha_evicted_total %zu\n", sum.m_evicted);
+  err |= METRIC(buf, "misha_handoffs_total", "counter",
+                "Connections handed to a less loaded worker.");
+  err |= buffer_append(buf, "misha_handoffs_total %zu\n", sum.m_handoffs);
+  err |= METRIC(buf, "misha_shed_total", "counter",
+                "Connections answered 503 because every slot was taken.");
+  err |= buffer_append(buf, "misha_shed_total %zu\n", sum.m_shed);
+  err |= METRIC(buf, "misha_backlogged_total", "counter",
+                "Connections that waited in a worker's backlog for a slot.");
+  err |= buffer_append(buf, "misha_backlogged_total %zu\n",
+                       sum.m_backlogged);
+  err |= METRIC(buf, "misha_limited_total", "counter",
+                "Connections answered 429 over their client's limit.");
+  err |= buffer_append(buf, "misha_limited_total %zu\n", sum.m_limited);
+  err |= METRIC(buf, "misha_requests_total", "counter",
+                "Responses by status code.");
+  for (i = 0; i < NUM_METRIC_STATUSES; i++)
+  {
+    err |= buffer_append(buf, "misha_requests_total{code=\"%s\"} %zu\n",
+                         metric_status[i].m_code, sum.m_requests[i]);
+  }
+  err |= METRIC(buf, "misha_sent_bytes_total", "counter",
+                "Header and body bytes written to clients.");
+  err |= buffer_append(buf, "misha_sent_bytes_total %zu\n", sum.m_bytes_sent);
+  err |= METRIC(buf, "misha_write_yields_total", "counter",
+                "Transfers that used up their write quota for a wakeup.");
+  err |= buffer_append(buf, "misha_write_yields_total %zu\n", sum.m_yields);
+  err |= METRIC(buf, "misha_throttled_total", "counter",
+                "Transfers put to sleep until their client's byte rate or "
+                "their pace allowed more.");
+  err |= buffer_append(buf, "misha_throttled_total %zu\n", sum.m_throttled);
+  err |= METRIC(buf, "misha_paced_total", "counter",
+                "File responses paced to the rate of a pacing rule.");
+  err |= buffer_append(buf, "misha_paced_total %zu\n", sum.m_paced);
+  err |= METRIC(buf, "misha_tls_handshakes_total", "counter",
+                "TLS handshakes completed.");
+  err |= buffer_append(buf, "misha_tls_handshakes_total %zu\n",
+                       sum.m_tls_handshakes);
+  err |= METRIC(buf, "misha_ktls_total", "counter",
+                "TLS connections whose sends the kernel encrypts.");
+  err |= buffer_append(buf, "misha_ktls_total %zu\n", sum.m_ktls);
+  err |= METRIC(buf, "misha_h2_sessions_total", "counter",
+                "Connections served as HTTP/2 with prior knowledge.");
+  err |= buffer_append(buf, "misha_h2_sessions_total %zu\n",
+                       sum.m_h2_sessions);
+  err |= METRIC(buf, "misha_h2_streams_total", "counter",
+                "HTTP/2 streams opened for a request.");
+  err |= buffer_append(buf, "misha_h2_streams_total %zu\n", sum.m_h2_streams);
+  err |= METRIC(buf, "misha_cold_cache_hits_total", "counter",
+                "Per-request state reused from a worker's free list.");
+  err |= buffer_append(buf, "misha_cold_cache_hits_total %zu\n",
+                       sum.m_cold_hits);
+  err |= METRIC(buf, "misha_cold_cache_misses_total", "counter",
+                "Per-request state that had to be allocated.");
+  err |= buffer_append(buf, "misha_cold_cache_misses_total %zu\n",
+                       sum.m_cold_misses);
+  err |= METRIC(buf, "misha_queue_waits_total", "counter",
+                "Returns from queue_wait.");
+  err |= buffer_append(buf, "misha_queue_waits_total %zu\n", sum.m_waits);
+  err |= METRIC(buf, "misha_queue_events_total", "counter",
+                "Events handed out by queue_wait.");
+  err |= buffer_append(buf, "misha_queue_events_total %zu\n", sum.m_events);
+  err |= METRIC(buf, "misha_pool_leases_total", "counter",
+                "Buffer leases by size class.");
+  for (i = 0; i < NUM_POOL_CLASSES; i++)
+  {
+    err |= buffer_append(buf, "misha_pool_leases_total{size=\"%zu\"} %zu\n",
+                         pool[i].m_size, pool[i].m_leases);
+  }
+  err |= METRIC(buf, "misha_pool_allocs_total", "counter",
+                "Buffer leases that missed the free list, by size class.");
+  for (i = 0; i < NUM_POOL_CLASSES; i++)
+  {
+    err |= buffer_append(buf, "misha_pool_allocs_total{size=\"%zu\"} %zu\n",
+                         pool[i].m_size, pool[i].m_allocs);
+  }
+  err |= METRIC(buf, "misha_pool_leaked_total", "counter",
+                "Buffers left to the kernel instead of reused, by size class.");
+  for (i = 0; i < NUM_POOL_CLASSES; i++)
+  {
+    err |= buffer_append(buf, "misha_pool_leaked_total{size=\"%zu\"} %zu\n",
+                         pool[i].m_size, pool[i].m_leaked);
+  }
+  err |= METRIC(buf, "misha_pool_in_use", "gauge",
+                "Leased buffers by size class.");
+  for (i = 0; i < NUM_POOL_CLASSES; i++)
+  {
+    err |= buffer_append(buf, "misha_pool_in_use{size=\"%zu\"} %zu\n",
+                         pool[i].m_size, pool[i].m_in_use);
+  }
+  err |= METRIC(buf, "misha_phase_seconds", "summary",
+                "Request lifecycle phases by response type.");
+  err |= render_latency(buf);
+  if (err)
+  {
+    return STATUS_INTERNAL_SERVER_ERROR;
+  }
+  (*progress)++;
+
+  return 0;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "configuration.h"
+#include "http.h"
+#include "util.h"
+
+struct conn_t;
+
+/* the statuses a response can end with, in the order they are exported */
+enum metric_status
+{
+  METRIC_STATUS_OK,
+  METRIC_STATUS_NOT_MODIFIED,
+  METRIC_STATUS_FORBIDDEN,
+  METRIC_STATUS_NOT_FOUND,
+  METRIC_STATUS_METHOD_NOT_ALLOWED,
+  METRIC_STATUS_TOO_MANY_REQUESTS,
+  METRIC_STATUS_INTERNAL_SERVER_ERROR,
+  NUM_METRIC_STATUSES,
+};
+
+/* where a request's time goes, in serve_con order */
+enum phase
+{
+  PHASE_RECV,    // first byte until the header is complete
+  PHASE_PARSE,   // parse_header_http
+  PHASE_RESOLVE, // prepare_resp_http on the offload pool, queueing included
+  PHASE_HEADER,  // header built and written, first body chunk with it
+  PHASE_BODY,    // rest of the body
+  PHASE_TOTAL,
+  NUM_PHASES,
+};
+
+/*
+ * Log-bucketed like HdrHistogram: values below 2^HIST_SUB_BITS ns are exact,
+ * every octave above is split into 2^HIST_SUB_BITS buckets (6% precision),
+ * and anything from 2^HIST_MAX_BITS ns (~69 s) on lands in the last one.
+ */
+#define HIST_SUB_BITS 4
+#define HIST_MAX_BITS 36
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+struct latency_hist
+{
+  uint64_t m_count;
+  uint64_t m_sum;
+  uint64_t m_bucket[HIST_BUCKETS];
+};
+
+/*
+ * Counters of one worker. Only the owning worker writes them (COUNTER_ADD),
+ * a scrape sums every worker's copy, and the padding keeps two workers from
+ * ever bouncing the same cache line.
+ */
+struct worker_metrics
+{
+  size_t m_accepted;
+  size_t m_evicted;
+  size_t m_handoffs;
+  size_t m_shed;
+  size_t m_backlogged;
+  size_t m_limited;
+  size_t m_requests[NUM_METRIC_STATUSES];
+  size_t m_bytes_sent;
+  size_t m_yields;
+  size_t m_throttled;
+  size_t m_paced;
+  size_t m_tls_handshakes;
+  size_t m_ktls;
+  size_t m_h2_sessions;
+  size_t m_h2_streams;
+  size_t m_cold_hits;
+  size_t m_cold_misses;
+  size_t m_waits;
+  size_t m_events;
+  struct latency_hist m_latency[NUM_PHASES][NUM_RES_TYPES];
+  const struct conn_t *m_conn;
+  size_t m_num_slots;
+  struct worker_metrics *m_next;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+void metrics_init(struct worker_metrics *, const struct conn_t *, size_t);
+void metrics_request(struct worker_metrics *, enum status);
+uint64_t metrics_now(void);
+void metrics_latency(struct worker_metrics *, enum phase, enum res_type,
+                     uint64_t);
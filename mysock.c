@@ -4,6 +4,7 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -165,6 +166,64 @@ int sockets_same_addr(const struct sockaddr_storage *sa1,
   }
 }
 
+static uint64_t fnv1a(const unsigned char *p, size_t len)
+{
+  uint64_t h = 14695981039346656037ULL;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+  {
+    h = (h ^ p[i]) * 1099511628211ULL;
+  }
+
+  return h;
+}
+
+/*
+ * Reduces the peer address to a single word. IPv4 addresses map to
+ * themselves and never collide. The rest is hashed with the family folded
+ * into the top bits, so two IPv6 or unix peers can share a key; that is
+ * rare and harmless, they are then merely counted as one client for
+ * eviction and the per-client limits.
+ */
+uint64_t get_socket_key(const struct sockaddr_storage *sa)
+{
+  const struct sockaddr_un *un;
+
+  switch (sa->ss_family)
+  {
+  case AF_INET:
+    return ((const struct sockaddr_in *)sa)->sin_addr.s_addr;
+  case AF_INET6:
+    return fnv1a(((const struct sockaddr_in6 *)sa)->sin6_addr.s6_addr, 16) |
+           (1ULL << 63);
+  default:
+    un = (const struct sockaddr_un *)sa;
+    return fnv1a((const unsigned char *)un->sun_path,
+                 strnlen(un->sun_path, sizeof(un->sun_path))) |
+           (1ULL << 62);
+  }
+}
+
+/*
+ * The peer's /24 (IPv4) or /64 (IPv6) network as a single word, the way
+ * get_socket_key reduces the address. 0 for peers without a network.
+ */
+uint64_t get_prefix_key(const struct sockaddr_storage *sa)
+{
+  switch (sa->ss_family)
+  {
+  case AF_INET:
+    return ((const struct sockaddr_in *)sa)->sin_addr.s_addr &
+           htonl(0xffffff00);
+  case AF_INET6:
+    return fnv1a(((const struct sockaddr_in6 *)sa)->sin6_addr.s6_addr, 8) |
+           (1ULL << 63);
+  default:
+    return 0;
+  }
+}
+
 void close_all_sockets()
 {
   int sockfd;
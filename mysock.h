@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 
@@ -10,4 +11,6 @@ int unblock_socket(int);
 int get_socket_inaddr(const struct sockaddr_storage *, char *, size_t);
 int sockets_same_addr(const struct sockaddr_storage *,
                       const struct sockaddr_storage *);
+uint64_t get_socket_key(const struct sockaddr_storage *);
+uint64_t get_prefix_key(const struct sockaddr_storage *);
 void close_all_sockets(void);
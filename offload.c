@@ -0,0 +1,133 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "offload.h"
+#include "util.h"
+
+static struct
+{
+  pthread_mutex_t m_lock;
+  pthread_cond_t m_cond;
+  struct offload_job *m_head;
+  struct offload_job *m_tail;
+} pending = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL};
+
+static void *offload_worker(void *arg)
+{
+  struct offload_job *job;
+  struct offload_done *done;
+
+  (void)arg;
+  for (;;)
+  {
+    pthread_mutex_lock(&pending.m_lock);
+    while (!(job = pending.m_head))
+    {
+      pthread_cond_wait(&pending.m_cond, &pending.m_lock);
+    }
+    if (!(pending.m_head = job->m_next))
+    {
+      pending.m_tail = NULL;
+    }
+    pthread_mutex_unlock(&pending.m_lock);
+
+    job->m_fn(job);
+
+    done = job->m_done;
+    pthread_mutex_lock(&done->m_lock);
+    job->m_next = done->m_head;
+    done->m_head = job;
+    pthread_mutex_unlock(&done->m_lock);
+
+    // the worker drains everything per wakeup, a failed bump only coalesces
+    if (write(done->m_eventfd, &(uint64_t){1}, sizeof(uint64_t)) < 0 &&
+        errno != EAGAIN)
+    {
+      log_warn("write:");
+    }
+  }
+
+  return NULL;
+}
+
+int offload_init(size_t nthreads)
+{
+  pthread_t thread;
+  size_t i;
+
+  for (i = 0; i < nthreads; i++)
+  {
+    if ((errno = pthread_create(&thread, NULL, offload_worker, NULL)))
+    {
+      log_warn("pthread_create:");
+      return -1;
+    }
+    pthread_detach(thread);
+  }
+
+  return 0;
+}
+
+int offload_done_init(struct offload_done *done)
+{
+  pthread_mutex_init(&done->m_lock, NULL);
+  done->m_head = NULL;
+  if ((done->m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+  {
+    log_warn("eventfd:");
+    return -1;
+  }
+
+  return 0;
+}
+
+void offload_submit(struct offload_job *job)
+{
+  job->m_next = NULL;
+
+  pthread_mutex_lock(&pending.m_lock);
+  if (pending.m_tail)
+  {
+    pending.m_tail->m_next = job;
+  }
+  else
+  {
+    pending.m_head = job;
+  }
+  pending.m_tail = job;
+  pthread_cond_signal(&pending.m_cond);
+  pthread_mutex_unlock(&pending.m_lock);
+}
+
+/*
+ * Takes every finished job in completion order. The counter is cleared
+ * before the list is taken, so a job finishing in between raises a fresh
+ * event instead of being missed.
+ */
+struct offload_job *offload_reap(struct offload_done *done)
+{
+  struct offload_job *job, *next, *list = NULL;
+  uint64_t cnt;
+
+  if (read(done->m_eventfd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+  {
+    log_warn("read:");
+  }
+
+  pthread_mutex_lock(&done->m_lock);
+  job = done->m_head;
+  done->m_head = NULL;
+  pthread_mutex_unlock(&done->m_lock);
+
+  for (; job; job = next)
+  {
+    next = job->m_next;
+    job->m_next = list;
+    list = job;
+  }
+
+  return list;
+}
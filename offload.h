@@ -0,0 +1,30 @@
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+
+/*
+ * Blocking filesystem work (stat, open, scandir, read) is run by a small
+ * pool of threads so that a slow disk only stalls the requests waiting on
+ * it. Each worker owns an offload_done; finished jobs are queued there and
+ * its eventfd, registered in the worker's event queue, is bumped.
+ */
+struct offload_done
+{
+  pthread_mutex_t m_lock;
+  struct offload_job *m_head;
+  int m_eventfd;
+};
+
+struct offload_job
+{
+  void (*m_fn)(struct offload_job *);
+  void *m_arg;
+  struct offload_done *m_done;
+  struct offload_job *m_next;
+};
+
+int offload_init(size_t);
+int offload_done_init(struct offload_done *);
+void offload_submit(struct offload_job *);
+struct offload_job *offload_reap(struct offload_done *);
@@ -0,0 +1,196 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "configuration.h"
+#include "pool.h"
+#include "util.h"
+
+/* set once by pool_configure() before any worker leases */
+static size_t class_size[] = {
+    [POOL_HEADER] = HEADER_BUFFER_SIZE,
+    [POOL_BULK_S] = BULK_BUFFER_MIN,
+    [POOL_BULK_M] = BULK_BUFFER_MAX / 4,
+    [POOL_BULK_L] = BULK_BUFFER_MAX,
+};
+
+void pool_configure(size_t header, size_t bulk_min, size_t bulk_max)
+{
+  class_size[POOL_HEADER] = header;
+  class_size[POOL_BULK_S] = bulk_min;
+  class_size[POOL_BULK_M] = bulk_max / 4;
+  class_size[POOL_BULK_L] = bulk_max;
+}
+
+size_t pool_size(enum pool_class c)
+{
+  return class_size[c];
+}
+
+/* every worker's pool, so statistics can be summed from any thread */
+static struct buf_pool *pools;
+static pthread_mutex_t pools_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void pool_init(struct buf_pool *p)
+{
+  size_t i;
+
+  memset(p, 0, sizeof(*p));
+  for (i = 0; i < NUM_POOL_CLASSES; i++)
+  {
+    p->m_class[i].m_stats.m_size = class_size[i];
+    p->m_class[i].m_max_free = MAX(POOL_MAX_FREE_BYTES / class_size[i], 1);
+  }
+
+  pthread_mutex_lock(&pools_mutex);
+  p->m_next = pools;
+  pools = p;
+  pthread_mutex_unlock(&pools_mutex);
+}
+
+int pool_lease(struct buf_pool *p, struct my_buffer *buf, size_t want)
+{
+  size_t i;
+  void *mem;
+
+  for (i = 0; i < NUM_POOL_CLASSES - 1 && class_size[i] < want; i++)
+    ;
+
+  if ((mem = p->m_class[i].m_free_list))
+  {
+    memcpy(&p->m_class[i].m_free_list, mem, sizeof(void *));
+    COUNTER_ADD(p->m_class[i].m_stats.m_free, -1);
+  }
+  else
+  {
+    if (posix_memalign(&mem, sysconf(_SC_PAGESIZE), class_size[i]))
+    {
+      log_warn("posix_memalign: can't lease %zu bytes", class_size[i]);
+      return 1;
+    }
+    COUNTER_ADD(p->m_class[i].m_stats.m_allocs, 1);
+  }
+  COUNTER_ADD(p->m_class[i].m_stats.m_in_use, 1);
+  COUNTER_ADD(p->m_class[i].m_stats.m_leases, 1);
+
+  buf->data = mem;
+  buf->size = class_size[i];
+  buffer_reset(buf);
+
+  return 0;
+}
+
+static size_t class_of(const struct my_buffer *buf)
+{
+  size_t i;
+
+  for (i = 0; i < NUM_POOL_CLASSES - 1 && class_size[i] != buf->size; i++)
+    ;
+
+  return i;
+}
+
+void pool_release(struct buf_pool *p, struct my_buffer *buf)
+{
+  size_t i;
+
+  if (buf->data == NULL)
+  {
+    return;
+  }
+
+  i = class_of(buf);
+  COUNTER_ADD(p->m_class[i].m_stats.m_in_use, -1);
+  if (p->m_class[i].m_stats.m_free < p->m_class[i].m_max_free)
+  {
+    memcpy(buf->data, &p->m_class[i].m_free_list, sizeof(void *));
+    p->m_class[i].m_free_list = buf->data;
+    COUNTER_ADD(p->m_class[i].m_stats.m_free, 1);
+  }
+  else
+  {
+    free(buf->data);
+  }
+
+  memset(buf, 0, sizeof(*buf));
+}
+
+/*
+ * Gives up a lease without taking the memory back, for a buffer the kernel
+ * may still read from. It stops counting as in use and counts as leaked.
+ */
+void pool_forget(struct buf_pool *p, struct my_buffer *buf)
+{
+  size_t i;
+
+  if (buf->data == NULL)
+  {
+    return;
+  }
+
+  i = class_of(buf);
+  COUNTER_ADD(p->m_class[i].m_stats.m_in_use, -1);
+  COUNTER_ADD(p->m_class[i].m_stats.m_leaked, 1);
+  memset(buf, 0, sizeof(*buf));
+}
+
+int pool_grow(struct buf_pool *p, struct my_buffer *buf, size_t want)
+{
+  struct my_buffer bigger;
+
+  if (pool_lease(p, &bigger, want))
+  {
+    return 1;
+  }
+  if (bigger.size <= buf->size)
+  {
+    pool_release(p, &bigger);
+    return 1;
+  }
+
+  memcpy(bigger.data, buf->data + buf->offset, buf->length - buf->offset);
+  bigger.length = buf->length - buf->offset;
+  pool_release(p, buf);
+  *buf = bigger;
+
+  return 0;
+}
+
+void pool_get_stats(struct pool_stats st[NUM_POOL_CLASSES])
+{
+  struct buf_pool *p;
+  size_t i;
+
+  memset(st, 0, NUM_POOL_CLASSES * sizeof(*st));
+
+  pthread_mutex_lock(&pools_mutex);
+  for (p = pools; p; p = p->m_next)
+  {
+    for (i = 0; i < NUM_POOL_CLASSES; i++)
+    {
+      st[i].m_size = class_size[i];
+      st[i].m_in_use += COUNTER_GET(p->m_class[i].m_stats.m_in_use);
+      st[i].m_free += COUNTER_GET(p->m_class[i].m_stats.m_free);
+      st[i].m_leases += COUNTER_GET(p->m_class[i].m_stats.m_leases);
+      st[i].m_allocs += COUNTER_GET(p->m_class[i].m_stats.m_allocs);
+      st[i].m_leaked += COUNTER_GET(p->m_class[i].m_stats.m_leaked);
+    }
+  }
+  pthread_mutex_unlock(&pools_mutex);
+}
+
+void log_pool_stats(void)
+{
+  struct pool_stats st[NUM_POOL_CLASSES];
+  size_t i;
+
+  pool_get_stats(st);
+  for (i = 0; i < NUM_POOL_CLASSES; i++)
+  {
+    log_info("pool %zu: in use %zu, free %zu, leases %zu, allocs %zu, "
+             "leaked %zu\n",
+             st[i].m_size, st[i].m_in_use, st[i].m_free, st[i].m_leases,
+             st[i].m_allocs, st[i].m_leaked);
+  }
+}
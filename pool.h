@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "util.h"
+
+enum pool_class
+{
+  POOL_HEADER,
+  POOL_BULK_S,
+  POOL_BULK_M,
+  POOL_BULK_L,
+  NUM_POOL_CLASSES,
+};
+
+struct pool_stats
+{
+  size_t m_size;
+  size_t m_in_use;
+  size_t m_free;
+  size_t m_leases;
+  size_t m_allocs;
+  size_t m_leaked;
+};
+
+struct buf_pool
+{
+  struct
+  {
+    void *m_free_list;
+    size_t m_max_free;
+    struct pool_stats m_stats;
+  } m_class[NUM_POOL_CLASSES];
+  struct buf_pool *m_next;
+};
+
+void pool_configure(size_t, size_t, size_t);
+size_t pool_size(enum pool_class);
+void pool_init(struct buf_pool *);
+int pool_lease(struct buf_pool *, struct my_buffer *, size_t);
+void pool_release(struct buf_pool *, struct my_buffer *);
+void pool_forget(struct buf_pool *, struct my_buffer *);
+int pool_grow(struct buf_pool *, struct my_buffer *, size_t);
+void pool_get_stats(struct pool_stats[NUM_POOL_CLASSES]);
+void log_pool_stats(void);
@@ -1,4 +1,5 @@
 #ifdef EPOLLFL
+#include <errno.h>
 #include <stddef.h>
 #include <stdio.h>
 
@@ -15,7 +16,7 @@ int queue_create(void)
 	{
 		warn("epoll_create1:");
 	}
-	log_info("Created queue %d\n", qfd);
+	log_debug("Created queue %d\n", qfd);
 
 	return qfd;
 }
@@ -48,12 +49,12 @@ int queue_add_fd(int qfd, int fd, enum queue_event_type t, int shared,
 	}
 	if (t == QUEUE_EVENT_IN)
 	{
-		log_info("Added fd %d to queue %d with data to %p to read \n", fd, qfd, data);
+		log_debug("Added fd %d to queue %d with data to %p to read \n", fd, qfd, data);
 	}
 
 	if (t == QUEUE_EVENT_OUT)
 	{
-		log_info("Added fd %d to queue %d with data to %p to write \n", fd, qfd, data);
+		log_debug("Added fd %d to queue %d with data to %p to write \n", fd, qfd, data);
 	}
 
 	e.data.ptr = (void *)data;
@@ -84,12 +85,12 @@ int queue_mod_fd(int qfd, int fd, enum queue_event_type t, const void *data)
 
 	if (t == QUEUE_EVENT_IN)
 	{
-		log_info("Modified fd %d to queue %d with data to %p to read \n", fd, qfd, data);
+		log_debug("Modified fd %d to queue %d with data to %p to read \n", fd, qfd, data);
 	}
 
 	if (t == QUEUE_EVENT_OUT)
 	{
-		log_info("Modified fd %d to queue %d with data to %p to write \n", fd, qfd, data);
+		log_debug("Modified fd %d to queue %d with data to %p to write \n", fd, qfd, data);
 	}
 
 	e.data.ptr = (void *)data;
@@ -105,7 +106,7 @@ int queue_mod_fd(int qfd, int fd, enum queue_event_type t, const void *data)
 int queue_rem_fd(int qfd, int fd)
 {
 	struct epoll_event e;
-	log_info("Removed fd: %d\n", fd);
+	log_debug("Removed fd: %d\n", fd);
 
 	if (epoll_ctl(qfd, EPOLL_CTL_DEL, fd, &e) < 0)
 	{
@@ -122,6 +123,11 @@ queue_wait(int qfd, queue_event *e, size_t elen)
 
 	if ((nready = epoll_wait(qfd, e, elen, -1)) < 0)
 	{
+		/* io_uring completions run as task work and interrupt the wait */
+		if (errno == EINTR)
+		{
+			return 0;
+		}
 		warn("epoll_wait:");
 		return -1;
 	}
@@ -132,7 +138,7 @@ void *
 queue_event_get_data(const queue_event *e)
 {
 
-	log_info("Getting event data for %d fd got %p\n", e->data.fd, e->data.ptr);
+	log_debug("Getting event data for %d fd got %p\n", e->data.fd, e->data.ptr);
 	return e->data.ptr;
 }
 
@@ -1,4 +1,5 @@
 #include "queue.h"
+#include "util.h"
 #include <sys/select.h>
 #include <pthread.h>
 #include <assert.h>
@@ -73,7 +74,7 @@ int queue_create(void)
         new_queue_index = num_queues;
         num_queues++;
 
-        log_info("Created queue %d\n", new_queue_index);
+        log_debug("Created queue %d\n", new_queue_index);
     }
 
     pthread_mutex_unlock(&num_queues_mutex);
@@ -126,12 +127,12 @@ int queue_add_fd(int qfd, int fd, enum queue_event_type type, int shared, const
 
     if (type == QUEUE_EVENT_IN)
     {
-        log_info("Added fd %d to queue %d with data to %p (%d) to read \n", fd, qfd, fd_array[qfd][num_fds[qfd] - 1].data, data);
+        log_debug("Added fd %d to queue %d with data to %p (%d) to read \n", fd, qfd, fd_array[qfd][num_fds[qfd] - 1].data, data);
     }
 
     if (type == QUEUE_EVENT_OUT)
     {
-        log_info("Added fd %d to queue %d with data to %p to write \n", fd, qfd, fd_array[qfd][num_fds[qfd] - 1].data);
+        log_debug("Added fd %d to queue %d with data to %p to write \n", fd, qfd, fd_array[qfd][num_fds[qfd] - 1].data);
     }
 
     return 0;
@@ -151,22 +152,16 @@ int queue_mod_fd(int qfd, int fd, enum queue_event_type type, const void *data)
 
     if (type == QUEUE_EVENT_IN)
     {
-        if (!FD_ISSET(fd, &writefds[qfd]))
-        {
-            FD_SET(fd, &readfds[qfd]);
-            FD_CLR(fd, &writefds[qfd]);
-        }
-        log_info("Modified fd %d to queue %d with data to %p to read \n", fd, qfd, data);
+        FD_SET(fd, &readfds[qfd]);
+        FD_CLR(fd, &writefds[qfd]);
+        log_debug("Modified fd %d to queue %d with data to %p to read \n", fd, qfd, data);
     }
 
     if (type == QUEUE_EVENT_OUT)
     {
-        if (!FD_ISSET(fd, &writefds[qfd]))
-        {
-            FD_SET(fd, &writefds[qfd]);
-            FD_CLR(fd, &readfds[qfd]);
-        }
-        log_info("Modified fd %d to queue %d with data to %p to write \n", fd, qfd, data);
+        FD_SET(fd, &writefds[qfd]);
+        FD_CLR(fd, &readfds[qfd]);
+        log_debug("Modified fd %d to queue %d with data to %p to write \n", fd, qfd, data);
     }
 
     int exact_found = 0;
@@ -184,13 +179,13 @@ int queue_mod_fd(int qfd, int fd, enum queue_event_type type, const void *data)
 
     assert(isFdOpen(fd));
 
-    log_info("Modified\n");
+    log_debug("Modified\n");
     return 0;
 }
 
 int queue_rem_fd(int qfd, int fd)
 {
-    log_info("Called to remove fd %d from queue %d\n", fd, qfd);
+    log_debug("Called to remove fd %d from queue %d\n", fd, qfd);
     if (primary_fds[qfd] == fd) {
         return -1;
     }
@@ -214,33 +209,35 @@ int queue_rem_fd(int qfd, int fd)
         FD_CLR(fd, &writefds[qfd]);
     }
 
-    log_info("Going to remove fd %d from queue %d\n", fd, qfd);
+    log_debug("Going to remove fd %d from queue %d\n", fd, qfd);
 
     // You may also remove the associated data, but in this example, we keep it intact.
 
-    // Shift the remaining file descriptors to maintain a compact array (optional).
+    // Move the last entry into the hole to keep the array compact
     for (int i = 0; i < num_fds[qfd]; i++)
     {
         if (fd_array[qfd][i].fd == fd)
         {
-            memset(&fd_array[qfd][i], sizeof(file_desc_info), 0);
+            fd_array[qfd][i] = fd_array[qfd][num_fds[qfd] - 1];
+            memset(&fd_array[qfd][num_fds[qfd] - 1], 0, sizeof(file_desc_info));
+            num_fds[qfd]--;
+            break;
         }
     }
 
-    log_info("Removed fd %d from queue %d\n", fd, qfd);
-    num_fds[qfd]--; // Watchme!
+    log_debug("Removed fd %d from queue %d\n", fd, qfd);
 
     return 0;
 }
 
 void log_fd_set(const fd_set *set, int q)
 {
-    log_info("File Descriptors in the Set for q %d: ", q);
+    log_debug("File Descriptors in the Set for q %d: ", q);
     for (int fd = 0; fd < FD_SETSIZE; fd++)
     {
         if (FD_ISSET(fd, set))
         {
-            log_info("%d ", fd);
+            log_debug("%d ", fd);
         }
     }
 }
@@ -336,14 +333,14 @@ void remove_closed_fds(int q)
 
 void *queue_event_get_data(const queue_event *event)
 {
-    log_info("Getting event data for fd %d from queue %d\n", event->fd, event->queue_id);
+    log_debug("Getting event data for fd %d from queue %d\n", event->fd, event->queue_id);
     // print_fdarray(event->queue_id);
     int q = event->queue_id;
     for (int i = 0; i < num_fds[q]; i++)
     {
         if (fd_array[q][i].fd == event->fd && fd_array[q][i].type == event->events)
         {
-            log_info("Getting event data for fd %d got %p\n", event->fd, fd_array[q][i].data);
+            log_debug("Getting event data for fd %d got %p\n", event->fd, fd_array[q][i].data);
             void *data = fd_array[q][i].data;
             return data;
         }
@@ -363,7 +360,7 @@ int queue_event_is_error(const queue_event *event)
         return is_error = 1;
     }
 
-    log_info("Is error call: %d\n", is_error);
+    log_debug("Is error call: %d\n", is_error);
 
     return is_error;
 }
\ No newline at end of file
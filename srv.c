@@ -1,47 +1,336 @@
+#define _GNU_SOURCE /* pthread_setaffinity_np */
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "connection.h"
+#include "handoff.h"
+#include "limit.h"
+#include "logger.h"
+#include "metrics.h"
+#include "offload.h"
+#include "pool.h"
 #include "queue.h"
 #include "srv.h"
+#include "uring.h"
 #include "util.h"
 
-struct data_for_worker
+/* puts a connection back into the queue for whatever it waits on next */
+static void
+rearm_con(int queue_fd, struct conn_t *c, int cfd, int queued,
+		  struct data_for_worker *d)
 {
-	int m_in_socket;
-	size_t m_num_slots;
-	const struct server *m_serv;
-};
+	enum queue_event_type t;
+	int ret;
+
+	if (c->m_file_descriptor == 0)
+	{
+		if (queued)
+		{
+			queue_rem_fd(queue_fd, cfd);
+			memset(c, 0, sizeof(struct conn_t));
+		}
+		return;
+	}
+
+	switch (c->m_state)
+	{
+	case CONN_TLS_RECV:
+	case CONN_RECV_HEADER:
+	case CONN_H2_RECV:
+	case CONN_WAIT_ZC:
+		/* only the error queue matters, POLLERR is reported regardless */
+		t = QUEUE_EVENT_IN;
+		break;
+	case CONN_TLS_SEND:
+	case CONN_SEND_HEADER:
+	case CONN_SEND_BODY:
+	case CONN_H2_SEND:
+		t = QUEUE_EVENT_OUT;
+		break;
+	case CONN_WAIT_IO:
+		/* parked on the offload pool, socket readiness is of no use yet */
+		if (queued)
+		{
+			queue_rem_fd(queue_fd, cfd);
+		}
+		return;
+	default:
+		return;
+	}
+
+	if (queued)
+	{
+		ret = queue_mod_fd(queue_fd, cfd, t, c);
+	}
+	else
+	{
+		ret = queue_add_fd(queue_fd, cfd, t, 0, c, 0);
+	}
+	if (ret < 0)
+	{
+		reset_con(c, d);
+		if (queued)
+		{
+			queue_rem_fd(queue_fd, cfd);
+		}
+	}
+}
+
+/*
+ * Serves c and puts it back in the queue. A response that just ended with
+ * the connection going idle is a request boundary: an overloaded worker
+ * hands the connection to a sibling there instead.
+ */
+static void
+step_con(int queue_fd, struct conn_t *c, int queued, struct data_for_worker *d)
+{
+	enum conn_state_t was = c->m_state;
+	struct data_for_worker *to;
+	int cfd = c->m_file_descriptor;
+
+	serve_con(c, d);
+	if (was != CONN_RECV_HEADER && c->m_state == CONN_RECV_HEADER &&
+		c->m_cold == NULL && (to = handoff_target(d)))
+	{
+		if (queued)
+		{
+			queue_rem_fd(queue_fd, cfd);
+		}
+		handoff_con(c, d, to);
+		return;
+	}
+	rearm_con(queue_fd, c, cfd, queued, d);
+}
+
+/*
+ * The eventfds, the timer and the TLS listener a worker watches carry their
+ * owner, the plain listener NULL.
+ */
+static int
+is_con(const void *c, const struct data_for_worker *d)
+{
+	return c != NULL && c != (void *)&d->m_done && c != (void *)&d->m_ring &&
+		   c != (void *)&d->m_handoff && c != (void *)&d->m_tick &&
+		   c != (void *)&d->m_tls_socket;
+}
+
+/* one event of queue_wait, for a connection or one of the worker's eventfds */
+static void
+dispatch(int queue_fd, const queue_event *e, struct data_for_worker *d)
+{
+	struct offload_job *job, *next;
+	struct handoff *h, *hnext;
+	struct conn_cold *cold, *cnext;
+	struct data_for_worker *to;
+	struct conn_t *c, *newc;
+	void *ud;
+	int res;
+
+	c = queue_event_get_data(e);
+
+	/* a parked connection is off the queue, its event is stale */
+	if (is_con(c, d) && c->m_state == CONN_WAIT_IO)
+	{
+		return;
+	}
+
+	if (queue_event_is_error(e))
+	{
+		/* zerocopy completions arrive through the error queue */
+		if (is_con(c, d) && zerocopy_pending_con(c))
+		{
+			step_con(queue_fd, c, 1, d);
+			return;
+		}
+		if (is_con(c, d))
+		{
+			queue_rem_fd(queue_fd, c->m_file_descriptor);
+			drop_con(c, d);
+		}
+
+		return;
+	}
+
+	if (c == (void *)&d->m_done)
+	{
+		/*
+		 * the offload pool finished jobs for parked connections, or for
+		 * streams of HTTP/2 ones, which never left the queue
+		 */
+		for (job = offload_reap(&d->m_done); job; job = next)
+		{
+			next = job->m_next;
+			if ((c = job_done_con(job, d)))
+			{
+				step_con(queue_fd, c, c->m_state != CONN_WAIT_IO, d);
+			}
+		}
+
+		return;
+	}
+
+	if (c == (void *)&d->m_ring)
+	{
+		uring_ack(&d->m_ring);
+		while (uring_reap(&d->m_ring, &ud, &res))
+		{
+			if ((c = read_done_con(ud, res, d)))
+			{
+				step_con(queue_fd, c, 0, d);
+			}
+		}
+
+		return;
+	}
+
+	if (c == (void *)&d->m_tick)
+	{
+		/* throttled transfers try again, out of tokens they sleep anew */
+		for (cold = wake_cons(d); cold; cold = cnext)
+		{
+			cnext = cold->m_next;
+			step_con(queue_fd, cold->m_conn, 0, d);
+		}
+
+		return;
+	}
+
+	if (c == (void *)&d->m_handoff)
+	{
+		/* connections a busier sibling moved here */
+		for (h = handoff_pop(&d->m_handoff); h; h = hnext)
+		{
+			hnext = h->m_next;
+			if ((newc = adopt_con(h, d)) &&
+				queue_add_fd(queue_fd, newc->m_file_descriptor,
+							 QUEUE_EVENT_IN, 0, newc, 0) < 0)
+			{
+				reset_con(newc, d);
+			}
+		}
+
+		return;
+	}
+
+	if (c == NULL || c == (void *)&d->m_tls_socket)
+	{
+
+		if (!(newc = accept_con(d, c != NULL)))
+		{
+			return;
+		}
+		if ((to = handoff_target(d)))
+		{
+			handoff_con(newc, d, to);
+			return;
+		}
+
+		if (queue_add_fd(queue_fd, newc->m_file_descriptor,
+						 QUEUE_EVENT_IN,
+						 0, newc, 0) < 0)
+		{
+
+			return;
+		}
+	}
+	else
+	{
+		step_con(queue_fd, c, 1, d);
+	}
+
+}
 
 static void *
 create_worker(void *data)
 {
 	queue_event *event = NULL;
-	struct conn_t *connection, *c, *newc;
+	struct conn_t *c;
 	struct data_for_worker *d = (struct data_for_worker *)data;
 	int queue_fd;
 	ssize_t nready;
-	size_t i;
+	size_t i, depth, nlater;
+	cpu_set_t cpu;
 
-	if (!(connection = calloc(d->m_num_slots, sizeof(*connection))))
+	/* before the first allocation, so the worker's memory is local to it */
+	if (d->m_cpu >= 0)
+	{
+		CPU_ZERO(&cpu);
+		CPU_SET(d->m_cpu, &cpu);
+		if ((errno = pthread_setaffinity_np(pthread_self(), sizeof(cpu), &cpu)))
+		{
+			log_warn("pthread_setaffinity_np: cpu %d:", d->m_cpu);
+		}
+	}
+
+	/* hot slots are scanned on every event, keep each on its own line */
+	if ((errno = posix_memalign((void **)&d->m_conn, CACHE_LINE_SIZE,
+								d->m_num_slots * sizeof(*d->m_conn))))
+	{
+		die("posix_memalign:");
+	}
+	memset(d->m_conn, 0, d->m_num_slots * sizeof(*d->m_conn));
+	if (!(d->m_peer = calloc(d->m_num_slots, sizeof(*d->m_peer))))
 	{
 		die("calloc:");
 	}
+	d->m_cold_free = NULL;
+	d->m_cold_nfree = 0;
+	d->m_npipes = 0;
+	pool_init(&d->m_pool);
+	metrics_init(&d->m_metrics, d->m_conn, d->m_num_slots);
 
 	if ((queue_fd = queue_create()) < 0)
 	{
 		exit(1);
 	}
+	d->m_queue_fd = queue_fd;
 
 	if (queue_add_fd(queue_fd, d->m_in_socket, QUEUE_EVENT_IN, 1, NULL, 1) < 0)
 	{
 		exit(1);
 	}
 
-	if (!(event = realloc_array(event, d->m_num_slots, sizeof(*event))))
+	if (d->m_tls_socket >= 0 &&
+		queue_add_fd(queue_fd, d->m_tls_socket, QUEUE_EVENT_IN, 1,
+					 &d->m_tls_socket, 0) < 0)
+	{
+		exit(1);
+	}
+
+	if (offload_done_init(&d->m_done) < 0 ||
+		queue_add_fd(queue_fd, d->m_done.m_eventfd, QUEUE_EVENT_IN, 0,
+					 &d->m_done, 0) < 0)
+	{
+		exit(1);
+	}
+
+	if (queue_add_fd(queue_fd, d->m_handoff.m_eventfd, QUEUE_EVENT_IN, 0,
+					 &d->m_handoff, 0) < 0)
+	{
+		exit(1);
+	}
+
+	if (tick_init(&d->m_tick) < 0 ||
+		queue_add_fd(queue_fd, d->m_tick.m_fd, QUEUE_EVENT_IN, 0, &d->m_tick,
+					 0) < 0)
+	{
+		exit(1);
+	}
+
+	/* without a ring buffered file reads go through the offload pool */
+	if (uring_init(&d->m_ring, MIN(d->m_num_slots, URING_MAX_ENTRIES)) == 0 &&
+		queue_add_fd(queue_fd, d->m_ring.m_eventfd, QUEUE_EVENT_IN, 0,
+					 &d->m_ring, 0) < 0)
+	{
+		exit(1);
+	}
+
+	if (!(event = realloc_array(event, d->m_num_events, sizeof(*event))))
 	{
 		die("reallocarray:");
 	}
@@ -49,118 +338,144 @@ create_worker(void *data)
 	for (;;)
 	{
 
-		if ((nready = queue_wait(queue_fd, event, d->m_num_slots)) < 0)
+		if ((nready = queue_wait(queue_fd, event, d->m_num_events)) < 0)
 		{
 			exit(1);
 		}
+		COUNTER_ADD(d->m_metrics.m_waits, 1);
+		COUNTER_ADD(d->m_metrics.m_events, (size_t)nready);
+		/* a moving average, one busy wakeup shouldn't shed connections */
+		depth = d->m_load.m_depth;
+		COUNTER_SET(d->m_load.m_depth, depth - (depth >> LOAD_SHIFT) + nready);
 
-		for (i = 0; i < (size_t)nready; i++)
+		/*
+		 * Bulk transfers go last, behind new requests and short responses,
+		 * and each only gets its quota; the batch is compacted in place.
+		 */
+		for (i = 0, nlater = 0; i < (size_t)nready; i++)
 		{
 			c = queue_event_get_data(&event[i]);
-
-			if (queue_event_is_error(&event[i]))
+			if (is_con(c, d) && !queue_event_is_error(&event[i]) &&
+				bulk_con(c))
 			{
-				if (c != NULL)
-				{
-					queue_rem_fd(queue_fd, c->m_file_descriptor);
-					c->m_resp.m_status = 0;
-					log_con(c);
-					reset_con(c);
-				}
-
+				event[nlater++] = event[i];
 				continue;
 			}
-
-			if (c == NULL)
+			dispatch(queue_fd, &event[i], d);
+		}
+		for (i = 0; i < nlater; i++)
+		{
+			/* unless an accept above evicted it meanwhile */
+			if (bulk_con(queue_event_get_data(&event[i])))
 			{
-
-				if (!(newc = accept_con(d->m_in_socket,
-										connection,
-										d->m_num_slots)))
-				{
-					continue;
-				}
-
-				if (queue_add_fd(queue_fd, newc->m_file_descriptor,
-								 QUEUE_EVENT_IN,
-								 0, newc, 0) < 0)
-				{
-
-					continue;
-				}
+				dispatch(queue_fd, &event[i], d);
 			}
-			else
-			{
+		}
 
-				int cfd = c->m_file_descriptor;
-
-				serve_con(c, d->m_serv);
-
-				if (c->m_file_descriptor == 0)
-				{
-
-					queue_rem_fd(queue_fd, cfd);
-					memset(c, 0, sizeof(struct conn_t));
-					continue;
-				}
-
-				switch (c->m_state)
-				{
-				case CONN_RECV_HEADER:
-					if (queue_mod_fd(queue_fd, c->m_file_descriptor,
-									 QUEUE_EVENT_IN,
-									 c) < 0)
-					{
-						reset_con(c);
-						queue_rem_fd(queue_fd, cfd);
-						break;
-					}
-					break;
-				case CONN_SEND_HEADER:
-				case CONN_SEND_BODY:
-					if (queue_mod_fd(queue_fd, c->m_file_descriptor,
-									 QUEUE_EVENT_OUT,
-									 c) < 0)
-					{
-
-						int fd = c->m_file_descriptor;
-						reset_con(c);
-						queue_rem_fd(queue_fd, cfd);
-						break;
-					}
-					break;
-				default:
-					break;
-				}
+		/* slots this batch freed go to connections waiting in the backlog */
+		while ((c = admit_con(d)))
+		{
+			if (queue_add_fd(queue_fd, c->m_file_descriptor, QUEUE_EVENT_IN, 0,
+							 c, 0) < 0)
+			{
+				reset_con(c, d);
 			}
 		}
+		limit_decay(&d->m_limits);
 	}
 
 	return NULL;
 }
 
-void init_thread_pool_for_server(int in_socket, size_t nthreads, size_t nslots,
+/* the n-th CPU we may run on, wrapping around */
+static int
+nth_cpu(const cpu_set_t *set, size_t n)
+{
+	int cpu;
+
+	n %= CPU_COUNT(set);
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if (CPU_ISSET(cpu, set) && n-- == 0)
+		{
+			return cpu;
+		}
+	}
+
+	return -1;
+}
+
+void init_thread_pool_for_server(int in_socket, int tls_socket,
+								 const struct topology *topo,
 								 const struct server *srv)
 {
 	pthread_t *thread = NULL;
 	struct data_for_worker *d = NULL;
+	size_t nthreads = topo->m_threads;
+	cpu_set_t cpus;
+	sigset_t set;
 	size_t i;
+	int sig;
 
-	if (!(d = realloc_array(d, nthreads, sizeof(*d))))
+	if (topo->m_pin && sched_getaffinity(0, sizeof(cpus), &cpus) < 0)
 	{
-		die("reallocarray:");
+		die("sched_getaffinity:");
+	}
+
+	/* each worker's counters must start on a line of their own */
+	if ((errno = posix_memalign((void **)&d, CACHE_LINE_SIZE,
+								nthreads * sizeof(*d))))
+	{
+		die("posix_memalign:");
 	}
 	for (i = 0; i < nthreads; i++)
 	{
 		d[i].m_in_socket = in_socket;
-		d[i].m_num_slots = nslots;
+		d[i].m_tls_socket = tls_socket;
+		d[i].m_num_slots = topo->m_slots;
+		d[i].m_num_events = topo->m_events;
+		d[i].m_cpu = topo->m_pin ? nth_cpu(&cpus, i) : -1;
 		d[i].m_serv = srv;
+		d[i].m_workers = d;
+		d[i].m_num_workers = nthreads;
+		d[i].m_handoff_at = 0;
+		d[i].m_overload = topo->m_overload;
+		d[i].m_backlog = d[i].m_backlog_tail = NULL;
+		d[i].m_nbacklog = 0;
+		d[i].m_backlog_max = topo->m_backlog;
+		memset(&d[i].m_load, 0, sizeof(d[i].m_load));
+		/* before any worker runs, siblings push from their first accept */
+		if (handoff_init(&d[i].m_handoff) < 0)
+		{
+			die("handoff_init:");
+		}
+		if (limit_init(&d[i].m_limits, &topo->m_limits) < 0)
+		{
+			die("limit_init:");
+		}
+	}
+
+	if (offload_init(OFFLOAD_THREADS) < 0)
+	{
+		die("offload_init:");
 	}
 
 	if (!(thread = realloc_array(thread, nthreads, sizeof(*thread))))
 	{
 		die("reallocarray:");
 	}
+
+	/* workers inherit the mask, signals are only ever taken by sigwait below */
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	sigaddset(&set, SIGHUP);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	if ((errno = pthread_sigmask(SIG_BLOCK, &set, NULL)))
+	{
+		die("pthread_sigmask:");
+	}
+
 	for (i = 0; i < nthreads; i++)
 	{
 		if (pthread_create(&thread[i], NULL, create_worker, &d[i]) != 0)
@@ -179,11 +494,26 @@ void init_thread_pool_for_server(int in_socket, size_t nthreads, size_t nslots,
 		}
 	}
 
-	for (i = 0; i < nthreads; i++)
+	// workers never return, the main thread reports statistics on demand
+	for (;;)
 	{
-		if ((errno = pthread_join(thread[i], NULL)))
+		if (sigwait(&set, &sig) != 0)
+		{
+			continue;
+		}
+		if (sig == SIGUSR1)
+		{
+			log_pool_stats();
+		}
+		else if (sig == SIGHUP)
+		{
+			logger_reopen();
+		}
+		else
 		{
-			log_warn("pthread_join:");
+			/* whatever the writer hasn't picked up yet goes out first */
+			logger_flush();
+			exit(0);
 		}
 	}
 }
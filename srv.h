@@ -3,6 +3,15 @@
 #include <regex.h>
 #include <stddef.h>
 
+#include "limit.h"
+
+/* body bytes per second for large file responses that match */
+struct pace_rule
+{
+	const char *m_match; /* a path prefix if it starts with /, else a MIME one */
+	size_t m_rate;
+};
+
 struct server
 {
 	size_t map_len;
@@ -10,6 +19,29 @@ struct server
 	char *host;
 	char *doc_idx;
 	int list_directories;
+	const struct pace_rule *pace; /* the first match applies */
+	size_t npace;
+};
+
+/* what a worker does with a new connection when every slot is taken */
+enum overload_policy
+{
+	OVERLOAD_EVICT,   /* drop the least advanced connection of the busiest peer */
+	OVERLOAD_SHED,    /* answer 503 with Retry-After and close */
+	OVERLOAD_BACKLOG, /* hold up to m_backlog until a slot frees, then shed */
+};
+
+/* how connections are spread: workers, slots each and events per wait */
+struct topology
+{
+	size_t m_threads;
+	size_t m_slots;
+	size_t m_events;
+	int m_pin;
+	enum overload_policy m_overload;
+	size_t m_backlog;
+	struct limit_config m_limits; /* enforced by each worker on its own */
 };
 
-void init_thread_pool_for_server(int, size_t, size_t, const struct server *);
+void init_thread_pool_for_server(int, int, const struct topology *,
+								 const struct server *);
@@ -0,0 +1,229 @@
+#include <errno.h>
+#include <limits.h>
+
+#include "tls.h"
+#include "util.h"
+
+#ifdef TLSFL
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+/* an OpenSSL built without kTLS hands nothing to the kernel */
+#ifndef BIO_get_ktls_send
+#define BIO_get_ktls_send(b) 0
+#endif
+#ifndef BIO_get_ktls_recv
+#define BIO_get_ktls_recv(b) 0
+#endif
+
+static SSL_CTX *ctx;
+
+static void tls_warn(const char *what)
+{
+  const char *why = ERR_reason_error_string(ERR_get_error());
+
+  log_warn("tls: %s: %s", what, why ? why : "unknown error");
+}
+
+/*
+ * Loads the certificate chain and key, before the chroot hides them. With
+ * ktls set OpenSSL moves the keys of every finished handshake into the
+ * kernel where the kernel and the cipher allow it.
+ */
+int tls_init(const char *cert, const char *key, int ktls)
+{
+  if (!(ctx = SSL_CTX_new(TLS_server_method())))
+  {
+    tls_warn("SSL_CTX_new");
+    return -1;
+  }
+  SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+  // a client closing an idle connection without close_notify is no error
+  SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF |
+                               (ktls ? SSL_OP_ENABLE_KTLS : 0));
+  SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE |
+                            SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                            SSL_MODE_RELEASE_BUFFERS);
+  if (SSL_CTX_use_certificate_chain_file(ctx, cert) != 1)
+  {
+    tls_warn(cert);
+    return -1;
+  }
+  if (SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1 ||
+      SSL_CTX_check_private_key(ctx) != 1)
+  {
+    tls_warn(key);
+    return -1;
+  }
+
+  return 0;
+}
+
+struct ssl_st *tls_new(int fd)
+{
+  SSL *ssl;
+
+  if (!(ssl = SSL_new(ctx)))
+  {
+    tls_warn("SSL_new");
+    return NULL;
+  }
+  if (SSL_set_fd(ssl, fd) != 1)
+  {
+    tls_warn("SSL_set_fd");
+    SSL_free(ssl);
+    return NULL;
+  }
+  SSL_set_accept_state(ssl);
+
+  return ssl;
+}
+
+/*
+ * One step of the handshake: 0 once it is done, with *mode telling which
+ * directions stayed with OpenSSL, 1 or 2 while it waits for the socket to
+ * become readable or writable, -1 if it failed.
+ */
+int tls_handshake(struct ssl_st *ssl, int *mode)
+{
+  int r;
+
+  ERR_clear_error();
+  if ((r = SSL_do_handshake(ssl)) != 1)
+  {
+    switch (SSL_get_error(ssl, r))
+    {
+    case SSL_ERROR_WANT_READ:
+      return 1;
+    case SSL_ERROR_WANT_WRITE:
+      return 2;
+    default:
+      return -1;
+    }
+  }
+
+  *mode = TLS_ON | TLS_READY;
+  if (!BIO_get_ktls_recv(SSL_get_rbio(ssl)))
+  {
+    *mode |= TLS_USER_RX;
+  }
+  if (!BIO_get_ktls_send(SSL_get_wbio(ssl)))
+  {
+    *mode |= TLS_USER_TX;
+  }
+
+  return 0;
+}
+
+/* SSL_read and SSL_write results as read(2) and write(2) would have them */
+static ssize_t result(struct ssl_st *ssl, int r)
+{
+  if (r > 0)
+  {
+    return r;
+  }
+  switch (SSL_get_error(ssl, r))
+  {
+  case SSL_ERROR_WANT_READ:
+  case SSL_ERROR_WANT_WRITE:
+    errno = EAGAIN;
+    return -1;
+  case SSL_ERROR_ZERO_RETURN:
+    return 0;
+  default:
+    errno = EIO;
+    return -1;
+  }
+}
+
+ssize_t tls_read(struct ssl_st *ssl, void *buf, size_t len)
+{
+  ERR_clear_error();
+
+  return result(ssl, SSL_read(ssl, buf, MIN(len, INT_MAX)));
+}
+
+/* a write that wants a retry must be retried with at least as many bytes */
+ssize_t tls_write(struct ssl_st *ssl, const void *buf, size_t len)
+{
+  ERR_clear_error();
+
+  return result(ssl, SSL_write(ssl, buf, MIN(len, INT_MAX)));
+}
+
+/* whether decrypted bytes wait in OpenSSL, where no event reports them */
+int tls_pending(struct ssl_st *ssl)
+{
+  return SSL_pending(ssl) > 0;
+}
+
+/*
+ * Without close_notify: it would be wrong once the kernel has the session,
+ * and every response is delimited without it.
+ */
+void tls_free(struct ssl_st *ssl)
+{
+  SSL_free(ssl);
+}
+
+#else
+
+int tls_init(const char *cert, const char *key, int ktls)
+{
+  (void)cert;
+  (void)key;
+  (void)ktls;
+  log_warn("tls: built without TLS support, rebuild with make TLS=1");
+
+  return -1;
+}
+
+struct ssl_st *tls_new(int fd)
+{
+  (void)fd;
+
+  return NULL;
+}
+
+int tls_handshake(struct ssl_st *ssl, int *mode)
+{
+  (void)ssl;
+  (void)mode;
+
+  return -1;
+}
+
+ssize_t tls_read(struct ssl_st *ssl, void *buf, size_t len)
+{
+  (void)ssl;
+  (void)buf;
+  (void)len;
+  errno = EIO;
+
+  return -1;
+}
+
+ssize_t tls_write(struct ssl_st *ssl, const void *buf, size_t len)
+{
+  (void)ssl;
+  (void)buf;
+  (void)len;
+  errno = EIO;
+
+  return -1;
+}
+
+int tls_pending(struct ssl_st *ssl)
+{
+  (void)ssl;
+
+  return 0;
+}
+
+void tls_free(struct ssl_st *ssl)
+{
+  (void)ssl;
+}
+
+#endif
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * HTTPS on a second listener, built with `make TLS=1`. OpenSSL does the
+ * handshake; with kTLS it then hands the session keys to the kernel
+ * (TCP_ULP "tls"), after which the socket takes plaintext and sendfile
+ * still works. A direction the kernel can't take stays with OpenSSL,
+ * through tls_read and tls_write.
+ */
+struct ssl_st;
+
+/* which directions of a TLS connection OpenSSL still encrypts */
+enum tls_mode
+{
+  TLS_ON = 1,      /* came in on the TLS listener */
+  TLS_READY = 2,   /* the handshake is done */
+  TLS_USER_RX = 4, /* reads go through tls_read */
+  TLS_USER_TX = 8, /* writes go through tls_write */
+};
+
+int tls_init(const char *, const char *, int);
+struct ssl_st *tls_new(int);
+int tls_handshake(struct ssl_st *, int *);
+ssize_t tls_read(struct ssl_st *, void *, size_t);
+ssize_t tls_write(struct ssl_st *, const void *, size_t);
+int tls_pending(struct ssl_st *);
+void tls_free(struct ssl_st *);
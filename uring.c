@@ -0,0 +1,202 @@
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+#include "util.h"
+
+static int sys_setup(unsigned entries, struct io_uring_params *p)
+{
+  return syscall(SYS_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned to_submit)
+{
+  return syscall(SYS_io_uring_enter, fd, to_submit, 0, 0, NULL, 0);
+}
+
+static int sys_register(int fd, unsigned op, void *arg, unsigned nargs)
+{
+  return syscall(SYS_io_uring_register, fd, op, arg, nargs);
+}
+
+/* on failure the ring stays unusable (m_fd < 0) and callers read otherwise */
+int uring_init(struct uring *r, unsigned entries)
+{
+  struct io_uring_params p;
+  char *sq, *cq;
+
+  memset(r, 0, sizeof(*r));
+  r->m_fd = r->m_eventfd = -1;
+  memset(&p, 0, sizeof(p));
+
+  if ((r->m_fd = sys_setup(entries, &p)) < 0)
+  {
+    log_warn("io_uring_setup:");
+    return -1;
+  }
+
+  r->m_sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->m_cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    r->m_sq_map_len = r->m_cq_map_len = MAX(r->m_sq_map_len, r->m_cq_map_len);
+  }
+  if ((r->m_sq_map = mmap(NULL, r->m_sq_map_len, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, r->m_fd,
+                          IORING_OFF_SQ_RING)) == MAP_FAILED)
+  {
+    log_warn("mmap:");
+    goto err;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+  {
+    r->m_cq_map = r->m_sq_map;
+  }
+  else if ((r->m_cq_map = mmap(NULL, r->m_cq_map_len, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, r->m_fd,
+                               IORING_OFF_CQ_RING)) == MAP_FAILED)
+  {
+    log_warn("mmap:");
+    goto err;
+  }
+  r->m_sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  if ((r->m_sqes = mmap(NULL, r->m_sqes_len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, r->m_fd,
+                        IORING_OFF_SQES)) == MAP_FAILED)
+  {
+    log_warn("mmap:");
+    goto err;
+  }
+
+  sq = r->m_sq_map;
+  cq = r->m_cq_map;
+  r->m_sq_head = (unsigned *)(sq + p.sq_off.head);
+  r->m_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  r->m_sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  r->m_sq_array = (unsigned *)(sq + p.sq_off.array);
+  r->m_cq_head = (unsigned *)(cq + p.cq_off.head);
+  r->m_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  r->m_cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  r->m_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  if ((r->m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+  {
+    log_warn("eventfd:");
+    goto err;
+  }
+  if (sys_register(r->m_fd, IORING_REGISTER_EVENTFD, &r->m_eventfd, 1) < 0)
+  {
+    log_warn("io_uring_register:");
+    goto err;
+  }
+
+  return 0;
+err:
+  if (r->m_eventfd >= 0)
+  {
+    close(r->m_eventfd);
+  }
+  if (r->m_sqes && r->m_sqes != MAP_FAILED)
+  {
+    munmap(r->m_sqes, r->m_sqes_len);
+  }
+  if (r->m_cq_map && r->m_cq_map != MAP_FAILED && r->m_cq_map != r->m_sq_map)
+  {
+    munmap(r->m_cq_map, r->m_cq_map_len);
+  }
+  if (r->m_sq_map && r->m_sq_map != MAP_FAILED)
+  {
+    munmap(r->m_sq_map, r->m_sq_map_len);
+  }
+  close(r->m_fd);
+  r->m_fd = r->m_eventfd = -1;
+
+  return -1;
+}
+
+/*
+ * Queues a single read and submits it right away. If the submit fails the
+ * entry is taken back, so it can't go out with a later one into a buffer
+ * the caller has given up on.
+ */
+int uring_read(struct uring *r, int fd, void *buf, size_t len, off_t off,
+               void *user_data)
+{
+  struct io_uring_sqe *sqe;
+  unsigned tail, idx;
+
+  tail = *r->m_sq_tail;
+  if (tail - __atomic_load_n(r->m_sq_head, __ATOMIC_ACQUIRE) >
+      *r->m_sq_mask)
+  {
+    errno = EBUSY;
+    return -1;
+  }
+  idx = tail & *r->m_sq_mask;
+  sqe = &r->m_sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->off = off;
+  sqe->addr = (uintptr_t)buf;
+  sqe->len = len;
+  sqe->user_data = (uintptr_t)user_data;
+  r->m_sq_array[idx] = idx;
+  __atomic_store_n(r->m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  while (sys_enter(r->m_fd, 1) < 0)
+  {
+    if (errno == EINTR)
+    {
+      continue;
+    }
+    // only enter consumes entries; if it took this one anyway, it's in flight
+    if (__atomic_load_n(r->m_sq_head, __ATOMIC_ACQUIRE) != tail)
+    {
+      break;
+    }
+    __atomic_store_n(r->m_sq_tail, tail, __ATOMIC_RELEASE);
+    log_warn("io_uring_enter:");
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Clears the completion eventfd. Call before draining with uring_reap, a
+ * completion posted afterwards raises a fresh event.
+ */
+void uring_ack(struct uring *r)
+{
+  uint64_t cnt;
+
+  if (read(r->m_eventfd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+  {
+    log_warn("read:");
+  }
+}
+
+int uring_reap(struct uring *r, void **user_data, int *res)
+{
+  struct io_uring_cqe *cqe;
+  unsigned head;
+
+  head = *r->m_cq_head;
+  if (head == __atomic_load_n(r->m_cq_tail, __ATOMIC_ACQUIRE))
+  {
+    return 0;
+  }
+  cqe = &r->m_cqes[head & *r->m_cq_mask];
+  *user_data = (void *)(uintptr_t)cqe->user_data;
+  *res = cqe->res;
+  __atomic_store_n(r->m_cq_head, head + 1, __ATOMIC_RELEASE);
+
+  return 1;
+}
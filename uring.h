@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * Minimal io_uring wrapper for file reads, one ring per worker. Completions
+ * are announced on m_eventfd, which goes into the worker's event queue like
+ * any other descriptor, so it works the same with select and epoll.
+ */
+struct uring
+{
+  int m_fd;
+  int m_eventfd;
+  unsigned *m_sq_head;
+  unsigned *m_sq_tail;
+  unsigned *m_sq_mask;
+  unsigned *m_sq_array;
+  struct io_uring_sqe *m_sqes;
+  unsigned *m_cq_head;
+  unsigned *m_cq_tail;
+  unsigned *m_cq_mask;
+  struct io_uring_cqe *m_cqes;
+  void *m_sq_map;
+  size_t m_sq_map_len;
+  void *m_cq_map;
+  size_t m_cq_map_len;
+  size_t m_sqes_len;
+};
+
+int uring_init(struct uring *, unsigned);
+int uring_read(struct uring *, int, void *, size_t, off_t, void *);
+void uring_ack(struct uring *);
+int uring_reap(struct uring *, void **, int *);
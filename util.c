@@ -48,7 +48,7 @@ void log_warn(const char *fmt, ...)
   va_end(ap);
 }
 
-void log_info(const char *fmt, ...)
+void log_print(const char *fmt, ...)
 {
   va_list ap;
 
@@ -200,14 +200,14 @@ int buffer_append(struct my_buffer *buf, const char *suffixfmt, ...)
   int ret;
 
   va_start(ap, suffixfmt);
-  ret = vsnprintf(buf->data + buf->length, sizeof(buf->data) - buf->length,
+  ret = vsnprintf(buf->data + buf->length, buf->size - buf->length,
                   suffixfmt, ap);
   va_end(ap);
 
-  if (ret < 0 || (size_t)ret >= (sizeof(buf->data) - buf->length))
+  if (ret < 0 || (size_t)ret >= (buf->size - buf->length))
   {
 
-    memset(buf->data + buf->length, 0, sizeof(buf->data) - buf->length);
+    memset(buf->data + buf->length, 0, buf->size - buf->length);
     return 1;
   }
 
@@ -216,6 +216,34 @@ int buffer_append(struct my_buffer *buf, const char *suffixfmt, ...)
   return 0;
 }
 
+int buffer_append_mem(struct my_buffer *buf, const void *mem, size_t len)
+{
+  if (len > buf->size - buf->length)
+  {
+    return 1;
+  }
+
+  memcpy(buf->data + buf->length, mem, len);
+  buf->length += len;
+
+  return 0;
+}
+
+void buffer_reset(struct my_buffer *buf)
+{
+  buf->offset = 0;
+  buf->length = 0;
+}
+
+void buffer_consume(struct my_buffer *buf, size_t n)
+{
+  buf->offset += n;
+  if (buf->offset >= buf->length)
+  {
+    buffer_reset(buf);
+  }
+}
+
 long long string_to_num(const char *numstr, long long minval, long long maxval,
                         const char **errstrp)
 {
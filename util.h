@@ -6,8 +6,15 @@
 
 #include "configuration.h"
 
+/*
+ * Unconsumed data lives in [offset, length). Consumers only advance offset;
+ * once everything is consumed both are rewound, so length > 0 still means
+ * "something pending".
+ */
 struct my_buffer {
-  char data[BUFFER_SIZE];
+  char *data;
+  size_t size;
+  size_t offset;
   size_t length;
 };
 
@@ -18,10 +25,37 @@ struct my_buffer {
 #undef LEN
 #define LEN(x) (sizeof(x) / sizeof *(x))
 
+/* counters with a single writer that other threads may read at any time */
+#define COUNTER_ADD(c, n) __atomic_store_n(&(c), (c) + (n), __ATOMIC_RELAXED)
+#define COUNTER_SET(c, v) __atomic_store_n(&(c), (v), __ATOMIC_RELAXED)
+#define COUNTER_GET(c) __atomic_load_n(&(c), __ATOMIC_RELAXED)
+
 extern char *argv0;
 
+#define LEVEL_DEBUG 0
+#define LEVEL_INFO 1
+#define LEVEL_WARN 2
+
+/* calls below LOG_LEVEL compile to nothing but are still type-checked */
+#define LOG_NOP(...)                                                         \
+  do                                                                         \
+  {                                                                          \
+    if (0)                                                                   \
+      log_print(__VA_ARGS__);                                                \
+  } while (0)
+#if LOG_LEVEL <= LEVEL_DEBUG
+#define log_debug(...) log_print(__VA_ARGS__)
+#else
+#define log_debug(...) LOG_NOP(__VA_ARGS__)
+#endif
+#if LOG_LEVEL <= LEVEL_INFO
+#define log_info(...) log_print(__VA_ARGS__)
+#else
+#define log_info(...) LOG_NOP(__VA_ARGS__)
+#endif
+
 void log_warn(const char *fmt, ...);
-void log_info(const char *fmt, ...);
+void log_print(const char *fmt, ...);
 void die(const char *fmt, ...);
 
 int esnprintf(char *, size_t, const char *, ...);
@@ -34,3 +68,6 @@ long long string_to_num(const char *, long long, long long, const char **);
 int append_before(char *, size_t, const char *);
 
 int buffer_append(struct my_buffer *, const char *, ...);
+int buffer_append_mem(struct my_buffer *, const void *, size_t);
+void buffer_reset(struct my_buffer *);
+void buffer_consume(struct my_buffer *, size_t);